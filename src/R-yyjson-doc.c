@@ -0,0 +1,293 @@
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "yyjson.h"
+#include "R-yyjson-schema.h"
+#include "R-yyjson-state.h"
+#include "R-yyjson-parse.h"
+#include "R-yyjson-doc.h"
+#include "file-map.h"
+
+#define DOC_TAG "yyjson_doc"
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Persistent document handles.
+//
+// An external pointer to an immutable 'yyjson_doc', so that a large
+// document is only parsed once, and then subtrees can be pulled out
+// with JSON Pointers (RFC 6901) e.g. "/catalog/items/17".
+//
+// Only the value at the pointer is converted to R.  Structural queries
+// (type, length, keys) make no R objects other than the answer.
+//
+// The doc is freed by a finalizer when the handle is garbage collected.
+// If the doc was parsed in-situ, the buffer it points into is held by a 
+// second external pointer (with its own finalizer) protected by the first.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+static void doc_finalizer(SEXP doc_) {
+  yyjson_doc *doc = (yyjson_doc *)R_ExternalPtrAddr(doc_);
+  if (doc != NULL) {
+    yyjson_doc_free(doc);
+    R_ClearExternalPtr(doc_);
+  }
+}
+
+
+static void map_finalizer(SEXP map_) {
+  file_map_t *map = (file_map_t *)R_ExternalPtrAddr(map_);
+  if (map != NULL) {
+    file_map_close(map);
+    free(map);
+    R_ClearExternalPtr(map_);
+  }
+}
+
+
+static SEXP make_doc_handle(yyjson_doc *doc, file_map_t *map) {
+  SEXP map_ = PROTECT(R_MakeExternalPtr(map, R_NilValue, R_NilValue));
+  if (map != NULL) {
+    R_RegisterCFinalizer(map_, map_finalizer);
+  }
+  
+  SEXP doc_ = PROTECT(R_MakeExternalPtr(doc, Rf_install(DOC_TAG), map_));
+  R_RegisterCFinalizer(doc_, doc_finalizer);
+  Rf_setAttrib(doc_, R_ClassSymbol, Rf_mkString(DOC_TAG));
+  UNPROTECT(2);
+  return doc_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Get the document from a handle created by 'json_open_file()'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+yyjson_doc *get_doc_handle(SEXP doc_) {
+  if (TYPEOF(doc_) != EXTPTRSXP || R_ExternalPtrTag(doc_) != Rf_install(DOC_TAG)) {
+    Rf_error("Expecting a 'yyjson_doc' from 'json_open_file()' or 'json_open_str()'");
+  }
+  yyjson_doc *doc = (yyjson_doc *)R_ExternalPtrAddr(doc_);
+  if (doc == NULL) {
+    Rf_error("'yyjson_doc' is no longer valid (documents can't be saved and re-loaded)");
+  }
+  return doc;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Resolve a JSON Pointer.  "" is the root of the document.
+// An error is raised if the pointer does not resolve to a value.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+yyjson_val *json_pointer_get(yyjson_doc *doc, SEXP ptr_, state_t *state) {
+  if (ptr_ == NA_STRING) {
+    error_and_destroy_state(state, "JSON pointer must not be NA");
+  }
+
+  const char *ptr = CHAR(ptr_);
+  yyjson_ptr_err err;
+  yyjson_val *val = yyjson_doc_ptr_getx(doc, ptr, (size_t)LENGTH(ptr_), &err);
+
+  if (val == NULL) {
+    if (err.code == YYJSON_PTR_ERR_RESOLVE) {
+      error_and_destroy_state(state, "JSON pointer not found: '%s'", ptr);
+    }
+    error_and_destroy_state(state, "Invalid JSON pointer '%s': %s", ptr, err.msg);
+  }
+
+  return val;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Convert the value at each pointer to R.
+//
+// A single pointer gives the value itself.  Otherwise a list named by the
+// names of 'ptrs_' (where given), or else by the pointers themselves.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP json_pointers_as_robj(yyjson_doc *doc, SEXP ptrs_, parse_options *opt, state_t *state) {
+
+  if (!Rf_isString(ptrs_)) {
+    error_and_destroy_state(state, "JSON pointer must be a character vector");
+  }
+
+  R_xlen_t n = Rf_xlength(ptrs_);
+  if (n == 1) {
+    return json_as_robj(json_pointer_get(doc, STRING_ELT(ptrs_, 0), state), opt, state);
+  }
+
+  SEXP res_ = PROTECT(Rf_allocVector(VECSXP, n));
+  SEXP nms_ = PROTECT(Rf_allocVector(STRSXP, n));
+  SEXP ptr_nms_ = Rf_getAttrib(ptrs_, R_NamesSymbol);
+
+  for (R_xlen_t i = 0; i < n; i++) {
+    yyjson_val *val = json_pointer_get(doc, STRING_ELT(ptrs_, i), state);
+    SET_VECTOR_ELT(res_, i, json_as_robj(val, opt, state));
+
+    SEXP nm_ = Rf_isNull(ptr_nms_) ? R_BlankString : STRING_ELT(ptr_nms_, i);
+    if (nm_ == NA_STRING || nm_ == R_BlankString) {
+      nm_ = STRING_ELT(ptrs_, i);
+    }
+    SET_STRING_ELT(nms_, i, nm_);
+  }
+  Rf_setAttrib(res_, R_NamesSymbol, nms_);
+
+  UNPROTECT(2);
+  return res_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Convert a freshly parsed document to R.
+// This is the root, unless the 'pointer' option selects part of it.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP json_doc_as_robj(yyjson_doc *doc, parse_options *opt, state_t *state) {
+  if (Rf_isNull(opt->pointer)) {
+    return json_as_robj(yyjson_doc_get_root(doc), opt, state);
+  }
+  return json_pointers_as_robj(doc, opt->pointer, opt, state);
+}
+
+
+//===========================================================================
+// Open a JSON file (which may be gzipped) and hold the parsed document
+//===========================================================================
+SEXP json_open_file_(SEXP filename_, SEXP parse_opts_) {
+
+  const char *filename = R_ExpandFileName(CHAR(STRING_ELT(filename_, 0)));
+  parse_options opt = create_parse_options(parse_opts_);
+
+  yyjson_read_err err;
+  state_t *state = create_state();
+  state_read_file(state, filename, opt.yyjson_read_flag & ~YYJSON_READ_INSITU, &err);
+  if (state->doc == NULL) {
+    error_and_destroy_state(state, "Error parsing JSON file '%s' [Loc: %.0f]: %s", 
+                            filename, (double)err.pos, err.msg);
+  }
+
+  // The handle takes ownership of the doc and its input buffer
+  yyjson_doc *doc = state->doc;
+  file_map_t *map = state->map;
+  state->doc = NULL;
+  state->map = NULL;
+  destroy_state(state);
+
+  return make_doc_handle(doc, map);
+}
+
+
+//===========================================================================
+// Parse a JSON string and hold the parsed document
+//===========================================================================
+SEXP json_open_str_(SEXP str_, SEXP parse_opts_) {
+
+  if (!Rf_isString(str_) || Rf_length(str_) != 1 || STRING_ELT(str_, 0) == NA_STRING) {
+    Rf_error("json_open_str(): 'str' must be a single string");
+  }
+
+  parse_options opt = create_parse_options(parse_opts_);
+  SEXP elem_ = STRING_ELT(str_, 0);
+
+  yyjson_read_err err;
+  yyjson_doc *doc = yyjson_read_opts((char *)CHAR(elem_), (size_t)LENGTH(elem_),
+                                     opt.yyjson_read_flag & ~YYJSON_READ_INSITU, NULL, &err);
+  if (doc == NULL) {
+    Rf_error("Error parsing JSON [Loc: %.0f]: %s", (double)err.pos, err.msg);
+  }
+
+  return make_doc_handle(doc, NULL);
+}
+
+
+//===========================================================================
+// Convert the value(s) at JSON pointer(s) to R
+//===========================================================================
+SEXP json_doc_get_(SEXP doc_, SEXP ptrs_, SEXP parse_opts_) {
+
+  yyjson_doc *doc = get_doc_handle(doc_);
+  parse_options opt = create_parse_options(parse_opts_);
+
+  // 'state->doc' is left as NULL, so the document is never freed here
+  state_t *state = create_state();
+  SEXP res_ = PROTECT(json_pointers_as_robj(doc, ptrs_, &opt, state));
+
+  destroy_state(state);
+  UNPROTECT(1);
+  return res_;
+}
+
+
+//===========================================================================
+// Type of the value at a JSON pointer
+//===========================================================================
+SEXP json_doc_type_(SEXP doc_, SEXP ptr_) {
+
+  yyjson_val *val = json_pointer_get(get_doc_handle(doc_), Rf_asChar(ptr_), NULL);
+
+  const char *type;
+  switch (yyjson_get_type(val)) {
+  case YYJSON_TYPE_NULL:
+    type = "null";
+    break;
+  case YYJSON_TYPE_BOOL:
+    type = "boolean";
+    break;
+  case YYJSON_TYPE_NUM:
+    type = yyjson_is_real(val) ? "double" : "integer";
+    break;
+  case YYJSON_TYPE_STR:
+    type = "string";
+    break;
+  case YYJSON_TYPE_ARR:
+    type = "array";
+    break;
+  case YYJSON_TYPE_OBJ:
+    type = "object";
+    break;
+  default:
+    type = "unknown";
+  }
+
+  return Rf_mkString(type);
+}
+
+
+//===========================================================================
+// Number of members of an []-array or {}-object. 1 for a scalar value
+//===========================================================================
+SEXP json_doc_length_(SEXP doc_, SEXP ptr_) {
+
+  yyjson_val *val = json_pointer_get(get_doc_handle(doc_), Rf_asChar(ptr_), NULL);
+
+  double len = yyjson_is_ctn(val) ? (double)yyjson_get_len(val) : 1;
+  return Rf_ScalarReal(len);
+}
+
+
+//===========================================================================
+// Keys of a {}-object.  NULL for any other value
+//===========================================================================
+SEXP json_doc_keys_(SEXP doc_, SEXP ptr_) {
+
+  yyjson_val *val = json_pointer_get(get_doc_handle(doc_), Rf_asChar(ptr_), NULL);
+  if (!yyjson_is_obj(val)) {
+    return R_NilValue;
+  }
+
+  SEXP keys_ = PROTECT(Rf_allocVector(STRSXP, (R_xlen_t)yyjson_obj_size(val)));
+
+  yyjson_val *key;
+  yyjson_obj_iter iter = yyjson_obj_iter_with(val);
+  for (R_xlen_t i = 0; (key = yyjson_obj_iter_next(&iter)); i++) {
+    SET_STRING_ELT(keys_, i, Rf_mkCharLenCE(yyjson_get_str(key), (int)yyjson_get_len(key), CE_UTF8));
+  }
+
+  UNPROTECT(1);
+  return keys_;
+}
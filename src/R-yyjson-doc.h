@@ -0,0 +1,8 @@
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// JSON Pointer access to a parsed document.  See 'R-yyjson-doc.c'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+yyjson_doc *get_doc_handle(SEXP doc_);
+yyjson_val *json_pointer_get(yyjson_doc *doc, SEXP ptr_, state_t *state);
+SEXP json_pointers_as_robj(yyjson_doc *doc, SEXP ptrs_, parse_options *opt, state_t *state);
+SEXP json_doc_as_robj(yyjson_doc *doc, parse_options *opt, state_t *state);
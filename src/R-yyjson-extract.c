@@ -0,0 +1,496 @@
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "yyjson.h"
+#include "R-yyjson-schema.h"
+#include "R-yyjson-state.h"
+#include "R-yyjson-parse.h"
+#include "R-yyjson-doc.h"
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Columnar extraction with JSONPath
+//
+// Each path is compiled once into a sequence of steps, and then evaluated
+// directly on the yyjson tree of every document.  The matching values
+// are gathered (in document order) and converted to a single atomic
+// vector, with the type chosen from the 'type_bitset' of all matches -
+// just as for a JSON []-array.
+//
+// Supported JSONPath:
+//   $               root (optional)
+//   .name ['name']  child of an object
+//   .* [*]          every element of an array, or value of an object
+//   [n]             array element.  Negative counts from the end
+//   [start:end:step] array slice. Any part may be omitted. step > 0
+//   ..name ..*      recursive descent (i.e. this step at any depth)
+//
+// If the last step is '.name', a value which was matched by the steps 
+// before it, but has no member 'name', gives a missing value (NA).  So e.g.
+// '$.items[*].price' has one element for each item.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#define STEP_CHILD    1
+#define STEP_WILDCARD 2
+#define STEP_INDEX    3
+#define STEP_SLICE    4
+
+#define SLICE_UNSET   LONG_MIN
+
+typedef struct {
+  int type;
+  bool recursive;     // step preceded by '..'
+  const char *name;   // STEP_CHILD
+  size_t name_len;
+  long start;         // STEP_INDEX uses 'start' only
+  long end;
+  long step;
+} path_step_t;
+
+typedef struct {
+  path_step_t *steps;
+  int nsteps;
+} json_path_t;
+
+// Growable buffer of matched values. Memory is from R_alloc()
+typedef struct {
+  yyjson_val **vals;
+  R_xlen_t n;
+  R_xlen_t capacity;
+} match_buf_t;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parse an integer for an index/slice.
+// @return false if there are no digits
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool parse_long(const char **p, long *val) {
+  char *end;
+  long x = strtol(*p, &end, 10);
+  if (end == *p) return false;
+  *p  = end;
+  *val = x;
+  return true;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Compile a JSONPath string into steps. Raises an R error if the path
+// isn't understood.  Memory is from R_alloc()
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static json_path_t compile_json_path(const char *path) {
+
+  // There can't be more steps than characters
+  size_t len = strlen(path);
+  json_path_t jp = {
+    .steps  = (path_step_t *)R_alloc(len + 1, sizeof(path_step_t)),
+    .nsteps = 0
+  };
+
+  const char *p = path;
+  if (*p == '$') p++;
+
+  while (*p) {
+    path_step_t *step = &jp.steps[jp.nsteps];
+    *step = (path_step_t){ .type = 0, .recursive = false, .name = NULL, .name_len = 0,
+                           .start = SLICE_UNSET, .end = SLICE_UNSET, .step = 1 };
+
+    bool dotted = false;
+    if (p[0] == '.' && p[1] == '.') {
+      step->recursive = true;
+      p += 2;
+      dotted = *p != '[';
+    } else if (*p == '.') {
+      p++;
+      dotted = true;
+    } else if (*p != '[') {
+      // A leading name without '$.' e.g. "items[*]"
+      if (jp.nsteps > 0 || p != path) {
+        Rf_error("Invalid JSONPath '%s' at position %i", path, (int)(p - path));
+      }
+      dotted = true;
+    }
+
+    if (dotted) {
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      // .name or .*
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      const char *start = p;
+      while (*p && *p != '.' && *p != '[') p++;
+      if (p == start) {
+        Rf_error("Invalid JSONPath '%s': empty name at position %i", path, (int)(p - path));
+      }
+      if (p - start == 1 && *start == '*') {
+        step->type = STEP_WILDCARD;
+      } else {
+        step->type     = STEP_CHILD;
+        step->name     = start;
+        step->name_len = (size_t)(p - start);
+      }
+    } else {
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      // [*] ['name'] [n] [start:end:step]
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      p++;
+      if (*p == '*') {
+        step->type = STEP_WILDCARD;
+        p++;
+      } else if (*p == '\'' || *p == '"') {
+        char quote = *p++;
+        const char *start = p;
+        while (*p && *p != quote) p++;
+        if (*p != quote) {
+          Rf_error("Invalid JSONPath '%s': unterminated name", path);
+        }
+        step->type     = STEP_CHILD;
+        step->name     = start;
+        step->name_len = (size_t)(p - start);
+        p++;
+      } else {
+        bool has_start = parse_long(&p, &step->start);
+        if (*p == ':') {
+          step->type = STEP_SLICE;
+          p++;
+          parse_long(&p, &step->end);
+          if (*p == ':') {
+            p++;
+            if (parse_long(&p, &step->step) && step->step < 1) {
+              Rf_error("Invalid JSONPath '%s': slice step must be positive", path);
+            }
+          }
+        } else if (has_start) {
+          step->type = STEP_INDEX;
+        } else {
+          Rf_error("Invalid JSONPath '%s' at position %i", path, (int)(p - path));
+        }
+      }
+      if (*p != ']') {
+        Rf_error("Invalid JSONPath '%s': expected ']' at position %i", path, (int)(p - path));
+      }
+      p++;
+    }
+
+    jp.nsteps++;
+  }
+
+  return jp;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Add a value to the matches
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void match_buf_push(match_buf_t *buf, yyjson_val *val) {
+  if (buf->n == buf->capacity) {
+    R_xlen_t capacity = buf->capacity == 0 ? 64 : 2 * buf->capacity;
+    yyjson_val **vals = (yyjson_val **)R_alloc((size_t)capacity, sizeof(yyjson_val *));
+    if (buf->n > 0) {
+      memcpy(vals, buf->vals, (size_t)buf->n * sizeof(yyjson_val *));
+    }
+    buf->vals     = vals;
+    buf->capacity = capacity;
+  }
+  buf->vals[buf->n++] = val;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Evaluate steps [i, nsteps) of the path starting at 'val'
+// A missing value is pushed as NULL
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void eval_json_path(yyjson_val *val, json_path_t *jp, int i, match_buf_t *buf) {
+
+  if (i == jp->nsteps) {
+    match_buf_push(buf, val);
+    return;
+  }
+
+  path_step_t *step = &jp->steps[i];
+  yyjson_val *elem;
+
+  switch (step->type) {
+  case STEP_CHILD:
+    elem = yyjson_is_obj(val) ? yyjson_obj_getn(val, step->name, step->name_len) : NULL;
+    if (elem != NULL) {
+      eval_json_path(elem, jp, i + 1, buf);
+    } else if (i == jp->nsteps - 1 && !step->recursive) {
+      match_buf_push(buf, NULL);
+    }
+    break;
+  case STEP_WILDCARD:
+    if (yyjson_is_arr(val)) {
+      yyjson_arr_iter iter = yyjson_arr_iter_with(val);
+      while ((elem = yyjson_arr_iter_next(&iter))) {
+        eval_json_path(elem, jp, i + 1, buf);
+      }
+    } else if (yyjson_is_obj(val)) {
+      yyjson_val *key;
+      yyjson_obj_iter iter = yyjson_obj_iter_with(val);
+      while ((key = yyjson_obj_iter_next(&iter))) {
+        eval_json_path(yyjson_obj_iter_get_val(key), jp, i + 1, buf);
+      }
+    }
+    break;
+  case STEP_INDEX:
+    if (yyjson_is_arr(val)) {
+      long len = (long)yyjson_arr_size(val);
+      long idx = step->start < 0 ? step->start + len : step->start;
+      if (idx >= 0 && idx < len) {
+        eval_json_path(yyjson_arr_get(val, (size_t)idx), jp, i + 1, buf);
+      }
+    }
+    break;
+  case STEP_SLICE:
+    if (yyjson_is_arr(val)) {
+      long len   = (long)yyjson_arr_size(val);
+      long start = step->start == SLICE_UNSET ? 0   : step->start;
+      long end   = step->end   == SLICE_UNSET ? len : step->end;
+      if (start < 0) start += len;
+      if (end   < 0) end   += len;
+      if (start < 0) start = 0;
+      if (end > len) end   = len;
+
+      yyjson_arr_iter iter = yyjson_arr_iter_with(val);
+      for (long idx = 0; idx < end && (elem = yyjson_arr_iter_next(&iter)); idx++) {
+        if (idx >= start && (idx - start) % step->step == 0) {
+          eval_json_path(elem, jp, i + 1, buf);
+        }
+      }
+    }
+    break;
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Recursive descent: try this same step on every descendant
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  if (step->recursive) {
+    if (yyjson_is_arr(val)) {
+      yyjson_arr_iter iter = yyjson_arr_iter_with(val);
+      while ((elem = yyjson_arr_iter_next(&iter))) {
+        if (yyjson_is_ctn(elem)) eval_json_path(elem, jp, i, buf);
+      }
+    } else if (yyjson_is_obj(val)) {
+      yyjson_val *key;
+      yyjson_obj_iter iter = yyjson_obj_iter_with(val);
+      while ((key = yyjson_obj_iter_next(&iter))) {
+        elem = yyjson_obj_iter_get_val(key);
+        if (yyjson_is_ctn(elem)) eval_json_path(elem, jp, i, buf);
+      }
+    }
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Convert the matched values to the best R vector for their types
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static SEXP matches_as_robj(match_buf_t *buf, parse_options *opt, state_t *state) {
+
+  unsigned int type_bitset = 0;
+  for (R_xlen_t i = 0; i < buf->n; i++) {
+    if (buf->vals[i] != NULL) {
+      type_bitset = update_type_bitset(type_bitset, buf->vals[i], opt);
+    }
+  }
+  unsigned int sexp_type = get_best_sexp_to_represent_type_bitset(type_bitset, opt);
+
+  R_xlen_t n = buf->n;
+  SEXP res_ = PROTECT(Rf_allocVector(sexp_type == INT64SXP ? REALSXP : sexp_type, n));
+
+  switch(sexp_type) {
+  case LGLSXP: {
+    int32_t *ptr = INTEGER(res_);
+    for (R_xlen_t i = 0; i < n; i++) ptr[i] = json_val_to_logical(buf->vals[i], opt);
+  }
+    break;
+  case INTSXP: {
+    int32_t *ptr = INTEGER(res_);
+    for (R_xlen_t i = 0; i < n; i++) ptr[i] = json_val_to_integer(buf->vals[i], opt);
+  }
+    break;
+  case REALSXP: {
+    double *ptr = REAL(res_);
+    for (R_xlen_t i = 0; i < n; i++) ptr[i] = json_val_to_double(buf->vals[i], opt);
+  }
+    break;
+  case INT64SXP: {
+    long long *ptr = (long long *)REAL(res_);
+    for (R_xlen_t i = 0; i < n; i++) ptr[i] = json_val_to_integer64(buf->vals[i], opt);
+    Rf_setAttrib(res_, R_ClassSymbol, Rf_mkString("integer64"));
+  }
+    break;
+  case STRSXP:
+    for (R_xlen_t i = 0; i < n; i++) {
+      SET_STRING_ELT(res_, i, json_val_to_charsxp(buf->vals[i], opt));
+    }
+    break;
+  case VECSXP: {
+    parse_options nested;
+    parse_options *nested_opt = nested_parse_options(opt, &nested);
+    for (R_xlen_t i = 0; i < n; i++) {
+      if (buf->vals[i] != NULL) {
+        SET_VECTOR_ELT(res_, i, json_as_robj(buf->vals[i], nested_opt, state));
+      }
+    }
+  }
+    break;
+  default:
+    error_and_destroy_state(state, "json_extract(): unhandled type %i", sexp_type);
+  }
+
+  UNPROTECT(1);
+  return res_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parse the input documents into 'state->docs'
+//
+// Files are read with 'state_read_file()' (so may be compressed, or a 
+// pipe), and the input a doc was parsed in-situ from is kept with it 
+// in 'state->maps'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void extract_parse_docs(SEXP x_, bool is_file, parse_options *opt, state_t *state) {
+
+  yyjson_read_flag flag = opt->yyjson_read_flag & ~YYJSON_READ_INSITU;
+  R_xlen_t n = TYPEOF(x_) == RAWSXP ? 1 : Rf_xlength(x_);
+
+  state->docs = (yyjson_doc **)calloc((size_t)n + 1, sizeof(yyjson_doc *));
+  if (state->docs == NULL) {
+    error_and_destroy_state(state, "json_extract(): Memory allocation failed");
+  }
+  state->ndocs = n;
+  
+  if (is_file) {
+    state->maps = (struct file_map **)calloc((size_t)n + 1, sizeof(struct file_map *));
+    if (state->maps == NULL) {
+      error_and_destroy_state(state, "json_extract(): Memory allocation failed");
+    }
+  }
+
+  yyjson_read_err err;
+
+  if (TYPEOF(x_) == RAWSXP) {
+    state->docs[0] = yyjson_read_opts((char *)RAW(x_), (size_t)Rf_xlength(x_),
+                                      flag | YYJSON_READ_STOP_WHEN_DONE, NULL, &err);
+    if (state->docs[0] == NULL) {
+      error_and_destroy_state(state, "Error parsing JSON [Loc: %.0f]: %s", (double)err.pos, err.msg);
+    }
+    return;
+  }
+
+  for (R_xlen_t i = 0; i < n; i++) {
+    SEXP elem_ = STRING_ELT(x_, i);
+    if (elem_ == NA_STRING) continue;
+
+    if (is_file) {
+      const char *filename = R_ExpandFileName(CHAR(elem_));
+      if (state_read_file(state, filename, flag, &err) == NULL) {
+        error_and_destroy_state(state, "Error parsing JSON file '%s' [Loc: %.0f]: %s",
+                                filename, (double)err.pos, err.msg);
+      }
+      state->docs[i] = state->doc;
+      state->maps[i] = state->map;
+      state->doc = NULL;
+      state->map = NULL;
+    } else {
+      state->docs[i] = yyjson_read_opts((char *)CHAR(elem_), (size_t)LENGTH(elem_), flag, NULL, &err);
+      if (state->docs[i] == NULL) {
+        error_and_destroy_state(state, "Couldn't parse JSON in element %.0f [Loc: %.0f]: %s",
+                                (double)(i + 1), (double)err.pos, err.msg);
+      }
+    }
+  }
+}
+
+
+//===========================================================================
+// Extract the values matching each JSONPath as a vector
+//
+// @param x_ character vector of JSON documents (or filenames), a raw vector
+//        holding a single document, or a document from 'json_open_file()'
+// @param paths_ character vector of JSONPath expressions
+// @param is_file_ logical. Is 'x_' a vector of filenames?
+// @param parse_opts_ parse options
+//
+// @return named list with a vector for each path. Matches from all
+//         documents are concatenated in order.  See above for missing values
+//===========================================================================
+SEXP json_extract_(SEXP x_, SEXP paths_, SEXP is_file_, SEXP parse_opts_) {
+
+  if (!Rf_isString(paths_)) {
+    Rf_error("json_extract(): 'paths' must be a character vector");
+  }
+  if (TYPEOF(x_) != EXTPTRSXP && TYPEOF(x_) != RAWSXP && !Rf_isString(x_)) {
+    Rf_error("json_extract(): 'x' must be a character vector, raw vector or 'yyjson_doc'");
+  }
+
+  parse_options opt = create_parse_options(parse_opts_);
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Compile the paths before doing any parsing
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  int npaths = Rf_length(paths_);
+  json_path_t *paths = (json_path_t *)R_alloc((size_t)npaths + 1, sizeof(json_path_t));
+  for (int i = 0; i < npaths; i++) {
+    if (STRING_ELT(paths_, i) == NA_STRING) {
+      Rf_error("json_extract(): 'paths' must not contain NA");
+    }
+    paths[i] = compile_json_path(CHAR(STRING_ELT(paths_, i)));
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Documents.  A 'yyjson_doc' handle is owned by R, so is never put in
+  // the state where it would be freed.  It is fetched first, as an invalid
+  // handle is an error.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  yyjson_doc *handle_doc = TYPEOF(x_) == EXTPTRSXP ? get_doc_handle(x_) : NULL;
+  state_t *state = create_state();
+  yyjson_doc **docs;
+  R_xlen_t ndocs;
+
+  if (TYPEOF(x_) == EXTPTRSXP) {
+    docs  = &handle_doc;
+    ndocs = 1;
+  } else {
+    extract_parse_docs(x_, Rf_asLogical(is_file_) == 1, &opt, state);
+    docs  = state->docs;
+    ndocs = state->ndocs;
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Evaluate each path on every document, then convert all its matches
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  SEXP res_ = PROTECT(Rf_allocVector(VECSXP, npaths));
+  SEXP nms_ = PROTECT(Rf_allocVector(STRSXP, npaths));
+  SEXP path_nms_ = Rf_getAttrib(paths_, R_NamesSymbol);
+
+  for (int i = 0; i < npaths; i++) {
+    match_buf_t buf = { .vals = NULL, .n = 0, .capacity = 0 };
+    for (R_xlen_t d = 0; d < ndocs; d++) {
+      if (docs[d] != NULL) {
+        eval_json_path(yyjson_doc_get_root(docs[d]), &paths[i], 0, &buf);
+      }
+    }
+    SET_VECTOR_ELT(res_, i, matches_as_robj(&buf, &opt, state));
+
+    SEXP nm_ = Rf_isNull(path_nms_) ? R_BlankString : STRING_ELT(path_nms_, i);
+    if (nm_ == NA_STRING || nm_ == R_BlankString) {
+      nm_ = STRING_ELT(paths_, i);
+    }
+    SET_STRING_ELT(nms_, i, nm_);
+  }
+  Rf_setAttrib(res_, R_NamesSymbol, nms_);
+
+  destroy_state(state);
+  UNPROTECT(2);
+  return res_;
+}
@@ -0,0 +1,384 @@
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "yyjson.h"
+#include "R-yyjson-filter.h"
+
+// Result of comparing a JSON value with an R value which have no ordering
+// e.g. a JSON string and an R number
+#define CMP_NONE 2
+
+
+//===========================================================================
+// Convert the R expression into a tree of filter nodes.
+//
+// All memory is allocated with R_alloc(), so it is released by R at the
+// end of the .Call().  Strings are copied, so that the tree does not
+// depend on any R objects staying alive.
+//===========================================================================
+static filter_node_t *new_filter_node(int op) {
+  filter_node_t *node = (filter_node_t *)R_alloc(1, sizeof(filter_node_t));
+  memset(node, 0, sizeof(filter_node_t));
+  node->op = op;
+  return node;
+}
+
+static const char *copy_string(const char *str, size_t len) {
+  char *res = R_alloc(len + 1, 1);
+  memcpy(res, str, len);
+  res[len] = '\0';
+  return res;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// The key is the bare name (or a string) on the left-hand side of the
+// comparison
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void set_filter_key(filter_node_t *node, SEXP key_, const char *fn) {
+  const char *key;
+
+  if (TYPEOF(key_) == SYMSXP) {
+    key = CHAR(PRINTNAME(key_));
+  } else if (Rf_isString(key_) && Rf_length(key_) == 1 && STRING_ELT(key_, 0) != NA_STRING) {
+    key = Rf_translateCharUTF8(STRING_ELT(key_, 0));
+  } else {
+    Rf_error("filter: the left-hand side of '%s' must be the name of a key", fn);
+  }
+
+  node->key_len = strlen(key);
+  node->key     = copy_string(key, node->key_len);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// The right-hand side of a comparison is evaluated in the environment of
+// the formula, so it may refer to R variables e.g. `~ ts >= start_time`
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void set_filter_values(filter_node_t *node, SEXP expr_, SEXP env_,
+                              bool scalar, const char *fn) {
+  int nprotect = 0;
+  SEXP val_ = PROTECT(Rf_eval(expr_, env_)); nprotect++;
+
+  if (Rf_isFactor(val_)) {
+    val_ = PROTECT(Rf_asCharacterFactor(val_)); nprotect++;
+  }
+
+  int n = Rf_length(val_);
+  if (scalar && n != 1) {
+    Rf_error("filter: the right-hand side of '%s' must be a single value", fn);
+  }
+  node->nvalues = n;
+
+  switch(TYPEOF(val_)) {
+  case LGLSXP:
+    node->value_type = FILTER_VAL_LGL;
+    node->lgl = (int *)R_alloc((size_t)n + 1, sizeof(int));
+    memcpy(node->lgl, LOGICAL(val_), (size_t)n * sizeof(int));
+    break;
+  case INTSXP:
+    node->value_type = FILTER_VAL_NUM;
+    node->num = (double *)R_alloc((size_t)n + 1, sizeof(double));
+    for (int i = 0; i < n; i++) {
+      node->num[i] = INTEGER(val_)[i] == NA_INTEGER ? NA_REAL : (double)INTEGER(val_)[i];
+    }
+    break;
+  case REALSXP:
+    node->value_type = FILTER_VAL_NUM;
+    node->num = (double *)R_alloc((size_t)n + 1, sizeof(double));
+    memcpy(node->num, REAL(val_), (size_t)n * sizeof(double));
+    break;
+  case STRSXP:
+    node->value_type = FILTER_VAL_STR;
+    node->str     = (const char **)R_alloc((size_t)n + 1, sizeof(char *));
+    node->str_len = (size_t *)R_alloc((size_t)n + 1, sizeof(size_t));
+    for (int i = 0; i < n; i++) {
+      if (STRING_ELT(val_, i) == NA_STRING) {
+        node->str[i]     = NULL;
+        node->str_len[i] = 0;
+      } else {
+        const char *str  = Rf_translateCharUTF8(STRING_ELT(val_, i));
+        node->str_len[i] = strlen(str);
+        node->str[i]     = copy_string(str, node->str_len[i]);
+      }
+    }
+    break;
+  default:
+    Rf_error("filter: the right-hand side of '%s' must be a logical, numeric or character vector", fn);
+  }
+
+  UNPROTECT(nprotect);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Recursively convert an R call
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static filter_node_t *parse_filter_expr(SEXP expr_, SEXP env_) {
+
+  if (TYPEOF(expr_) != LANGSXP || TYPEOF(CAR(expr_)) != SYMSXP) {
+    Rf_error("filter: expression must be a comparison e.g. ~ x > 1");
+  }
+
+  const char *fn = CHAR(PRINTNAME(CAR(expr_)));
+  int nargs      = Rf_length(expr_) - 1;
+  SEXP arg1_     = nargs >= 1 ? CADR(expr_)  : R_NilValue;
+  SEXP arg2_     = nargs >= 2 ? CADDR(expr_) : R_NilValue;
+
+  filter_node_t *node = NULL;
+
+  if (strcmp(fn, "(") == 0 && nargs == 1) {
+    return parse_filter_expr(arg1_, env_);
+  } else if ((strcmp(fn, "&") == 0 || strcmp(fn, "&&") == 0) && nargs == 2) {
+    node = new_filter_node(FILTER_AND);
+    node->lhs = parse_filter_expr(arg1_, env_);
+    node->rhs = parse_filter_expr(arg2_, env_);
+  } else if ((strcmp(fn, "|") == 0 || strcmp(fn, "||") == 0) && nargs == 2) {
+    node = new_filter_node(FILTER_OR);
+    node->lhs = parse_filter_expr(arg1_, env_);
+    node->rhs = parse_filter_expr(arg2_, env_);
+  } else if (strcmp(fn, "!") == 0 && nargs == 1) {
+    node = new_filter_node(FILTER_NOT);
+    node->lhs = parse_filter_expr(arg1_, env_);
+  } else if (strcmp(fn, "is.null") == 0 && nargs == 1) {
+    node = new_filter_node(FILTER_IS_NULL);
+    set_filter_key(node, arg1_, fn);
+  } else if (strcmp(fn, "%in%") == 0 && nargs == 2) {
+    node = new_filter_node(FILTER_IN);
+    set_filter_key(node, arg1_, fn);
+    set_filter_values(node, arg2_, env_, false, fn);
+  } else if (nargs == 2) {
+    int op;
+    if      (strcmp(fn, "==") == 0) { op = FILTER_EQ; }
+    else if (strcmp(fn, "!=") == 0) { op = FILTER_NE; }
+    else if (strcmp(fn, "<" ) == 0) { op = FILTER_LT; }
+    else if (strcmp(fn, "<=") == 0) { op = FILTER_LE; }
+    else if (strcmp(fn, ">" ) == 0) { op = FILTER_GT; }
+    else if (strcmp(fn, ">=") == 0) { op = FILTER_GE; }
+    else {
+      Rf_error("filter: unsupported function '%s'", fn);
+    }
+    node = new_filter_node(op);
+    set_filter_key(node, arg1_, fn);
+    set_filter_values(node, arg2_, env_, true, fn);
+  } else {
+    Rf_error("filter: unsupported function '%s'", fn);
+  }
+
+  return node;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parse the 'filter' option.
+//
+// @param filter_ a one-sided formula, or a call (e.g. from 'quote()') in
+//        which case any R variables are looked up in the global environment
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+filter_node_t *parse_filter(SEXP filter_) {
+  SEXP expr_ = filter_;
+  SEXP env_  = R_GlobalEnv;
+
+  if (Rf_inherits(filter_, "formula")) {
+    if (Rf_length(filter_) != 2) {
+      Rf_error("filter: formula must be one-sided e.g. ~ x > 1");
+    }
+    expr_ = CADR(filter_);
+    SEXP formula_env_ = Rf_getAttrib(filter_, Rf_install(".Environment"));
+    if (TYPEOF(formula_env_) == ENVSXP) {
+      env_ = formula_env_;
+    }
+  }
+
+  return parse_filter_expr(expr_, env_);
+}
+
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Free a filter created by 'copy_filter()'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void free_filter(filter_node_t *node) {
+  if (node == NULL) return;
+
+  free_filter(node->lhs);
+  free_filter(node->rhs);
+  free((void *)node->key);
+  free(node->lgl);
+  free(node->num);
+  if (node->str != NULL) {
+    for (int i = 0; i < node->nvalues; i++) {
+      free((void *)node->str[i]);
+    }
+  }
+  free((void *)node->str);
+  free(node->str_len);
+  free(node);
+}
+
+
+static void *copy_memory(const void *src, size_t size, bool *ok) {
+  if (src == NULL) return NULL;
+  void *dst = malloc(size);
+  if (dst == NULL) {
+    *ok = false;
+    return NULL;
+  }
+  memcpy(dst, src, size);
+  return dst;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Copy a filter (e.g. from 'parse_filter()') into malloc() memory, so that 
+// it may be kept beyond the end of the current .Call().  
+// Must be released with 'free_filter()'
+//
+// @return NULL if memory allocation failed
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+filter_node_t *copy_filter(filter_node_t *node) {
+  if (node == NULL) return NULL;
+
+  filter_node_t *copy = calloc(1, sizeof(filter_node_t));
+  if (copy == NULL) return NULL;
+
+  bool ok = true;
+  size_t n = (size_t)node->nvalues;
+
+  copy->op         = node->op;
+  copy->key_len    = node->key_len;
+  copy->value_type = node->value_type;
+  copy->nvalues    = node->nvalues;
+
+  copy->key     = copy_memory(node->key    , node->key_len + 1      , &ok);
+  copy->lgl     = copy_memory(node->lgl    , (n + 1) * sizeof(int)   , &ok);
+  copy->num     = copy_memory(node->num    , (n + 1) * sizeof(double), &ok);
+  copy->str_len = copy_memory(node->str_len, (n + 1) * sizeof(size_t), &ok);
+  if (ok && node->str != NULL) {
+    copy->str = calloc(n + 1, sizeof(char *));
+    ok = copy->str != NULL;
+    for (size_t i = 0; ok && i < n; i++) {
+      copy->str[i] = copy_memory(node->str[i], node->str_len[i] + 1, &ok);
+    }
+  }
+
+  if (ok && node->lhs != NULL) {
+    copy->lhs = copy_filter(node->lhs);
+    ok = copy->lhs != NULL;
+  }
+  if (ok && node->rhs != NULL) {
+    copy->rhs = copy_filter(node->rhs);
+    ok = copy->rhs != NULL;
+  }
+
+  if (!ok) {
+    free_filter(copy);
+    return NULL;
+  }
+  return copy;
+}
+
+
+
+//===========================================================================
+// Evaluate the filter on a yyjson value.
+// This does not call the R API so it is safe to use from worker threads.
+//===========================================================================
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Compare JSON value with the i-th R value.
+// Returns -1, 0, 1 or CMP_NONE if the values can't be compared (i.e.
+// different types or NA).
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static int filter_compare(filter_node_t *node, yyjson_val *val, int i) {
+
+  switch(node->value_type) {
+  case FILTER_VAL_LGL: {
+    if (!yyjson_is_bool(val) || node->lgl[i] == NA_LOGICAL) return CMP_NONE;
+    int x = yyjson_get_bool(val);
+    return x == node->lgl[i] ? 0 : (x < node->lgl[i] ? -1 : 1);
+  }
+  case FILTER_VAL_NUM: {
+    if (!yyjson_is_num(val) || isnan(node->num[i])) return CMP_NONE;
+    double x = yyjson_get_num(val);
+    return x == node->num[i] ? 0 : (x < node->num[i] ? -1 : 1);
+  }
+  case FILTER_VAL_STR: {
+    if (!yyjson_is_str(val) || node->str[i] == NULL) return CMP_NONE;
+    size_t len = yyjson_get_len(val);
+    size_t n   = len < node->str_len[i] ? len : node->str_len[i];
+    int res    = memcmp(yyjson_get_str(val), node->str[i], n);
+    if (res == 0) {
+      res = (len > node->str_len[i]) - (len < node->str_len[i]);
+    }
+    return res < 0 ? -1 : (res > 0 ? 1 : 0);
+  }
+  }
+
+  return CMP_NONE;
+}
+
+
+static bool filter_eval(filter_node_t *node, yyjson_val *obj) {
+
+  switch(node->op) {
+  case FILTER_AND:
+    return filter_eval(node->lhs, obj) && filter_eval(node->rhs, obj);
+  case FILTER_OR:
+    return filter_eval(node->lhs, obj) || filter_eval(node->rhs, obj);
+  case FILTER_NOT:
+    return !filter_eval(node->lhs, obj);
+  }
+
+  yyjson_val *val = yyjson_obj_getn(obj, node->key, node->key_len);
+  bool is_null = val == NULL || yyjson_is_null(val);
+
+  if (node->op == FILTER_IS_NULL) {
+    return is_null;
+  }
+
+  // Missing values and JSON nulls never satisfy a comparison
+  if (is_null) {
+    return false;
+  }
+
+  if (node->op == FILTER_IN) {
+    for (int i = 0; i < node->nvalues; i++) {
+      if (filter_compare(node, val, i) == 0) return true;
+    }
+    return false;
+  }
+
+  int cmp = filter_compare(node, val, 0);
+
+  switch(node->op) {
+  case FILTER_EQ: return cmp == 0;
+  case FILTER_NE: return cmp != 0;
+  case FILTER_LT: return cmp == -1;
+  case FILTER_LE: return cmp == -1 || cmp == 0;
+  case FILTER_GT: return cmp ==  1;
+  case FILTER_GE: return cmp ==  1 || cmp == 0;
+  }
+
+  return false;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Should this row be kept?
+//
+// Values which are not {}-objects are always kept, so that the caller
+// reports them as an error in the usual way.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool row_matches_filter(yyjson_val *obj, filter_node_t *filter) {
+  if (filter == NULL || !yyjson_is_obj(obj)) return true;
+  return filter_eval(filter, obj);
+}
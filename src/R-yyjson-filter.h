@@ -0,0 +1,49 @@
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Row filters.  See 'R-yyjson-filter.c'
+//
+// A filter is given in R as a one-sided formula e.g.
+//     ~ status == "error" & ts >= 100
+// This is converted once (on the main thread) into a tree of 'filter_node_t'
+// which is then evaluated directly on the yyjson {}-object for each row.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define FILTER_AND      1
+#define FILTER_OR       2
+#define FILTER_NOT      3
+#define FILTER_IS_NULL  4
+#define FILTER_EQ       5
+#define FILTER_NE       6
+#define FILTER_LT       7
+#define FILTER_LE       8
+#define FILTER_GT       9
+#define FILTER_GE      10
+#define FILTER_IN      11
+
+#define FILTER_VAL_LGL 1
+#define FILTER_VAL_NUM 2
+#define FILTER_VAL_STR 3
+
+typedef struct filter_node {
+  int op;
+
+  // FILTER_AND, FILTER_OR, FILTER_NOT
+  struct filter_node *lhs;
+  struct filter_node *rhs;
+
+  // Everything else: key of the value in the {}-object ...
+  const char *key;
+  size_t key_len;
+
+  // ... and the R value(s) it is compared with
+  int value_type;
+  int nvalues;
+  int *lgl;
+  double *num;
+  const char **str;     // NULL for NA
+  size_t *str_len;
+} filter_node_t;
+
+filter_node_t *parse_filter(SEXP filter_);
+filter_node_t *copy_filter(filter_node_t *node);
+void free_filter(filter_node_t *node);
+bool row_matches_filter(yyjson_val *obj, filter_node_t *filter);
@@ -0,0 +1,335 @@
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "yyjson.h"
+#include "R-yyjson-schema.h"
+#include "R-yyjson-state.h"
+#include "R-yyjson-parse.h"
+#include "R-yyjson-lazy-str.h"
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Lazy string columns
+//
+// The bytes of every string are copied (once) into a single growable buffer
+// owned by the vector, and each element is an offset/length into this buffer.
+// The yyjson doc the strings came from can be freed as soon as the row is
+// filled.
+//
+//   data1 - external pointer to the 'lazy_str_t'
+//   data2 - the materialised STRSXP, or R_NilValue until it is needed
+//
+// Accessing a single element (STRING_ELT) creates just that CHARSXP.
+// The length, and whether there are any NAs, are known without creating
+// any CHARSXPs.  A full STRSXP is only created if something asks for a
+// pointer to the data, or modifies the vector. After that the buffer is
+// freed and all methods use the STRSXP.
+//
+// There is no custom serialization, so saved objects are just regular 
+// character vectors, and can be loaded without this package.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#define LAZY_STR_NA SIZE_MAX
+
+typedef struct {
+  R_xlen_t length;
+  R_xlen_t capacity;
+  size_t *offset;  // start of each string in 'buf'
+  size_t *len;     // length of each string. LAZY_STR_NA for NA
+  char *buf;
+  size_t nbuf;
+  size_t buf_size;
+} lazy_str_t;
+
+static R_altrep_class_t lazy_str_class;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Free the buffers. The struct itself remains, as 'length' is still needed
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void lazy_str_release(lazy_str_t *ls) {
+  free(ls->offset);
+  free(ls->len);
+  free(ls->buf);
+  ls->offset   = NULL;
+  ls->len      = NULL;
+  ls->buf      = NULL;
+  ls->nbuf     = 0;
+  ls->buf_size = 0;
+  ls->capacity = 0;
+}
+
+static void lazy_str_finalizer(SEXP ptr_) {
+  lazy_str_t *ls = (lazy_str_t *)R_ExternalPtrAddr(ptr_);
+  if (ls == NULL) return;
+  lazy_str_release(ls);
+  free(ls);
+  R_ClearExternalPtr(ptr_);
+}
+
+static inline lazy_str_t *lazy_str_get(SEXP x) {
+  return (lazy_str_t *)R_ExternalPtrAddr(R_altrep_data1(x));
+}
+
+static inline bool is_materialised(SEXP x) {
+  return R_altrep_data2(x) != R_NilValue;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// CHARSXP for a single element.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static SEXP lazy_str_charsxp(lazy_str_t *ls, R_xlen_t i) {
+  if (ls->len[i] == LAZY_STR_NA) {
+    return NA_STRING;
+  }
+  return Rf_mkCharLen(ls->buf + ls->offset[i], (int)ls->len[i]);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create all the CHARSXPs as a regular STRSXP in 'data2'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static SEXP lazy_str_materialise(SEXP x) {
+  if (is_materialised(x)) {
+    return R_altrep_data2(x);
+  }
+
+  lazy_str_t *ls = lazy_str_get(x);
+  SEXP str_ = PROTECT(Rf_allocVector(STRSXP, ls->length));
+  for (R_xlen_t i = 0; i < ls->length; i++) {
+    SET_STRING_ELT(str_, i, lazy_str_charsxp(ls, i));
+  }
+  R_set_altrep_data2(x, str_);
+  lazy_str_release(ls);
+
+  UNPROTECT(1);
+  return str_;
+}
+
+
+//===========================================================================
+// ALTREP methods
+//===========================================================================
+static R_xlen_t lazy_str_Length(SEXP x) {
+  if (is_materialised(x)) {
+    return XLENGTH(R_altrep_data2(x));
+  }
+  return lazy_str_get(x)->length;
+}
+
+static SEXP lazy_str_Elt(SEXP x, R_xlen_t i) {
+  if (is_materialised(x)) {
+    return STRING_ELT(R_altrep_data2(x), i);
+  }
+  return lazy_str_charsxp(lazy_str_get(x), i);
+}
+
+static void lazy_str_Set_elt(SEXP x, R_xlen_t i, SEXP val_) {
+  SET_STRING_ELT(lazy_str_materialise(x), i, val_);
+}
+
+static void *lazy_str_Dataptr(SEXP x, Rboolean writeable) {
+  return DATAPTR(lazy_str_materialise(x));
+}
+
+static const void *lazy_str_Dataptr_or_null(SEXP x) {
+  if (is_materialised(x)) {
+    return DATAPTR(R_altrep_data2(x));
+  }
+  return NULL;
+}
+
+static int lazy_str_No_NA(SEXP x) {
+  if (is_materialised(x)) {
+    return 0; // unknown
+  }
+  lazy_str_t *ls = lazy_str_get(x);
+  for (R_xlen_t i = 0; i < ls->length; i++) {
+    if (ls->len[i] == LAZY_STR_NA) return 0;
+  }
+  return 1;
+}
+
+static SEXP lazy_str_Duplicate(SEXP x, Rboolean deep) {
+  if (is_materialised(x)) {
+    return Rf_duplicate(R_altrep_data2(x));
+  }
+  lazy_str_t *ls = lazy_str_get(x);
+  SEXP str_ = PROTECT(Rf_allocVector(STRSXP, ls->length));
+  for (R_xlen_t i = 0; i < ls->length; i++) {
+    SET_STRING_ELT(str_, i, lazy_str_charsxp(ls, i));
+  }
+  UNPROTECT(1);
+  return str_;
+}
+
+static Rboolean lazy_str_Inspect(SEXP x, int pre, int deep, int pvec,
+                                 void (*inspect_subtree)(SEXP, int, int, int)) {
+  if (is_materialised(x)) {
+    Rprintf("yyjson lazy string (len=%.0f, materialised)\n", (double)lazy_str_Length(x));
+  } else {
+    lazy_str_t *ls = lazy_str_get(x);
+    Rprintf("yyjson lazy string (len=%.0f, bytes=%.0f)\n", (double)ls->length, (double)ls->nbuf);
+  }
+  return TRUE;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Register the ALTREP class.  Called from 'R_init_yyjsonr()'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void lazy_str_init(DllInfo *dll) {
+  lazy_str_class = R_make_altstring_class("yyjson_lazy_str", "yyjsonr", dll);
+
+  R_set_altrep_Length_method         (lazy_str_class, lazy_str_Length);
+  R_set_altrep_Inspect_method        (lazy_str_class, lazy_str_Inspect);
+  R_set_altrep_Duplicate_method      (lazy_str_class, lazy_str_Duplicate);
+  R_set_altvec_Dataptr_method        (lazy_str_class, lazy_str_Dataptr);
+  R_set_altvec_Dataptr_or_null_method(lazy_str_class, lazy_str_Dataptr_or_null);
+  R_set_altstring_Elt_method         (lazy_str_class, lazy_str_Elt);
+  R_set_altstring_Set_elt_method     (lazy_str_class, lazy_str_Set_elt);
+  R_set_altstring_No_NA_method       (lazy_str_class, lazy_str_No_NA);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Make room for at least 'n' elements.  New elements are NA
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void lazy_str_reserve(lazy_str_t *ls, R_xlen_t n) {
+  if (n <= ls->capacity) return;
+
+  size_t *offset = (size_t *)realloc(ls->offset, (size_t)n * sizeof(size_t));
+  if (offset == NULL) Rf_error("lazy_str: Memory allocation failed");
+  ls->offset = offset;
+
+  size_t *len = (size_t *)realloc(ls->len, (size_t)n * sizeof(size_t));
+  if (len == NULL) Rf_error("lazy_str: Memory allocation failed");
+  ls->len = len;
+
+  for (R_xlen_t i = ls->capacity; i < n; i++) {
+    ls->offset[i] = 0;
+    ls->len[i]    = LAZY_STR_NA;
+  }
+  ls->capacity = n;
+}
+
+
+//===========================================================================
+// Create a lazy string vector of length 'n'.  All elements are NA
+//===========================================================================
+SEXP lazy_str_new(R_xlen_t n) {
+  lazy_str_t *ls = (lazy_str_t *)calloc(1, sizeof(lazy_str_t));
+  if (ls == NULL) {
+    Rf_error("lazy_str_new(): Memory allocation failed");
+  }
+  SEXP ptr_ = PROTECT(R_MakeExternalPtr(ls, R_NilValue, R_NilValue));
+  R_RegisterCFinalizer(ptr_, lazy_str_finalizer);
+
+  SEXP x_ = PROTECT(R_new_altrep(lazy_str_class, ptr_, R_NilValue));
+  lazy_str_set_length(x_, n);
+
+  UNPROTECT(2);
+  return x_;
+}
+
+
+bool is_lazy_str(SEXP x) {
+  return ALTREP(x) && R_altrep_inherits(x, lazy_str_class);
+}
+
+
+//===========================================================================
+// Change the length of a lazy string vector which is still being filled.
+// This is the equivalent of 'Rf_lengthgets()', without creating any CHARSXPs
+//===========================================================================
+void lazy_str_set_length(SEXP x, R_xlen_t n) {
+  lazy_str_t *ls = lazy_str_get(x);
+  lazy_str_reserve(ls, n);
+  for (R_xlen_t i = n; i < ls->length; i++) {
+    ls->len[i] = LAZY_STR_NA;
+  }
+  ls->length = n;
+}
+
+
+//===========================================================================
+// Set element 'i' to a copy of the given bytes. 'str = NULL' for NA
+//===========================================================================
+void lazy_str_set(SEXP x, R_xlen_t i, const char *str, size_t len) {
+  if (is_materialised(x)) {
+    SET_STRING_ELT(R_altrep_data2(x), i, str == NULL ? NA_STRING : Rf_mkCharLen(str, (int)len));
+    return;
+  }
+
+  lazy_str_t *ls = lazy_str_get(x);
+
+  if (str == NULL) {
+    ls->len[i] = LAZY_STR_NA;
+    return;
+  }
+
+  if (ls->nbuf + len > ls->buf_size) {
+    size_t buf_size = ls->buf_size == 0 ? 4096 : 2 * ls->buf_size;
+    while (buf_size < ls->nbuf + len) buf_size *= 2;
+    char *buf = (char *)realloc(ls->buf, buf_size);
+    if (buf == NULL) Rf_error("lazy_str: Memory allocation failed");
+    ls->buf      = buf;
+    ls->buf_size = buf_size;
+  }
+
+  memcpy(ls->buf + ls->nbuf, str, len);
+  ls->offset[i] = ls->nbuf;
+  ls->len[i]    = len;
+  ls->nbuf     += len;
+}
+
+
+//===========================================================================
+// Set element 'i' from an existing CHARSXP
+//===========================================================================
+void lazy_str_set_charsxp(SEXP x, R_xlen_t i, SEXP charsxp_) {
+  if (charsxp_ == NA_STRING) {
+    lazy_str_set(x, i, NULL, 0);
+  } else {
+    lazy_str_set(x, i, CHAR(charsxp_), (size_t)LENGTH(charsxp_));
+  }
+}
+
+
+//===========================================================================
+// Set element 'i' from a JSON value.
+// Strings are copied directly. Any other value is converted exactly as it
+// would be for a regular string column (see 'json_val_to_charsxp()')
+//===========================================================================
+void lazy_str_set_json_val(SEXP x, R_xlen_t i, yyjson_val *val, parse_options *opt) {
+  if (yyjson_is_str(val) && 
+      !(opt->str_specials == STR_SPECIALS_AS_SPECIAL && yyjson_equals_str(val, "NA"))) {
+    // 'Rf_mkChar()' stops at the first nul byte, so do the same here
+    const char *str = yyjson_get_str(val);
+    lazy_str_set(x, i, str, strnlen(str, yyjson_get_len(val)));
+  } else {
+    lazy_str_set_charsxp(x, i, json_val_to_charsxp(val, opt));
+  }
+}
+
+
+//===========================================================================
+// Allocate a data.frame column. Character columns are lazy if the 
+// 'lazy_strings' option is set
+//===========================================================================
+SEXP alloc_df_column(unsigned int alloc_type, R_xlen_t n, parse_options *opt) {
+  if (alloc_type == STRSXP && opt->lazy_strings) {
+    return lazy_str_new(n);
+  }
+  return Rf_allocVector(alloc_type, n);
+}
@@ -0,0 +1,19 @@
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Lazy string columns.  See 'R-yyjson-lazy-str.c'
+//
+// An ALTREP character vector which holds the bytes of each string in a
+// compact buffer.  CHARSXPs are only created when an element is accessed,
+// so string columns which are never looked at never touch the global
+// CHARSXP cache.  Used for data.frame columns when 'lazy_strings = TRUE'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void lazy_str_init(DllInfo *dll);
+
+SEXP lazy_str_new(R_xlen_t n);
+bool is_lazy_str(SEXP x);
+void lazy_str_set(SEXP x, R_xlen_t i, const char *str, size_t len);
+void lazy_str_set_charsxp(SEXP x, R_xlen_t i, SEXP charsxp_);
+void lazy_str_set_json_val(SEXP x, R_xlen_t i, yyjson_val *val, parse_options *opt);
+void lazy_str_set_length(SEXP x, R_xlen_t n);
+
+SEXP alloc_df_column(unsigned int alloc_type, R_xlen_t n, parse_options *opt);
@@ -0,0 +1,265 @@
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "yyjson.h"
+#include "R-yyjson-schema.h"
+#include "R-yyjson-state.h"
+#include "R-yyjson-parse.h"
+#include "R-yyjson-filter.h"
+#include "R-yyjson-doc.h"
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parse a character vector where each element is a JSON document
+//
+// The elements are parsed in batches.  For each batch:
+//   (1) the yyjson parse of each element is split across the worker
+//       threads. Workers only see plain C strings and make no R API calls.
+//   (2) on the main thread, each document is converted to an R object in
+//       element order, and then freed.
+//
+// When simplifying to a data.frame, every document is needed to discover
+// the columns, so all documents are kept until the data.frame is built.
+//
+// All docs are held in 'state->docs' so they are freed if there is an error.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Number of elements parsed before they are converted to R (list output)
+#define VEC_BATCH_SIZE 65536
+
+// Don't bother splitting small batches across lots of threads
+#define MIN_ELEMS_PER_THREAD 1024
+#define VEC_MAX_THREADS 64
+
+
+typedef struct {
+  const char **str;       // element strings. NULL for NA
+  size_t *len;
+  yyjson_doc **docs;      // output. NULL for NA or a parse error
+  R_xlen_t lo, hi;        // elements [lo, hi) for this worker
+  yyjson_read_flag flag;
+} vec_worker_t;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parse the elements in a worker's range. No R API calls here!
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void *vec_worker_run(void *arg) {
+  vec_worker_t *w = (vec_worker_t *)arg;
+
+  for (R_xlen_t i = w->lo; i < w->hi; i++) {
+    if (w->str[i] == NULL) {
+      w->docs[i] = NULL;
+    } else {
+      w->docs[i] = yyjson_read_opts((char *)w->str[i], w->len[i], w->flag, NULL, NULL);
+    }
+  }
+
+  return NULL;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parse elements [lo, hi) into 'docs[lo, hi)' using up to 'nthreads' threads.
+// Worker 0 runs on the calling thread.  If a thread can't be created,
+// that worker is just run on the calling thread too.
+//
+// 'nthreads' is capped at VEC_MAX_THREADS (as for BGZF decompression).
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void parse_range(const char **str, size_t *len, yyjson_doc **docs,
+                        R_xlen_t lo, R_xlen_t hi, int nthreads, yyjson_read_flag flag) {
+
+  R_xlen_t n = hi - lo;
+  R_xlen_t max_threads = n / MIN_ELEMS_PER_THREAD;
+  if (max_threads < nthreads) nthreads = max_threads < 1 ? 1 : (int)max_threads;
+  if (nthreads > VEC_MAX_THREADS) nthreads = VEC_MAX_THREADS;
+
+  // Heap allocated so a large 'nthreads' can't overflow the stack.
+  // If allocation fails, just parse everything on this thread.
+  vec_worker_t *workers = calloc((size_t)nthreads, sizeof(vec_worker_t));
+  pthread_t *tid        = calloc((size_t)nthreads, sizeof(pthread_t));
+  bool *started         = calloc((size_t)nthreads, sizeof(bool));
+  if (workers == NULL || tid == NULL || started == NULL) {
+    free(workers);
+    free(tid);
+    free(started);
+    vec_worker_run(&(vec_worker_t){
+      .str = str, .len = len, .docs = docs, .lo = lo, .hi = hi, .flag = flag
+    });
+    return;
+  }
+
+  for (int i = 0; i < nthreads; i++) {
+    workers[i] = (vec_worker_t){
+      .str  = str,
+      .len  = len,
+      .docs = docs,
+      .lo   = lo + n * i / nthreads,
+      .hi   = lo + n * (i + 1) / nthreads,
+      .flag = flag
+    };
+  }
+
+  for (int i = 1; i < nthreads; i++) {
+    started[i] = pthread_create(&tid[i], NULL, vec_worker_run, &workers[i]) == 0;
+  }
+
+  vec_worker_run(&workers[0]);
+
+  for (int i = 1; i < nthreads; i++) {
+    if (started[i]) {
+      pthread_join(tid[i], NULL);
+    } else {
+      vec_worker_run(&workers[i]);
+    }
+  }
+
+  free(workers);
+  free(tid);
+  free(started);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Re-parse an element which failed, so the error message can be reported
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static const char *parse_error_msg(const char *str, size_t len, yyjson_read_flag flag) {
+  yyjson_read_err err;
+  yyjson_doc *doc = yyjson_read_opts((char *)str, len, flag, NULL, &err);
+  if (doc != NULL) {
+    yyjson_doc_free(doc);
+    return "unknown error";
+  }
+  return err.msg;
+}
+
+
+//===========================================================================
+// Parse each element of a character vector of JSON
+//
+// @param str_ character vector
+// @param parse_opts_ parse options
+// @param simplify_df_ logical. If TRUE, each element must be a {}-object
+//        and the result is a data.frame with one row per element.
+//        NA elements become a row of missing values.
+//        Otherwise the result is a list with one R object per element
+//        (NULL for NA elements and elements which can't be parsed)
+// @param nthreads_ number of threads for parsing
+//===========================================================================
+SEXP parse_from_str_vec_(SEXP str_, SEXP parse_opts_, SEXP simplify_df_, SEXP nthreads_) {
+
+  if (!Rf_isString(str_)) {
+    Rf_error("'str' must be a character vector");
+  }
+
+  parse_options opt = create_parse_options(parse_opts_);
+  bool simplify_df  = Rf_asLogical(simplify_df_) == 1;
+  int nthreads      = Rf_asInteger(nthreads_);
+  if (nthreads == NA_INTEGER || nthreads < 1) nthreads = 1;
+
+  // Elements are never modified in-place
+  yyjson_read_flag flag = opt.yyjson_read_flag & ~YYJSON_READ_INSITU;
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Gather the C strings on the main thread, so the workers never need
+  // to touch the R character vector
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  R_xlen_t n = Rf_xlength(str_);
+  const char **str = (const char **)R_alloc((size_t)n + 1, sizeof(char *));
+  size_t *len      = (size_t *)R_alloc((size_t)n + 1, sizeof(size_t));
+
+  for (R_xlen_t i = 0; i < n; i++) {
+    SEXP elem_ = STRING_ELT(str_, i);
+    if (elem_ == NA_STRING) {
+      str[i] = NULL;
+      len[i] = 0;
+    } else {
+      str[i] = CHAR(elem_);
+      len[i] = (size_t)LENGTH(elem_);
+    }
+  }
+
+  state_t *state = create_state();
+  R_xlen_t ndocs = simplify_df ? n : (n < VEC_BATCH_SIZE ? n : VEC_BATCH_SIZE);
+  state->docs = (yyjson_doc **)calloc((size_t)ndocs + 1, sizeof(yyjson_doc *));
+  if (state->docs == NULL) {
+    error_and_destroy_state(state, "parse_from_str_vec_(): Memory allocation failed");
+  }
+  state->ndocs = ndocs;
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // data.frame: parse everything, then build the data.frame from the
+  // root {}-object of each document.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  if (simplify_df) {
+    if (!Rf_isNull(opt.pointer) && Rf_length(opt.pointer) != 1) {
+      error_and_destroy_state(state, "simplify = 'df' only works with a single 'pointer'");
+    }
+    parse_range(str, len, state->docs, 0, n, nthreads, flag);
+
+    yyjson_val **rows = (yyjson_val **)R_alloc((size_t)n + 1, sizeof(yyjson_val *));
+    R_xlen_t nrows = 0;
+
+    for (R_xlen_t i = 0; i < n; i++) {
+      if (str[i] == NULL) {
+        if (opt.filter == NULL) rows[nrows++] = NULL;
+        continue;
+      }
+      if (state->docs[i] == NULL) {
+        error_and_destroy_state(state, "Couldn't parse JSON in element %.0f: %s\n",
+                                (double)(i + 1), parse_error_msg(str[i], len[i], flag));
+      }
+      yyjson_val *obj = Rf_isNull(opt.pointer) ? 
+        yyjson_doc_get_root(state->docs[i]) :
+        json_pointer_get(state->docs[i], STRING_ELT(opt.pointer, 0), state);
+      if (!yyjson_is_obj(obj)) {
+        error_and_destroy_state(state, "simplify = 'df' only works if all elements represent JSON objects");
+      }
+      if (row_matches_filter(obj, opt.filter)) {
+        rows[nrows++] = obj;
+      }
+    }
+
+    SEXP df_ = PROTECT(json_objects_to_data_frame(rows, nrows, &opt, state));
+    destroy_state(state);
+    UNPROTECT(1);
+    return df_;
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // list: parse a batch, convert it in order, free it.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  SEXP list_ = PROTECT(Rf_allocVector(VECSXP, n));
+
+  for (R_xlen_t lo = 0; lo < n; lo += ndocs) {
+    R_xlen_t hi = lo + ndocs < n ? lo + ndocs : n;
+    yyjson_doc **docs = state->docs;
+
+    parse_range(str + lo, len + lo, docs, 0, hi - lo, nthreads, flag);
+
+    for (R_xlen_t i = lo; i < hi; i++) {
+      yyjson_doc *doc = docs[i - lo];
+      if (doc == NULL) {
+        if (str[i] != NULL) {
+          Rf_warning("Couldn't parse JSON in element %.0f. Inserting 'NULL'\n", (double)(i + 1));
+        }
+        continue;
+      }
+      SET_VECTOR_ELT(list_, i, json_doc_as_robj(doc, &opt, state));
+      yyjson_doc_free(doc);
+      docs[i - lo] = NULL;
+    }
+  }
+
+  destroy_state(state);
+  UNPROTECT(1);
+  return list_;
+}
@@ -8,21 +8,50 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-#include "zlib.h"
 #include "yyjson.h"
+#include "R-yyjson-schema.h"
 #include "R-yyjson-state.h"
 #include "R-yyjson-parse.h"
+#include "R-yyjson-filter.h"
+#include "R-yyjson-row-decoder.h"
+#include "R-yyjson-lazy-str.h"
+#include "R-yyjson-doc.h"
+#include "utils.h"
+
+#define PARSE_OPTIONS_TAG "yyjson_parse_options"
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Forward declarations
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 SEXP json_array_of_objects_to_data_frame(yyjson_val *arr, parse_options *opt, state_t *state);
+SEXP json_objects_to_data_frame(yyjson_val **rows, R_xlen_t nrows, parse_options *opt, state_t *state);
 SEXP json_as_robj(yyjson_val *val, parse_options *opt, state_t *state);
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// The most recently parsed options list (and the resulting struct). 
+// The list is kept with R_PreserveObject() so it cannot be garbage collected
+// and its address re-used while it is in the cache.  Any modification of 
+// the list in R makes a copy (as the preserved list is shared), so if 
+// the same list is passed in again, the cached struct is still valid.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static SEXP cached_parse_opts_ = NULL;
+static parse_options cached_parse_opt;
+
+static void cache_parse_options(SEXP parse_opts_, parse_options *opt) {
+  R_PreserveObject(parse_opts_);
+  if (cached_parse_opts_ != NULL) {
+    R_ReleaseObject(cached_parse_opts_);
+  }
+  cached_parse_opts_ = parse_opts_;
+  cached_parse_opt   = *opt;
+}
+
+
 //===========================================================================
 // Pare the R list of options into the 'parse_options' struct
 //
@@ -30,6 +59,16 @@ SEXP json_as_robj(yyjson_val *val, parse_options *opt, state_t *state);
 //===========================================================================
 parse_options create_parse_options(SEXP parse_opts_) {
   
+  // Options compiled with 'opts_read_json(compile = TRUE)'
+  parse_options *compiled = get_options_handle(parse_opts_, PARSE_OPTIONS_TAG);
+  if (compiled != NULL) {
+    return *compiled;
+  }
+  
+  if (parse_opts_ == cached_parse_opts_) {
+    return cached_parse_opt;
+  }
+  
   // Set default options
   parse_options opt = {
     .int64                 = INT64_AS_STR,
@@ -45,7 +84,17 @@ parse_options create_parse_options(SEXP parse_opts_) {
     .single_null           = R_NilValue,
     .empty_array           = EMPTY_ARRAY_AS_LIST,
     .empty_object          = EMPTY_OBJECT_AS_NAMED_LIST,
-    .yyjson_read_flag      = 0
+    .yyjson_read_flag      = 0,
+    .columns               = NULL,
+    .columns_len           = NULL,
+    .ncolumns              = 0,
+    .filter                = NULL,
+    .ncol_types            = 0,
+    .col_type_names        = NULL,
+    .col_types             = NULL,
+    .extra_cols_as_list    = false,
+    .lazy_strings          = false,
+    .pointer               = R_NilValue
   };
   
   // Sanity check and extract option names from the named list
@@ -63,6 +112,7 @@ parse_options create_parse_options(SEXP parse_opts_) {
   }
   
   // Loop over options in R named list and assign to C struct
+  bool cacheable = true;
   for (int i = 0; i < Rf_length(parse_opts_); i++) {
     const char *opt_name = CHAR(STRING_ELT(nms_, i));
     SEXP val_ = VECTOR_ELT(parse_opts_, i);
@@ -123,15 +173,282 @@ parse_options create_parse_options(SEXP parse_opts_) {
       if (opt.digits_promote < 0 || opt.digits_promote > 30) {
         Rf_error("'digits_promote' must be integer in range [0, 30]");
       }
+    } else if (strcmp(opt_name, "filter") == 0) {
+      if (!Rf_isNull(val_)) {
+        opt.filter = parse_filter(val_);
+      }
+    } else if (strcmp(opt_name, "col_types") == 0) {
+      if (!Rf_isNull(val_)) {
+        SEXP nms_ = Rf_getAttrib(val_, R_NamesSymbol);
+        if (!(Rf_isString(val_) || Rf_isNewList(val_)) || Rf_isNull(nms_)) {
+          Rf_error("'col_types' must be a named list or named character vector");
+        }
+        opt.ncol_types     = Rf_length(val_);
+        opt.col_type_names = (const char **)R_alloc((size_t)opt.ncol_types + 1, sizeof(char *));
+        opt.col_types      = (unsigned int *)R_alloc((size_t)opt.ncol_types + 1, sizeof(unsigned int));
+        schema_t names;
+        schema_init(&names, true);
+        for (int col = 0; col < opt.ncol_types; col++) {
+          opt.col_type_names[col] = CHAR(STRING_ELT(nms_, col));
+          if (schema_add(&names, opt.col_type_names[col], strlen(opt.col_type_names[col])) != col) {
+            Rf_error("'col_types' has more than one type for '%s'", opt.col_type_names[col]);
+          }
+          SEXP type_ = Rf_isString(val_) ? STRING_ELT(val_, col) : Rf_asChar(VECTOR_ELT(val_, col));
+          const char *type = CHAR(type_);
+          if (strcmp(type, "logical") == 0) {
+            opt.col_types[col] = LGLSXP;
+          } else if (strcmp(type, "integer") == 0) {
+            opt.col_types[col] = INTSXP;
+          } else if (strcmp(type, "integer64") == 0) {
+            opt.col_types[col] = INT64SXP;
+          } else if (strcmp(type, "double") == 0 || strcmp(type, "numeric") == 0) {
+            opt.col_types[col] = REALSXP;
+          } else if (strcmp(type, "character") == 0) {
+            opt.col_types[col] = STRSXP;
+          } else if (strcmp(type, "list") == 0) {
+            opt.col_types[col] = VECSXP;
+          } else {
+            Rf_error("'col_types' for '%s' not understood: '%s'", opt.col_type_names[col], type);
+          }
+        }
+      }
+    } else if (strcmp(opt_name, "extra_cols") == 0) {
+      const char *val = CHAR(STRING_ELT(val_, 0));
+      if (strcmp(val, "ignore") == 0) {
+        opt.extra_cols_as_list = false;
+      } else if (strcmp(val, "list") == 0) {
+        opt.extra_cols_as_list = true;
+      } else {
+        Rf_error("extra_cols option not understood: '%s'", val);
+      }
+    } else if (strcmp(opt_name, "lazy_strings") == 0) {
+      opt.lazy_strings = Rf_asLogical(val_) == 1;
+    } else if (strcmp(opt_name, "pointer") == 0) {
+      if (!Rf_isNull(val_) && (!Rf_isString(val_) || Rf_length(val_) == 0)) {
+        Rf_error("'pointer' must be a character vector or NULL");
+      }
+      opt.pointer = val_;
+    } else if (strcmp(opt_name, "columns") == 0) {
+      if (!Rf_isNull(val_)) {
+        if (!Rf_isString(val_)) {
+          Rf_error("'columns' must be a character vector or NULL");
+        }
+        // Keep C copies of the pointers so that selection can be checked 
+        // without calling the R API. Memory is released by R after the .Call
+        opt.ncolumns    = Rf_length(val_);
+        opt.columns     = (const char **)R_alloc((size_t)opt.ncolumns + 1, sizeof(char *));
+        opt.columns_len = (size_t *)R_alloc((size_t)opt.ncolumns + 1, sizeof(size_t));
+        for (int col = 0; col < opt.ncolumns; col++) {
+          opt.columns[col]     = CHAR(STRING_ELT(val_, col));
+          opt.columns_len[col] = strlen(opt.columns[col]);
+        }
+      }
     } else {
       Rf_warning("Unknown option ignored: '%s'\n", opt_name);
+      cacheable = false;
     }
   }
+  
+  // The catch-all column only applies when there is a declared schema
+  if (opt.ncol_types == 0) {
+    opt.extra_cols_as_list = false;
+  }
+  
+  // 'columns', 'filter' and 'col_types' use R_alloc() memory which 
+  // is only valid until the end of this .Call()
+  if (cacheable && opt.ncolumns == 0 && opt.filter == NULL && opt.ncol_types == 0) {
+    cache_parse_options(parse_opts_, &opt);
+  }
 
   return opt;
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Free a compiled 'parse_options' (and the arrays it owns)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void free_compiled_parse_options(parse_options *opt) {
+  if (opt == NULL) return;
+  free((void *)opt->columns);
+  free(opt->columns_len);
+  free((void *)opt->col_type_names);
+  free(opt->col_types);
+  free_filter(opt->filter);
+  free(opt);
+}
+
+static void compiled_parse_options_finalizer(SEXP handle_) {
+  free_compiled_parse_options((parse_options *)R_ExternalPtrAddr(handle_));
+  R_ClearExternalPtr(handle_);
+}
+
+static void *copy_array(const void *src, size_t n, size_t size, bool *ok) {
+  if (src == NULL) return NULL;
+  void *dst = malloc((n + 1) * size);
+  if (dst == NULL) {
+    *ok = false;
+    return NULL;
+  }
+  memcpy(dst, src, n * size);
+  return dst;
+}
+
+
+//===========================================================================
+// Compile an R list of options into a handle to a 'parse_options' struct.
+//
+// Everything which 'create_parse_options()' allocated with R_alloc() is 
+// copied into malloc() memory owned by the handle.  Strings still point 
+// into the R list, which is kept alive by the handle.
+//
+// Note: the right-hand side of a 'filter' is evaluated once, at compile time.
+//===========================================================================
+SEXP compile_parse_options_(SEXP parse_opts_) {
+  
+  if (get_options_handle(parse_opts_, PARSE_OPTIONS_TAG) != NULL) {
+    return parse_opts_;
+  }
+  
+  parse_options opt = create_parse_options(parse_opts_);
+  
+  parse_options *compiled = calloc(1, sizeof(parse_options));
+  if (compiled == NULL) {
+    Rf_error("compile_parse_options_(): Memory allocation failed");
+  }
+  *compiled = opt;
+  
+  bool ok = true;
+  compiled->columns        = copy_array(opt.columns       , (size_t)opt.ncolumns  , sizeof(char *)      , &ok);
+  compiled->columns_len    = copy_array(opt.columns_len   , (size_t)opt.ncolumns  , sizeof(size_t)      , &ok);
+  compiled->col_type_names = copy_array(opt.col_type_names, (size_t)opt.ncol_types, sizeof(char *)      , &ok);
+  compiled->col_types      = copy_array(opt.col_types     , (size_t)opt.ncol_types, sizeof(unsigned int), &ok);
+  compiled->filter         = NULL;
+  if (ok && opt.filter != NULL) {
+    compiled->filter = copy_filter(opt.filter);
+    ok = compiled->filter != NULL;
+  }
+  
+  if (!ok) {
+    free_compiled_parse_options(compiled);
+    Rf_error("compile_parse_options_(): Memory allocation failed");
+  }
+  
+  return make_options_handle(compiled, PARSE_OPTIONS_TAG, parse_opts_,
+                             compiled_parse_options_finalizer, "opts_read_json_compiled");
+}
+
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Should the {}-object member with this key become a data.frame column?
+// i.e. is it in the 'columns' option (if set).
+//
+// No R API calls, so this is safe to use in worker threads
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool is_selected_column(yyjson_val *key, parse_options *opt) {
+  if (opt->columns == NULL) return true;
+  
+  for (int i = 0; i < opt->ncolumns; i++) {
+    if (yyjson_equals_strn(key, opt->columns[i], opt->columns_len[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Columns declared by the 'col_types' option.
+//
+// If 'extra_cols = "list"', there is one more column (EXTRA_COL_NAME) 
+// after the declared columns, which holds a list of all the other keys.
+//
+// @return number of columns. 0 if there is no declared schema (i.e.
+//         columns need to be found by probing)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+int get_declared_column_count(parse_options *opt) {
+  return opt->ncol_types + (opt->extra_cols_as_list ? 1 : 0);
+}
+
+const char *get_declared_column_name(parse_options *opt, int col) {
+  return col < opt->ncol_types ? opt->col_type_names[col] : EXTRA_COL_NAME;
+}
+
+unsigned int get_declared_column_type(parse_options *opt, int col) {
+  return col < opt->ncol_types ? opt->col_types[col] : VECSXP;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Named list of the members of a {}-object which are not declared in 
+// 'col_types'.  This is the value for the EXTRA_COL_NAME column.
+//
+// This is called for every row, so nothing is allocated unless there are
+// extra members, and keys are looked up in the hashed 'schema' (whose 
+// first 'ncol_types' columns are the declared columns).
+//
+// @return named list. Or 'df_missing_list_elem' if there are no other members
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static inline bool is_extra_key(yyjson_val *key, schema_t *schema, parse_options *opt) {
+  int col = schema_find(schema, yyjson_get_str(key), yyjson_get_len(key));
+  return col < 0 || col >= opt->ncol_types;
+}
+
+SEXP json_object_extra_keys(yyjson_val *obj, schema_t *schema, parse_options *opt, state_t *state) {
+  
+  yyjson_val *key;
+  yyjson_obj_iter iter = yyjson_obj_iter_with(obj);
+  
+  int nextra = 0;
+  while ((key = yyjson_obj_iter_next(&iter))) {
+    nextra += is_extra_key(key, schema, opt);
+  }
+  
+  if (nextra == 0) {
+    return opt->df_missing_list_elem;
+  }
+  
+  parse_options nested;
+  parse_options *nested_opt = nested_parse_options(opt, &nested);
+  
+  SEXP res_ = PROTECT(Rf_allocVector(VECSXP, nextra));
+  SEXP nms_ = PROTECT(Rf_allocVector(STRSXP, nextra));
+  
+  iter = yyjson_obj_iter_with(obj);
+  int idx = 0;
+  while ((key = yyjson_obj_iter_next(&iter))) {
+    if (!is_extra_key(key, schema, opt)) continue;
+    SET_STRING_ELT(nms_, idx, Rf_mkChar(yyjson_get_str(key)));
+    SET_VECTOR_ELT(res_, idx, json_as_robj(yyjson_obj_iter_get_val(key), nested_opt, state));
+    idx++;
+  }
+  
+  Rf_setAttrib(res_, R_NamesSymbol, nms_);
+  UNPROTECT(2);
+  return res_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// The 'columns' and 'filter' options only apply to the top-level data.frame. 
+// Return options to use when parsing values nested within it.
+//
+// @param nested storage for the nested options (if needed)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+parse_options *nested_parse_options(parse_options *opt, parse_options *nested) {
+  if (opt->columns == NULL && opt->filter == NULL && opt->ncol_types == 0) return opt;
+  
+  *nested = *opt;
+  nested->columns     = NULL;
+  nested->columns_len = NULL;
+  nested->ncolumns    = 0;
+  nested->filter      = NULL;
+  nested->ncol_types  = 0;
+  nested->extra_cols_as_list = false;
+  return nested;
+}
+
+
 
 //===========================================================================
 //   ###                  ##                 
@@ -543,8 +860,14 @@ unsigned int get_best_sexp_to_represent_type_bitset(unsigned int type_bitset, pa
 
 //===========================================================================
 // Update type bitset with a new json value
+//
+// This is the thread-safe core of 'update_type_bitset()'.  It makes no 
+// calls to the R API, so it can be used from worker threads.
+// Any condition which would cause a warning or an error is flagged in 
+// 'status' (see TYPE_STATUS_*), and it is up to the caller (on the main thread)
+// to report it.
 //===========================================================================
-unsigned int update_type_bitset(unsigned int type_bitset, yyjson_val *val, parse_options *opt) {
+unsigned int update_type_bitset_core(unsigned int type_bitset, yyjson_val *val, parse_options *opt, unsigned int *status) {
 
   switch(yyjson_get_type(val)) {
   case YYJSON_TYPE_BOOL:
@@ -563,7 +886,7 @@ unsigned int update_type_bitset(unsigned int type_bitset, yyjson_val *val, parse
           // Signed INT64_MAX =  2^63-1 =  9223372036854775807
           // Signed INT64_MIN = -2^63   = -9223372036854775808
           if (tmp > INT64_MAX) {
-            Rf_warning("64bit unsigned integer values exceed capacity of unsigned 64bit container (bit64::integer64). Expect overflow");
+            *status |= TYPE_STATUS_UINT64_OVERFLOW;
           }
           type_bitset |= VAL_INT64;
         } else {
@@ -594,7 +917,7 @@ unsigned int update_type_bitset(unsigned int type_bitset, yyjson_val *val, parse
       type_bitset |= VAL_REAL;
       break;
     default:
-      Rf_error("get_array_element_type_bitset(): Unknown subtype in : %i\n", yyjson_get_subtype(val));
+      *status |= TYPE_STATUS_UNKNOWN;
     }
     break;
   case YYJSON_TYPE_STR:
@@ -622,8 +945,35 @@ unsigned int update_type_bitset(unsigned int type_bitset, yyjson_val *val, parse
     // Don't do anything with JSON 'null'
     break;
   default:
-    Rf_error("get_array_element_type_bitset(); Unhandled type: %i -> %s\n", yyjson_get_type(val), 
-          yyjson_get_type_desc(val));
+    *status |= TYPE_STATUS_UNKNOWN;
+  }
+  
+  return type_bitset;
+}
+
+
+//===========================================================================
+// Report any problems flagged by 'update_type_bitset_core()'
+//===========================================================================
+void report_type_bitset_status(unsigned int status) {
+  if (status & TYPE_STATUS_UNKNOWN) {
+    Rf_error("get_array_element_type_bitset(): Unhandled JSON type/subtype\n");
+  }
+  if (status & TYPE_STATUS_UINT64_OVERFLOW) {
+    Rf_warning("64bit unsigned integer values exceed capacity of unsigned 64bit container (bit64::integer64). Expect overflow");
+  }
+}
+
+
+//===========================================================================
+// Update type bitset with a new json value
+//===========================================================================
+unsigned int update_type_bitset(unsigned int type_bitset, yyjson_val *val, parse_options *opt) {
+  
+  unsigned int status = 0;
+  type_bitset = update_type_bitset_core(type_bitset, val, opt, &status);
+  if (status) {
+    report_type_bitset_status(status);
   }
   
   return type_bitset;
@@ -964,11 +1314,14 @@ SEXP json_array_as_vecsxp(yyjson_val *arr, parse_options *opt, state_t *state) {
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Iterate over array and insert items into list
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  parse_options nested;
+  parse_options *nested_opt = nested_parse_options(opt, &nested);
+  
   yyjson_arr_iter iter = yyjson_arr_iter_with( arr );
   yyjson_val *val;
   unsigned int idx = 0;
   while ((val = yyjson_arr_iter_next(&iter))) {
-    SET_VECTOR_ELT(res_, idx, json_as_robj(val, opt, state));
+    SET_VECTOR_ELT(res_, idx, json_as_robj(val, nested_opt, state));
     ++idx;
   }
   
@@ -1395,213 +1748,93 @@ SEXP json_array_as_robj(yyjson_val *arr, parse_options *opt, state_t *state) {
 //   #  #  #   #   #  #  #   #         #      #      #   #  # # #  #     
 //  ####    ####    ##    ####         #      #       ####  #   #   ###  
 //
-//
-// Parse []-array of only {}-objects. Extract a single key/value from 
-// each {}-object and return all values as an atomic vector.
-//
-// Pre-requisite: 
-//    'arr' is a JSON []-array
-//    []-array only contains {}-objects
 //===========================================================================
 
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Pre-requisites:
-//   - all values within {}-objects accessible by key='key_name' can 
-//     be contained in an LGLSXP
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP json_array_of_objects_to_lglsxp(yyjson_val *arr, const char *key_name, 
-                                     parse_options *opt, state_t *state) {
-  
-  size_t nrow = yyjson_get_len(arr);
-  SEXP vec_ = PROTECT(Rf_allocVector(LGLSXP, (R_xlen_t)nrow)); 
-  int *vecp = INTEGER(vec_);
-  
-  yyjson_arr_iter iter = yyjson_arr_iter_with(arr);
-  yyjson_val *obj;
-  
-  while ((obj = yyjson_arr_iter_next(&iter))) {
-    yyjson_val *val = yyjson_obj_get(obj, key_name);
-    *vecp++ = json_val_to_logical(val, opt);
-  }
-  
-  UNPROTECT(1);
-  return vec_;
-}
 
 
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Pre-requisites:
-//   - all values within {}-objects accessible by key='key_name' can 
-//     be contained in an INTSXP
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP json_array_of_objects_to_intsxp(yyjson_val *arr, const char *key_name, 
-                                     parse_options *opt, state_t *state) {
-  
-  size_t nrow = yyjson_get_len(arr);
-  SEXP vec_ = PROTECT(Rf_allocVector(INTSXP, (R_xlen_t)nrow)); 
-  int *vecp = INTEGER(vec_);
-  
-  yyjson_arr_iter iter = yyjson_arr_iter_with(arr);
-  yyjson_val *obj;
-  
-  while ((obj = yyjson_arr_iter_next(&iter))) {
-    yyjson_val *val = yyjson_obj_get(obj, key_name);
-    *vecp++ = json_val_to_integer(val, opt);
-  }
-  
-  UNPROTECT(1);
-  return vec_;
-}
-
-
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Pre-requisites:
-//   - all values within {}-objects accessible by key='key_name' can 
-//     be contained in an REALSXP
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP json_array_of_objects_to_realsxp(yyjson_val *arr, const char *key_name, 
-                                      parse_options *opt, state_t *state) {
-  
-  size_t nrow = yyjson_get_len(arr);
-  SEXP vec_ = PROTECT(Rf_allocVector(REALSXP, (R_xlen_t)nrow));
-  double *vecp = REAL(vec_);
-  
-  yyjson_arr_iter iter = yyjson_arr_iter_with(arr);
-  yyjson_val *obj;
-  
-  while ((obj = yyjson_arr_iter_next(&iter))) {
-    yyjson_val *val = yyjson_obj_get(obj, key_name);
-    *vecp++ = json_val_to_double(val, opt);
-  }
-  
-  UNPROTECT(1);
-  return vec_;
-}
-
-
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Pre-requisites:
-//   - all values within {}-objects accessible by key='key_name' can 
-//     be contained in an STRSXP
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP json_array_of_objects_to_strsxp(yyjson_val *arr, const char *key_name, 
-                                     parse_options *opt, state_t *state) {
-  
-  size_t nrow = yyjson_get_len(arr);
-  SEXP vec_ = PROTECT(Rf_allocVector(STRSXP, (R_xlen_t)nrow)); 
-  
-  unsigned int idx = 0;
-  yyjson_arr_iter iter = yyjson_arr_iter_with(arr);
-  yyjson_val *obj;
-  
-  while ((obj = yyjson_arr_iter_next(&iter))) {
-    yyjson_val *val = yyjson_obj_get(obj, key_name);
-    SET_STRING_ELT(vec_, idx, json_val_to_charsxp(val, opt));
-    idx++;
-  }
-  
-  UNPROTECT(1);
-  return vec_;
-}
-
-
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// All values within {}-objects accessible by key='key_name' are 
-// stored in a VECSXP (i.e. list)
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP json_array_of_objects_to_vecsxp(yyjson_val *arr, const char *key_name, 
-                                     parse_options *opt, state_t *state) {
-  
-  size_t nrow = yyjson_get_len(arr);
-  SEXP vec_ = PROTECT(Rf_allocVector(VECSXP, (R_xlen_t)nrow));
+//===========================================================================
+// Parse a JSON []-array of {}-objects into a data.frame
+//
+//  Pre-requisite:
+//     - 'arr' is a JSON []-array
+//     - all members of []-array are {}-objects
+//===========================================================================
+SEXP json_array_of_objects_to_data_frame(yyjson_val *arr, parse_options *opt, state_t *state) {
   
-  unsigned int idx = 0;
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Gather the {}-objects within the []-array which will become rows.
+  // If there is a 'filter' then only the matching objects are kept.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  yyjson_val **rows = (yyjson_val **)R_alloc(yyjson_get_len(arr) + 1, sizeof(yyjson_val *));
+  R_xlen_t nrows = 0;
   yyjson_arr_iter iter = yyjson_arr_iter_with(arr);
   yyjson_val *obj;
   
   while ((obj = yyjson_arr_iter_next(&iter))) {
-    yyjson_val *val = yyjson_obj_get(obj, key_name);
-
-    if (val == NULL) {
-        SET_VECTOR_ELT(vec_, idx, opt->df_missing_list_elem); // NA_logical_
-    } else {
-      SET_VECTOR_ELT(vec_, idx, json_as_robj(val, opt, state));
+    if (row_matches_filter(obj, opt->filter)) {
+      rows[nrows++] = obj;
     }
-    
-    idx++;
   }
   
-  UNPROTECT(1);
-  return vec_;
+  return json_objects_to_data_frame(rows, nrows, opt, state);
 }
 
 
-
-
-
 //===========================================================================
-// Parse a JSON []-array of {}-objects into a data.frame
+// Parse a set of {}-objects into a data.frame. One row per object.
 //
 //  Pre-requisite:
-//     - 'arr' is a JSON []-array
-//     - all members of []-array are {}-objects
+//     - each of 'rows' is a {}-object, or NULL for an all-NA row
 //===========================================================================
-SEXP json_array_of_objects_to_data_frame(yyjson_val *arr, parse_options *opt, state_t *state) {
+SEXP json_objects_to_data_frame(yyjson_val **rows, R_xlen_t nrows, parse_options *opt, state_t *state) {
   
   int nprotect = 0;
+  yyjson_val *obj;
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Accumulation of unique key-names in the objects
   // These will become the column names of the data.frame.
   // Each column also has a 'type_bitset' to keep track of the type of each
-  // value across the different {}-objects
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  char *colname[MAX_DF_COLS];
-  unsigned int type_bitset[MAX_DF_COLS] = {0};
-  unsigned int ncols = 0;
-  
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Prepare to iterate over all {}-objects within the []-array
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  unsigned int nrows = (unsigned int)yyjson_get_len(arr);
-  yyjson_arr_iter iter = yyjson_arr_iter_with(arr);
-  yyjson_val *obj;
+  // value across the different {}-objects.
+  // This is a local schema (rather than the one in the 'state'), as 
+  // data.frames may be nested within other data.frames.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  schema_t schema;
+  schema_init(&schema, true);
+  
+  // A user-supplied schema means there is no need to probe the rows
+  if (opt->ncol_types > 0) {
+    for (int col = 0; col < get_declared_column_count(opt); col++) {
+      const char *name = get_declared_column_name(opt, col);
+      schema_add(&schema, name, strlen(name));
+    }
+  }
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // A pass over all {}-objects within the []-array
+  // A pass over all rows
   // Accumulate
   //   - all unique names (in the order they are first encountered)
   //   - a 'type_bitset' for the values represented by each name
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  while ((obj = yyjson_arr_iter_next(&iter))) {
+  for (R_xlen_t row = 0; opt->ncol_types == 0 && row < nrows; row++) {
+    obj = rows[row];
+    if (obj == NULL) continue;
     
     yyjson_val *key, *val;
     yyjson_obj_iter obj_iter = yyjson_obj_iter_with(obj);
     
     while ((key = yyjson_obj_iter_next(&obj_iter))) {
+      if (!is_selected_column(key, opt)) continue;
       val = yyjson_obj_iter_get_val(key);
       
-      int name_idx = -1;
-      for (int i = 0; i < ncols; i++) {
-        if (yyjson_equals_str(key, colname[i])) {
-          name_idx = i;
-          break;
-        }
-      }
-      if (name_idx < 0) {
-        // Name has not been seen yet. so add it.
-        name_idx = (int)ncols;
-        colname[ncols] = (char *)yyjson_get_str(key);
-        ncols++;
-        if (ncols == MAX_DF_COLS) {
-          error_and_destroy_state(state, "Maximum columns for data.frame exceeded: %i", MAX_DF_COLS);
-        }
-      }
-      
-      type_bitset[name_idx] = update_type_bitset(type_bitset[name_idx], val, opt);
+      int name_idx = schema_add_key(&schema, key);
+      schema.type_bitset[name_idx] = update_type_bitset(schema.type_bitset[name_idx], val, opt);
     }
   }
   
+  int ncols = schema.ncols;
+  char **colname = schema.names;
+  
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Create a data.frame.
@@ -1612,44 +1845,59 @@ SEXP json_array_of_objects_to_data_frame(yyjson_val *arr, parse_options *opt, st
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // For each column name,
   //   - determine the best SEXP to represent the 'type_bitset'
-  //   - Call a parse function which will
-  //        - loop through the entire []-array, plucking the value from each
-  //          {}-object
-  //        - return an atomic vector or a list
-  //   - place this vector as a column in the data.frame
+  //   - place a vector of this type as a column in the data.frame
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  for (unsigned int col = 0; col < ncols; col++) {
+  unsigned int *sexp_type = (unsigned int *)R_alloc((size_t)ncols + 1, sizeof(unsigned int));
+  
+  for (int col = 0; col < ncols; col++) {
     
-    unsigned int sexp_type = get_best_sexp_to_represent_type_bitset(type_bitset[col], opt);
+    sexp_type[col] = opt->ncol_types > 0 ? get_declared_column_type(opt, col) :
+      get_best_sexp_to_represent_type_bitset(schema.type_bitset[col], opt);
     
     //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
     // Debugging types
     //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    // dump_type_bitset(type_bitset[col]);
+    // dump_type_bitset(schema.type_bitset[col]);
     // Rf_warning("[dfcol %i] %s - sexp_type: %i -> %s\n",
     //         col, colname[col],
-    //         sexp_type, Rf_type2char(sexp_type));
+    //         sexp_type[col], Rf_type2char(sexp_type[col]));
     
-    switch (sexp_type) {
+    unsigned int alloc_type;
+    switch (sexp_type[col]) {
     case LGLSXP:
-      SET_VECTOR_ELT(df_, col, json_array_of_objects_to_lglsxp(arr, colname[col], opt, state));
-      break;
     case INTSXP:
-      SET_VECTOR_ELT(df_, col, json_array_of_objects_to_intsxp(arr, colname[col], opt, state));
-      break;
     case REALSXP:
-      SET_VECTOR_ELT(df_, col, json_array_of_objects_to_realsxp(arr, colname[col], opt, state));
-      break;
     case STRSXP:
-      SET_VECTOR_ELT(df_, col, json_array_of_objects_to_strsxp(arr, colname[col], opt, state));
-      break;
     case VECSXP:
-      SET_VECTOR_ELT(df_, col, json_array_of_objects_to_vecsxp(arr, colname[col], opt, state));
+      alloc_type = sexp_type[col];
+      break;
+    case INT64SXP:
+      // INT64SXP is actually contained in a REALSXP
+      alloc_type = REALSXP;
       break;
     default:
-      Rf_warning("Unhandled 'df' coltype: %i -> %s\n", sexp_type, Rf_type2char(sexp_type));
-      SET_VECTOR_ELT(df_, col, Rf_allocVector(LGLSXP, nrows));
+      Rf_warning("Unhandled 'df' coltype: %i -> %s\n", sexp_type[col], Rf_type2char(sexp_type[col]));
+      alloc_type = LGLSXP;
+    }
+    
+    SEXP vec_ = PROTECT(alloc_df_column(alloc_type, nrows, opt));
+    if (sexp_type[col] == INT64SXP) {
+      SEXP att_val_ = PROTECT(Rf_mkString("integer64"));
+      Rf_setAttrib(vec_, R_ClassSymbol, att_val_);
+      UNPROTECT(1);
     }
+    SET_VECTOR_ELT(df_, col, vec_);
+    UNPROTECT(1);
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Fill the data.frame one row at a time.  
+  // Each {}-object is walked once, with every value sent to its column.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  row_decoder_t *dec = row_decoder_create(&schema, sexp_type, opt, state);
+  
+  for (R_xlen_t row = 0; row < nrows; row++) {
+    row_decoder_fill(dec, df_, row, rows[row]);
   }
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -1719,12 +1967,15 @@ SEXP json_object_as_list(yyjson_val *obj, parse_options *opt, state_t *state) {
   SEXP res_ = PROTECT(Rf_allocVector(VECSXP, n)); nprotect++;
   SEXP nms_ = PROTECT(Rf_allocVector(STRSXP, n)); nprotect++;
   
+  parse_options nested;
+  parse_options *nested_opt = nested_parse_options(opt, &nested);
+  
   yyjson_val *key, *val;
   yyjson_obj_iter iter = yyjson_obj_iter_with(obj);
   unsigned int idx = 0;
   while ((key = yyjson_obj_iter_next(&iter))) {
     val = yyjson_obj_iter_get_val(key);
-    SET_VECTOR_ELT(res_, idx, json_as_robj(val, opt, state));
+    SET_VECTOR_ELT(res_, idx, json_as_robj(val, nested_opt, state));
     SET_STRING_ELT(nms_, idx, Rf_mkChar(yyjson_get_str(key)));
     ++idx;
   }
@@ -1924,6 +2175,41 @@ void output_verbose_error(const char *str, unsigned long len, yyjson_read_err er
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Convert 'state->doc' to an R object, releasing the shared small doc 
+// arena if an R error (or interrupt) jumps out of the conversion.
+//
+// The state itself is not touched on a jump: it may already have been 
+// freed by 'error_and_destroy_state()'.  Otherwise it is lost (as for any 
+// other R error), but its doc is never used again, so the arena can be.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct {
+  parse_options *opt;
+  state_t *state;
+} doc_as_robj_args;
+
+static SEXP doc_as_robj_body(void *data) {
+  doc_as_robj_args *args = (doc_as_robj_args *)data;
+  return json_doc_as_robj(args->state->doc, args->opt, args->state);
+}
+
+static void release_small_doc_arena_on_jump(void *data, Rboolean jump) {
+  if (jump && *(bool *)data) {
+    release_small_doc_arena();
+  }
+}
+
+static SEXP state_doc_as_robj(parse_options *opt, state_t *state) {
+  doc_as_robj_args args = { .opt = opt, .state = state };
+  bool uses_small_doc_arena = state->uses_small_doc_arena;
+  SEXP cont_ = PROTECT(R_MakeUnwindCont());
+  SEXP res_ = R_UnwindProtect(doc_as_robj_body, &args, release_small_doc_arena_on_jump, 
+                              &uses_small_doc_arena, cont_);
+  UNPROTECT(1);
+  return res_;
+}
+
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -1931,7 +2217,8 @@ SEXP parse_json_from_str(const char *str, size_t len, parse_options *opt) {
   
   yyjson_read_err err;
   state_t *state = create_state();
-  state->doc = yyjson_read_opts((char *)str, len, opt->yyjson_read_flag, NULL, &err);
+  yyjson_alc *alc = state_small_doc_alc(state, len, opt->yyjson_read_flag);
+  state->doc = yyjson_read_opts((char *)str, len, opt->yyjson_read_flag, alc, &err);
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // If doc is NULL, then an error occurred during parsing.
@@ -1951,9 +2238,9 @@ SEXP parse_json_from_str(const char *str, size_t len, parse_options *opt) {
   }
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Parse the document from the root node
+  // Parse the document from the root node (or the 'pointer' node)
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  SEXP res_ = PROTECT(json_as_robj(yyjson_doc_get_root(state->doc), opt, state));
+  SEXP res_ = PROTECT(state_doc_as_robj(opt, state));
   
   
   destroy_state(state);
@@ -1969,13 +2256,10 @@ SEXP parse_json_from_file(const char *filename, parse_options *opt) {
   
   yyjson_read_err err;
   
-  // yyjson_doc *yyjson_read_file(const char *path,
-  //                              yyjson_read_flag flg,
-  //                              const yyjson_alc *alc,
-  //                              yyjson_read_err *err);
-  
+  // Plain files are read with 'yyjson_read_file()'. Compressed files and 
+  // pipes are streamed (see 'state_read_file()')
   state_t *state = create_state();
-  state->doc = yyjson_read_file((char *)filename, opt->yyjson_read_flag, NULL, &err);
+  state_read_file(state, filename, opt->yyjson_read_flag, &err);
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // If doc is NULL, then an error occurred during parsing.
@@ -1994,9 +2278,9 @@ SEXP parse_json_from_file(const char *filename, parse_options *opt) {
   }
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Parse the document from the root node
+  // Parse the document from the root node (or the 'pointer' node)
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  SEXP res_ = PROTECT(json_as_robj(yyjson_doc_get_root(state->doc), opt, state));
+  SEXP res_ = PROTECT(json_doc_as_robj(state->doc, opt, state));
   
   destroy_state(state);
   UNPROTECT(1);
@@ -2041,63 +2325,6 @@ SEXP parse_from_raw_(SEXP raw_, SEXP parse_opts_) {
 }
 
 
-//===========================================================================
-// Parse from file given as a filename - ending in ".gz"
-//===========================================================================
-SEXP parse_from_gzfile_(SEXP filename_, SEXP parse_opts_) {
-  
-  const char *filename = (const char *)CHAR( STRING_ELT(filename_, 0) );
-  filename = R_ExpandFileName(filename);
-  parse_options opt = create_parse_options(parse_opts_);
-  
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Read tail end of .gz file to get length.
-  // If uncompressed length > 4GB this method will fail as there are 
-  // only 4-bytes reserved for the field!
-  // Stored as a little-endian 32bit int.  Reading this byte-by-byte
-  // to avoid an endianness issue on 32bit powerpc (Issue #39)
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  FILE *fp = fopen(filename, "rb");
-  if (fp == NULL) {
-    Rf_error("couldn't open file: %s", filename);
-  }
-  
-  fseek(fp, -4, SEEK_END);
-  int32_t uncompressed_len = 0;
-  uncompressed_len += fgetc(fp);
-  uncompressed_len += fgetc(fp) <<  8;
-  uncompressed_len += fgetc(fp) << 16;
-  uncompressed_len += fgetc(fp) << 24;
-  fclose(fp);
-  
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Allocate a buffer to hold the uncompressed file.
-  // Note: this approach will change if/when yyjson implements streaming
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  char *buf = R_alloc(1, (int)uncompressed_len + 1);
-  if (buf == 0) {
-    Rf_error("Couldn't allocate buffer for reading json.gz file: %s", filename);
-  }
-  
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Uncompress file to buffer
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  gzFile gzfp = gzopen(filename, "r");
-  int N = gzread(gzfp, (void *)buf, (unsigned int)uncompressed_len);
-  gzclose(gzfp);
-  if (N != uncompressed_len) {
-    Rf_error("Incorrect number of bytes read. Expected %i, read %i", uncompressed_len, N);
-  }
-  
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Parse buffer as string
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  SEXP res_ = PROTECT(parse_json_from_str(buf, (size_t)uncompressed_len, &opt));
-  
-  UNPROTECT(1);
-  return res_;
-}
-
 //===========================================================================
 // Parse from file given as a filename
 //===========================================================================
@@ -2106,11 +2333,7 @@ SEXP parse_from_file_(SEXP filename_, SEXP parse_opts_) {
   const char *filename = (const char *)CHAR( STRING_ELT(filename_, 0) );
   filename = R_ExpandFileName(filename);
   
-  size_t len = strlen(filename);
-  if (strncmp(filename + len - 3, ".gz", 3) == 0) {
-    return parse_from_gzfile_(filename_, parse_opts_);
-  }
-  
+  // Gzipped files are detected and streamed by 'state_read_file()'
   parse_options opt = create_parse_options(parse_opts_);
   return parse_json_from_file(filename, &opt);
 }
@@ -2126,7 +2349,7 @@ SEXP validate_json_file_(SEXP filename_, SEXP verbose_, SEXP parse_opts_) {
   
   yyjson_read_err err;
   state_t *state = create_state();
-  state->doc = yyjson_read_file((char *)filename, opt.yyjson_read_flag, NULL, &err);
+  state_read_file(state, filename, opt.yyjson_read_flag, &err);
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // If doc is NULL, then an error occurred during parsing.
@@ -28,6 +28,14 @@
 #define VAL_OBJ     1 << 9
 #define VAL_INT64   1 << 10
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Status flags set by 'update_type_bitset_core()'.  
+// The core function does not call the R API (so it is safe to use in worker 
+// threads), so problems are flagged here and reported later.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define TYPE_STATUS_UNKNOWN         1 << 0
+#define TYPE_STATUS_UINT64_OVERFLOW 1 << 1
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Give numeric values to a few flags.
 // These are specific numeric flags, as I think they could be expanded to 
@@ -108,8 +116,21 @@ typedef struct {
   unsigned int empty_array;
   unsigned int empty_object;
   unsigned int yyjson_read_flag;
+  const char **columns;     // Keys to keep when creating a data.frame. NULL = all keys
+  size_t *columns_len;
+  int ncolumns;
+  struct filter_node *filter; // Keep only the rows matching this. NULL = all rows
+  int ncol_types;             // Number of columns declared in 'col_types'. 0 = probe for columns
+  const char **col_type_names;
+  unsigned int *col_types;    // SEXP type of each declared column
+  bool extra_cols_as_list;    // Collect undeclared keys into the EXTRA_COL_NAME list column
+  bool lazy_strings;          // data.frame string columns are lazy ALTREP vectors
+  SEXP pointer;               // JSON Pointer(s) to the value(s) to convert. R_NilValue = root
 } parse_options;
 
+// Name of the catch-all list column when 'extra_cols = "list"'
+#define EXTRA_COL_NAME ".extra"
+
 
 //===========================================================================
 // Number of context characters to print when an error occurs
@@ -119,8 +140,18 @@ typedef struct {
 parse_options create_parse_options(SEXP parse_opts_);
 SEXP parse_json_from_str(const char *str, size_t len, parse_options *opt);
 
+bool is_selected_column(yyjson_val *key, parse_options *opt);
+int get_declared_column_count(parse_options *opt);
+const char *get_declared_column_name(parse_options *opt, int col);
+unsigned int get_declared_column_type(parse_options *opt, int col);
+SEXP json_object_extra_keys(yyjson_val *obj, schema_t *schema, parse_options *opt, state_t *state);
+SEXP json_objects_to_data_frame(yyjson_val **rows, R_xlen_t nrows, parse_options *opt, state_t *state);
+parse_options *nested_parse_options(parse_options *opt, parse_options *nested);
+
 
 unsigned int update_type_bitset(unsigned int type_bitset, yyjson_val *val, parse_options *opt);
+unsigned int update_type_bitset_core(unsigned int type_bitset, yyjson_val *val, parse_options *opt, unsigned int *status);
+void report_type_bitset_status(unsigned int status);
 unsigned int get_best_sexp_to_represent_type_bitset(unsigned int type_bitset, parse_options *opt);
 void dump_type_bitset(unsigned int type_bitset);
 
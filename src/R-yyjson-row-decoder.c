@@ -0,0 +1,181 @@
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "yyjson.h"
+#include "R-yyjson-schema.h"
+#include "R-yyjson-state.h"
+#include "R-yyjson-parse.h"
+#include "R-yyjson-row-decoder.h"
+#include "R-yyjson-lazy-str.h"
+
+
+//===========================================================================
+// Column writers.
+// One of these is chosen for each column when the decoder is created, so
+// the column type is not re-checked for every value.
+//===========================================================================
+static void write_logical(SEXP column_, R_xlen_t row, yyjson_val *val, row_decoder_t *dec) {
+  LOGICAL(column_)[row] = json_val_to_logical(val, dec->opt);
+}
+
+static void write_integer(SEXP column_, R_xlen_t row, yyjson_val *val, row_decoder_t *dec) {
+  INTEGER(column_)[row] = json_val_to_integer(val, dec->opt);
+}
+
+static void write_integer64(SEXP column_, R_xlen_t row, yyjson_val *val, row_decoder_t *dec) {
+  // INT64SXP is actually contained in a REALSXP
+  ((long long *)(REAL(column_)))[row] = json_val_to_integer64(val, dec->opt);
+}
+
+static void write_double(SEXP column_, R_xlen_t row, yyjson_val *val, row_decoder_t *dec) {
+  REAL(column_)[row] = json_val_to_double(val, dec->opt);
+}
+
+static void write_string(SEXP column_, R_xlen_t row, yyjson_val *val, row_decoder_t *dec) {
+  if (val == NULL) {
+    SET_STRING_ELT(column_, row, NA_STRING);
+  } else {
+    SET_STRING_ELT(column_, row, json_val_to_charsxp(val, dec->opt));
+  }
+}
+
+static void write_lazy_string(SEXP column_, R_xlen_t row, yyjson_val *val, row_decoder_t *dec) {
+  if (val == NULL) {
+    lazy_str_set(column_, row, NULL, 0);
+  } else {
+    lazy_str_set_json_val(column_, row, val, dec->opt);
+  }
+}
+
+static void write_list(SEXP column_, R_xlen_t row, yyjson_val *val, row_decoder_t *dec) {
+  if (val == NULL) {
+    SET_VECTOR_ELT(column_, row, dec->opt->df_missing_list_elem);
+  } else {
+    SET_VECTOR_ELT(column_, row, json_as_robj(val, dec->nested_opt, dec->state));
+  }
+}
+
+static void write_nothing(SEXP column_, R_xlen_t row, yyjson_val *val, row_decoder_t *dec) {
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create a decoder for the columns in the schema.
+//
+// All memory is from R_alloc(), so nothing needs to be freed.
+//
+// @param schema column names
+// @param sexp_type the type of each column
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+row_decoder_t *row_decoder_create(schema_t *schema, unsigned int *sexp_type,
+                                  parse_options *opt, state_t *state) {
+
+  row_decoder_t *dec = (row_decoder_t *)R_alloc(1, sizeof(row_decoder_t));
+  int ncols = schema->ncols;
+
+  dec->schema     = schema;
+  dec->opt        = opt;
+  dec->nested_opt = nested_parse_options(opt, &dec->nested);
+  dec->state      = state;
+  dec->extra_col  = opt->extra_cols_as_list ? opt->ncol_types : -1;
+
+  dec->writer   = (col_writer_t *)R_alloc((size_t)ncols + 1, sizeof(col_writer_t));
+  dec->last_row = (R_xlen_t *)R_alloc((size_t)ncols + 1, sizeof(R_xlen_t));
+
+  for (int col = 0; col < ncols; col++) {
+    dec->last_row[col] = -1;
+
+    switch(sexp_type[col]) {
+    case LGLSXP:
+      dec->writer[col] = write_logical;
+      break;
+    case INTSXP:
+      dec->writer[col] = write_integer;
+      break;
+    case INT64SXP:
+      dec->writer[col] = write_integer64;
+      break;
+    case REALSXP:
+      dec->writer[col] = write_double;
+      break;
+    case STRSXP:
+      // Columns are allocated with 'alloc_df_column()', which makes them
+      // lazy if this option is set
+      dec->writer[col] = opt->lazy_strings ? write_lazy_string : write_string;
+      break;
+    case VECSXP:
+      dec->writer[col] = write_list;
+      break;
+    default:
+      dec->writer[col] = write_nothing;
+    }
+  }
+
+  // Initial space for key predictions.  This grows as needed
+  dec->nkey_col = (size_t)ncols + 1;
+  dec->key_col  = (int *)R_alloc(dec->nkey_col, sizeof(int));
+  for (size_t i = 0; i < dec->nkey_col; i++) {
+    dec->key_col[i] = -1;
+  }
+
+  return dec;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Slot the values from a {}-object into the given row.
+//
+// The keys of the object are walked once, in order, and each value is sent
+// straight to the writer for its column.  Columns not seen in this object
+// are then filled with the missing value for their type.
+//
+// If a key appears more than once in an object, the first value is used
+// (the same as 'yyjson_obj_get()')
+//
+// Pre-requisite: 'obj' is a {}-object, or NULL for a row of missing values
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void row_decoder_fill(row_decoder_t *dec, SEXP df_, R_xlen_t row, yyjson_val *obj) {
+
+  schema_t *schema = dec->schema;
+
+  size_t nkeys = obj == NULL ? 0 : yyjson_obj_size(obj);
+  if (nkeys > dec->nkey_col) {
+    size_t nkey_col = 2 * nkeys;
+    dec->key_col = (int *)S_realloc((char *)dec->key_col, (long)nkey_col, (long)dec->nkey_col, sizeof(int));
+    for (size_t i = dec->nkey_col; i < nkey_col; i++) {
+      dec->key_col[i] = -1;
+    }
+    dec->nkey_col = nkey_col;
+  }
+
+  yyjson_val *key;
+  yyjson_obj_iter iter = yyjson_obj_iter_with(obj);
+
+  for (size_t i = 0; obj != NULL && (key = yyjson_obj_iter_next(&iter)); i++) {
+    int col = schema_predict_col(schema, dec->key_col, i, key);
+    if (col < 0 || col == dec->extra_col || dec->last_row[col] == row) continue;
+
+    dec->last_row[col] = row;
+    dec->writer[col](VECTOR_ELT(df_, col), row, yyjson_obj_iter_get_val(key), dec);
+  }
+
+  for (int col = 0; col < schema->ncols; col++) {
+    if (dec->last_row[col] == row) continue;
+    dec->last_row[col] = row;
+
+    if (col == dec->extra_col) {
+      SEXP extra_ = obj == NULL ? R_NilValue : json_object_extra_keys(obj, schema, dec->opt, dec->state);
+      SET_VECTOR_ELT(VECTOR_ELT(df_, col), row, extra_);
+    } else {
+      dec->writer[col](VECTOR_ELT(df_, col), row, NULL, dec);
+    }
+  }
+}
@@ -0,0 +1,30 @@
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Row decoder.  See 'R-yyjson-row-decoder.c'
+//
+// Slots the values from {}-objects into the rows of a data.frame (held as
+// a list of column vectors) once the schema is known.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+struct row_decoder;
+
+// Write a single value into a column. 'val' is NULL if the key is missing
+typedef void (*col_writer_t)(SEXP column_, R_xlen_t row, yyjson_val *val, struct row_decoder *dec);
+
+typedef struct row_decoder {
+  schema_t *schema;
+  col_writer_t *writer;  // writer for each column
+  int extra_col;         // column for undeclared keys (see 'extra_cols'). -1 if none
+
+  int *key_col;          // predicted column for each key position
+  size_t nkey_col;
+  R_xlen_t *last_row;    // last row written for each column
+
+  parse_options *opt;
+  parse_options *nested_opt; // options for values in list-columns
+  parse_options nested;
+  state_t *state;
+} row_decoder_t;
+
+row_decoder_t *row_decoder_create(schema_t *schema, unsigned int *sexp_type,
+                                  parse_options *opt, state_t *state);
+void row_decoder_fill(row_decoder_t *dec, SEXP df_, R_xlen_t row, yyjson_val *obj);
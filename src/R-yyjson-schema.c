@@ -0,0 +1,221 @@
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "yyjson.h"
+#include "R-yyjson-schema.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Allocate memory from R or from the C heap.
+// Note: R_alloc() memory must only be requested from the main thread
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void *schema_alloc(schema_t *schema, size_t size) {
+  if (schema->use_r_alloc) {
+    return (void *)R_alloc(size, 1);
+  }
+  return malloc(size);
+}
+
+static void schema_release(schema_t *schema, void *ptr) {
+  if (!schema->use_r_alloc) {
+    free(ptr);
+  }
+}
+
+static void *schema_grow(schema_t *schema, void *ptr, size_t old_size, size_t new_size) {
+  if (schema->use_r_alloc) {
+    return (void *)S_realloc((char *)ptr, (long)new_size, (long)old_size, 1);
+  }
+  return realloc(ptr, new_size);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// FNV-1a hash of the key bytes
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static inline uint64_t hash_name(const char *name, size_t len) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)name[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Initialise an empty schema.
+// A zeroed schema (e.g. from calloc()) is also a valid, empty malloc() schema
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void schema_init(schema_t *schema, bool use_r_alloc) {
+  memset(schema, 0, sizeof(schema_t));
+  schema->use_r_alloc = use_r_alloc;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Free all memory.  The schema is left empty and may be re-used.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void schema_free(schema_t *schema) {
+  if (schema == NULL) return;
+
+  if (!schema->use_r_alloc) {
+    for (int i = 0; i < schema->ncols; i++) {
+      free(schema->names[i]);
+    }
+    free(schema->names);
+    free(schema->name_len);
+    free(schema->type_bitset);
+    free(schema->slots);
+  }
+
+  schema_init(schema, schema->use_r_alloc);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Find the slot for this name: either the slot holding it, or the empty
+// slot where it would be inserted.  Table must not be full.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static size_t find_slot(schema_t *schema, const char *name, size_t len) {
+  size_t mask = schema->nslots - 1;
+  size_t slot = (size_t)hash_name(name, len) & mask;
+
+  while (true) {
+    int col = schema->slots[slot];
+    if (col < 0) {
+      return slot;
+    }
+    if (schema->name_len[col] == len && memcmp(schema->names[col], name, len) == 0) {
+      return slot;
+    }
+    slot = (slot + 1) & mask;
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Look up a column by name
+// @return column index, or -1 if the name is not in the schema
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+int schema_find(schema_t *schema, const char *name, size_t len) {
+  if (schema->nslots == 0) return -1;
+  return schema->slots[find_slot(schema, name, len)];
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Double the size of the hash table (load factor is kept at or below 0.5)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool grow_slots(schema_t *schema) {
+  size_t nslots = schema->nslots == 0 ? 64 : 2 * schema->nslots;
+  int *slots = schema_alloc(schema, nslots * sizeof(int));
+  if (slots == NULL) return false;
+
+  for (size_t i = 0; i < nslots; i++) {
+    slots[i] = -1;
+  }
+
+  schema_release(schema, schema->slots);
+  schema->slots  = slots;
+  schema->nslots = nslots;
+
+  for (int col = 0; col < schema->ncols; col++) {
+    size_t slot = find_slot(schema, schema->names[col], schema->name_len[col]);
+    schema->slots[slot] = col;
+  }
+
+  return true;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Grow the per-column arrays
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool grow_cols(schema_t *schema) {
+  size_t old_capacity = (size_t)schema->capacity;
+  size_t new_capacity = old_capacity == 0 ? 32 : 2 * old_capacity;
+  if (new_capacity > INT32_MAX) return false;
+
+  char **names = schema_grow(schema, schema->names,
+                             old_capacity * sizeof(char *), new_capacity * sizeof(char *));
+  if (names == NULL) return false;
+  schema->names = names;
+
+  size_t *name_len = schema_grow(schema, schema->name_len,
+                                 old_capacity * sizeof(size_t), new_capacity * sizeof(size_t));
+  if (name_len == NULL) return false;
+  schema->name_len = name_len;
+
+  unsigned int *type_bitset = schema_grow(schema, schema->type_bitset,
+                                          old_capacity * sizeof(unsigned int), new_capacity * sizeof(unsigned int));
+  if (type_bitset == NULL) return false;
+  schema->type_bitset = type_bitset;
+
+  schema->capacity = (int)new_capacity;
+  return true;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Look up a column by name, adding it as a new column if it has not
+// been seen before.
+//
+// The name is copied, so the 'doc' it came from may be freed.
+//
+// @return column index, or -1 if memory allocation failed
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+int schema_add(schema_t *schema, const char *name, size_t len) {
+
+  if (2 * ((size_t)schema->ncols + 1) > schema->nslots) {
+    if (!grow_slots(schema)) return -1;
+  }
+
+  size_t slot = find_slot(schema, name, len);
+  if (schema->slots[slot] >= 0) {
+    return schema->slots[slot];
+  }
+
+  // Name has not been seen yet.
+  if (schema->ncols == schema->capacity) {
+    if (!grow_cols(schema)) return -1;
+  }
+
+  char *new_name = schema_alloc(schema, len + 1);
+  if (new_name == NULL) return -1;
+  memcpy(new_name, name, len);
+  new_name[len] = '\0';
+
+  int col = schema->ncols;
+  schema->names[col]       = new_name;
+  schema->name_len[col]    = len;
+  schema->type_bitset[col] = 0;
+  schema->slots[slot]      = col;
+  schema->ncols++;
+
+  return col;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Add all the columns of 'src' to 'dst'. Type bitsets of columns which 
+// are in both are combined.  If 'dst' is empty, this makes a copy of 'src'.
+// @return false if memory allocation failed
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool schema_merge(schema_t *dst, schema_t *src) {
+  for (int col = 0; col < src->ncols; col++) {
+    int idx = schema_add(dst, src->names[col], src->name_len[col]);
+    if (idx < 0) return false;
+    dst->type_bitset[idx] |= src->type_bitset[col];
+  }
+  return true;
+}
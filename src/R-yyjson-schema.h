@@ -0,0 +1,67 @@
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Schema discovery.  See 'R-yyjson-schema.c'
+//
+// A schema is the set of unique key names seen across a number of {}-objects
+// (in the order they were first seen) and a 'type_bitset' for the values
+// of each key.  These become the columns of a data.frame.
+//
+// Key lookup uses an open-addressing hash table, so the cost of discovery
+// is linear in the size of the input regardless of how many columns there are.
+//
+// Memory is either from malloc() or R_alloc():
+//   - malloc()  - for schemas used on worker threads, or which must outlive
+//                 the current .Call(). Must be released with 'schema_free()'
+//   - R_alloc() - memory is reclaimed by R at the end of the .Call(), so
+//                 nothing leaks if there is an R error.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct {
+  int ncols;
+  int capacity;
+  char **names;              // nul-terminated copies of the key names
+  size_t *name_len;
+  unsigned int *type_bitset;
+
+  int *slots;                // column index for each slot. -1 = empty
+  size_t nslots;             // always a power of 2 (or 0)
+
+  bool use_r_alloc;
+} schema_t;
+
+void schema_init(schema_t *schema, bool use_r_alloc);
+void schema_free(schema_t *schema);
+int  schema_find(schema_t *schema, const char *name, size_t len);
+int  schema_add(schema_t *schema, const char *name, size_t len);
+bool schema_merge(schema_t *dst, schema_t *src);
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Index of the column for a yyjson key (adding the column if it is new).
+// @return column index, or -1 if memory allocation failed
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static inline int schema_add_key(schema_t *schema, yyjson_val *key) {
+  return schema_add(schema, yyjson_get_str(key), yyjson_get_len(key));
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Column for the key at position 'i' within a {}-object.
+//
+// Producers almost always emit keys in the same order, so 'key_col[i]' holds
+// the column of the key at this position in the previous object.  If the
+// prediction is wrong, fall back to a hash lookup and update the prediction.
+//
+// @return column index, or -1 if the key is not in the schema
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static inline int schema_predict_col(schema_t *schema, int *key_col, size_t i, yyjson_val *key) {
+  const char *name = yyjson_get_str(key);
+  size_t len = yyjson_get_len(key);
+  int col = key_col[i];
+  
+  if (col >= 0 && schema->name_len[col] == len && memcmp(schema->names[col], name, len) == 0) {
+    return col;
+  }
+  
+  col = schema_find(schema, name, len);
+  key_col[i] = col;
+  return col;
+}
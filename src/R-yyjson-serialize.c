@@ -14,6 +14,9 @@
 
 #include "yyjson.h"
 #include "R-yyjson-serialize.h"
+#include "utils.h"
+
+#define SERIALIZE_OPTIONS_TAG "yyjson_serialize_options"
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -22,11 +25,41 @@
 yyjson_mut_val *serialize_core(SEXP robj_, yyjson_mut_doc *doc, serialize_options *opt);
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// The most recently parsed options list (and the resulting struct).
+// The list is kept with R_PreserveObject() so its address can't be re-used 
+// by another object while it is in the cache.  See 'create_parse_options()'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static SEXP cached_serialize_opts_ = NULL;
+static serialize_options cached_serialize_opt;
+
+static void cache_serialize_options(SEXP serialize_opts_, serialize_options *opt) {
+  R_PreserveObject(serialize_opts_);
+  if (cached_serialize_opts_ != NULL) {
+    R_ReleaseObject(cached_serialize_opts_);
+  }
+  cached_serialize_opts_ = serialize_opts_;
+  cached_serialize_opt   = *opt;
+}
+
+
 //===========================================================================
 // Parse the options from R list into a C struct
 //===========================================================================
 serialize_options parse_serialize_options(SEXP serialize_opts_) {
   
+  // Options compiled with 'opts_write_json(compile = TRUE)'
+  serialize_options *compiled = get_options_handle(serialize_opts_, SERIALIZE_OPTIONS_TAG);
+  if (compiled != NULL) {
+    return *compiled;
+  }
+  
+  // Re-use the result from the last call if given the same options list.
+  // See 'cache_serialize_options()'
+  if (serialize_opts_ == cached_serialize_opts_) {
+    return cached_serialize_opt;
+  }
+  
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Default options
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -59,6 +92,7 @@ serialize_options parse_serialize_options(SEXP serialize_opts_) {
   }
   
   // Iterate over R options to populate C options struct
+  bool cacheable = true;
   for (int i = 0; i < Rf_length(serialize_opts_); i++) {
     const char *opt_name = CHAR(STRING_ELT(nms_, i));
     SEXP val_ = VECTOR_ELT(serialize_opts_, i);
@@ -112,13 +146,45 @@ serialize_options parse_serialize_options(SEXP serialize_opts_) {
       }
     } else {
       Rf_warning("Unknown option ignored: '%s'\n", opt_name);
+      cacheable = false;
     }
   }
   
+  if (cacheable) {
+    cache_serialize_options(serialize_opts_, &opt);
+  }
+  
   return opt;
 }
 
 
+//===========================================================================
+// Compile an R list of options into a handle to a 'serialize_options' struct
+//===========================================================================
+static void compiled_serialize_options_finalizer(SEXP handle_) {
+  free(R_ExternalPtrAddr(handle_));
+  R_ClearExternalPtr(handle_);
+}
+
+SEXP compile_serialize_options_(SEXP serialize_opts_) {
+  
+  if (get_options_handle(serialize_opts_, SERIALIZE_OPTIONS_TAG) != NULL) {
+    return serialize_opts_;
+  }
+  
+  serialize_options opt = parse_serialize_options(serialize_opts_);
+  
+  serialize_options *compiled = malloc(sizeof(serialize_options));
+  if (compiled == NULL) {
+    Rf_error("compile_serialize_options_(): Memory allocation failed");
+  }
+  *compiled = opt;
+  
+  return make_options_handle(compiled, SERIALIZE_OPTIONS_TAG, serialize_opts_,
+                             compiled_serialize_options_finalizer, "opts_write_json_compiled");
+}
+
+
 //===========================================================================
 //    ###                  ##                 
 //   #   #                  #                 
@@ -7,13 +7,34 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <sys/stat.h>
 
-#include "zlib.h"
 #include "yyjson.h"
+#include "R-yyjson-schema.h"
 #include "R-yyjson-state.h"
+#include "file-map.h"
+#include "decompress.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// A single arena, kept between calls, for parsing small documents.
+// This is only ever used from the main R thread.
+//
+// 'small_doc_arena_in_use' guards against re-entrant use e.g. if a warning 
+// handler in R calls back into the parser while a doc is still alive.
+// Conversion of a doc from the arena to R must go through R_UnwindProtect()
+// so that the arena is still released (by 'release_small_doc_arena()') if 
+// an R error (or an interrupt) jumps out of it.  See 'parse_json_from_str()'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define SMALL_DOC_ARENA_SIZE 65536
+static size_t small_doc_arena[SMALL_DOC_ARENA_SIZE / sizeof(size_t)];
+static yyjson_alc small_doc_alc;
+static bool small_doc_arena_in_use = false;
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -36,14 +57,127 @@ void destroy_state(state_t *state) {
     yyjson_doc_free(state->doc);
   }
   
-  for (int i = 0; i < state->ncols; i++) {
-    free(state->colnames[i]);
+  for (R_xlen_t i = 0; i < state->ndocs; i++) {
+    if (state->docs[i]) {
+      yyjson_doc_free(state->docs[i]);
+    }
+  }
+  free(state->docs);
+  free(state->lines);
+  
+  // An in-situ doc points into the file map, so free it after the docs
+  if (state->map != NULL) {
+    file_map_close(state->map);
+    free(state->map);
+  }
+  if (state->maps != NULL) {
+    for (R_xlen_t i = 0; i < state->ndocs; i++) {
+      if (state->maps[i] != NULL) {
+        file_map_close(state->maps[i]);
+        free(state->maps[i]);
+      }
+    }
+    free(state->maps);
+  }
+  
+  schema_free(&state->schema);
+  
+  // Docs allocated from the arena must be freed before the arena
+  free(state->arena);
+  if (state->uses_small_doc_arena) {
+    small_doc_arena_in_use = false;
   }
   
   free(state);
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Allocator for parsing a single line of NDJSON.
+//
+// A pool allocator over a single buffer which is kept in the state and 
+// re-used for every line, so parsing millions of short lines does not 
+// call malloc()/free() for each one.  The pool is reset each time this is
+// called, so the doc from the previous line must already have been freed.
+//
+// The buffer only grows. Very long lines are parsed with the default 
+// allocator (returns NULL) rather than holding on to a huge buffer.
+//
+// @param len length of the line
+// @param flag the yyjson read flag which will be used to parse the line
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define MAX_ARENA_SIZE (64 * 1024 * 1024)
+#define MIN_ARENA_SIZE 65536
+yyjson_alc *state_line_alc(state_t *state, size_t len, yyjson_read_flag flag) {
+  
+  size_t size = yyjson_read_max_memory_usage(len, flag);
+  if (size == 0 || size > MAX_ARENA_SIZE) {
+    return NULL;
+  }
+  
+  if (size > state->arena_size) {
+    size_t new_size = state->arena_size == 0 ? MIN_ARENA_SIZE : state->arena_size;
+    while (new_size < size) new_size *= 2;
+    
+    void *arena = realloc(state->arena, new_size);
+    if (arena == NULL) {
+      return NULL;
+    }
+    state->arena      = arena;
+    state->arena_size = new_size;
+  }
+  
+  if (!yyjson_alc_pool_init(&state->alc, state->arena, state->arena_size)) {
+    return NULL;
+  }
+  
+  return &state->alc;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Allocator for parsing a small document into 'state->doc'.
+//
+// For small inputs, yyjson's malloc() of the doc is a large part of the 
+// cost of a call.  Instead use the static arena, which is released 
+// when the state is destroyed (including by 'error_and_destroy_state()').
+//
+// Must only be called from the main thread.
+//
+// @return NULL (i.e. use the default allocator) if the document might not 
+//         fit in the arena, or the arena is already in use.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+yyjson_alc *state_small_doc_alc(state_t *state, size_t len, yyjson_read_flag flag) {
+  
+  if (small_doc_arena_in_use) {
+    return NULL;
+  }
+  
+  size_t size = yyjson_read_max_memory_usage(len, flag);
+  if (size == 0 || size > sizeof(small_doc_arena)) {
+    return NULL;
+  }
+  
+  if (!yyjson_alc_pool_init(&small_doc_alc, small_doc_arena, sizeof(small_doc_arena))) {
+    return NULL;
+  }
+  
+  small_doc_arena_in_use = true;
+  state->uses_small_doc_arena = true;
+  return &small_doc_alc;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Release the small doc arena when the state which held it can't be 
+// destroyed (i.e. after an R error).  Any doc from the arena must not be 
+// used again.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void release_small_doc_arena(void) {
+  small_doc_arena_in_use = false;
+}
+
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -62,3 +196,205 @@ void error_and_destroy_state(state_t *state, const char *fmt, ...) {
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parse a compressed JSON file, or any non-regular file (e.g. a pipe), 
+// into 'state->doc'
+//
+// The input is only opened once, and the compression is detected from the
+// data as it is read, so a pipe is read exactly once.
+//
+// The file is decompressed a chunk at a time into a single buffer which 
+// is fed to yyjson's incremental reader, so parsing overlaps decompression
+// and the decompressed data only ever exists once - the doc is parsed 
+// in-situ and its strings point into the buffer (held in 'state->map').
+//
+// The incremental reader needs a buffer which never moves, so address 
+// space for the largest possible output is reserved up front (deflate 
+// can't compress by more than 1032:1.  Other formats get the maximum 
+// reservation) and memory is only committed as data arrives.  
+// Multi-member/multi-frame files are a single stream, and there is no
+// reliance on the 4-byte (i.e. < 4GB) length in the gzip trailer.
+//
+// The incremental reader doesn't support the non-standard JSON options, 
+// or a scalar at the root (which may end early at a chunk boundary).  
+// For these, and if address space can't be reserved, the whole file is 
+// decompressed into the buffer first and then parsed in-situ.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define STREAM_CHUNK_SIZE  (4 << 20)
+#define GZIP_MAX_RATIO     1032
+#define STREAM_MAX_RESERVE ((size_t)1 << (sizeof(size_t) >= 8 ? 45 : 30))
+#define NONSTANDARD_FLAGS  (YYJSON_READ_JSON5 | YYJSON_READ_ALLOW_BOM | YYJSON_READ_ALLOW_INVALID_UNICODE)
+
+// Read errors are copied here, as the stream's message is freed with it
+static char stream_errmsg[256];
+
+static yyjson_doc *stream_fail(dstream_t *ds, yyjson_read_err *err, yyjson_read_code code, size_t pos, const char *msg) {
+  if (code == YYJSON_READ_ERROR_FILE_READ) {
+    snprintf(stream_errmsg, sizeof(stream_errmsg), "%s", msg);
+    msg = stream_errmsg;
+  }
+  dstream_close(ds);
+  err->code = code;
+  err->pos  = pos;
+  err->msg  = msg;
+  return NULL;
+}
+
+static bool is_json_ws(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static yyjson_doc *state_read_stream(state_t *state, const char *filename, 
+                                     yyjson_read_flag flag, yyjson_read_err *err) {
+  
+  memset(err, 0, sizeof(yyjson_read_err));
+  
+  struct stat st;
+  const char *errmsg = "file opening failed";
+  dstream_t *ds = stat(filename, &st) == 0 ? dstream_open(filename, 1, &errmsg) : NULL;
+  if (ds == NULL) {
+    return stream_fail(ds, err, YYJSON_READ_ERROR_FILE_OPEN, 0, errmsg);
+  }
+  compression_t compression = dstream_compression(ds);
+  
+  state->map = calloc(1, sizeof(file_map_t));
+  if (state->map == NULL) {
+    return stream_fail(ds, err, YYJSON_READ_ERROR_MEMORY_ALLOCATION, 0, "memory allocation failed");
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Reserve address space for the largest possible output
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  size_t capacity = STREAM_MAX_RESERVE;
+  if (compression == COMPRESSION_GZIP && S_ISREG(st.st_mode) &&
+      (size_t)st.st_size < (STREAM_MAX_RESERVE - STREAM_CHUNK_SIZE) / GZIP_MAX_RATIO) {
+    capacity = (size_t)st.st_size * GZIP_MAX_RATIO + STREAM_CHUNK_SIZE;
+  }
+  bool incremental = file_map_reserve(state->map, capacity) &&
+    (flag & NONSTANDARD_FLAGS) == 0;
+  
+  file_map_t *map = state->map;
+  yyjson_incr_state *incr = NULL;
+  size_t len = 0;
+  
+  while (state->doc == NULL) {
+    
+    // Always keep room for the chunk, plus zero padding after it
+    if (!file_map_grow(map, len + STREAM_CHUNK_SIZE + YYJSON_PADDING_SIZE)) {
+      yyjson_incr_free(incr);
+      return stream_fail(ds, err, YYJSON_READ_ERROR_MEMORY_ALLOCATION, len, "memory allocation failed");
+    }
+    
+    char *buf = (char *)map->data;
+    ptrdiff_t n = dstream_read(ds, buf + len, STREAM_CHUNK_SIZE);
+    if (n < 0) {
+      yyjson_incr_free(incr);
+      return stream_fail(ds, err, YYJSON_READ_ERROR_FILE_READ, len, dstream_error(ds));
+    }
+    if (n == 0) break;
+    len += (size_t)n;
+    
+    if (!incremental) continue;
+    
+    if (incr == NULL) {
+      // Only stream a {}-object or []-array
+      size_t i = 0;
+      while (i < len && is_json_ws(buf[i])) i++;
+      if (i == len || (buf[i] != '{' && buf[i] != '[')) {
+        incremental = false;
+        continue;
+      }
+      
+      incr = yyjson_incr_new(buf, map->map_len - YYJSON_PADDING_SIZE, 
+                             flag | YYJSON_READ_INSITU | YYJSON_READ_STOP_WHEN_DONE, NULL);
+      if (incr == NULL) {
+        return stream_fail(ds, err, YYJSON_READ_ERROR_MEMORY_ALLOCATION, 0, "memory allocation failed");
+      }
+    }
+    
+    state->doc = yyjson_incr_read(incr, len, err);
+    if (state->doc == NULL && err->code != YYJSON_READ_ERROR_MORE) {
+      yyjson_incr_free(incr);
+      dstream_close(ds);
+      return NULL;
+    }
+  }
+  yyjson_incr_free(incr);
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Not streamed: parse the whole buffer, which is followed by zero padding
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  if (!incremental) {
+    dstream_close(ds);
+    state->doc = yyjson_read_opts((char *)map->data, len, flag | YYJSON_READ_INSITU, NULL, err);
+    return state->doc;
+  }
+  
+  if (state->doc == NULL) {
+    return stream_fail(ds, err, len == 0 ? YYJSON_READ_ERROR_EMPTY_CONTENT : YYJSON_READ_ERROR_UNEXPECTED_END, 
+                       len, len == 0 ? "input data is empty" : "unexpected end of data");
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Streamed: anything after the document must be whitespace.
+  // Check the rest of the stream in a small buffer rather than keeping it.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  size_t pos = yyjson_doc_get_read_size(state->doc);
+  const char *tail = map->data + pos;
+  size_t tail_len = len - pos;
+  char trailing[4096];
+  
+  while (true) {
+    for (size_t i = 0; i < tail_len; i++, pos++) {
+      if (!is_json_ws(tail[i])) {
+        yyjson_doc_free(state->doc);
+        state->doc = NULL;
+        return stream_fail(ds, err, YYJSON_READ_ERROR_UNEXPECTED_CONTENT, pos, "unexpected content after document");
+      }
+    }
+    ptrdiff_t n = dstream_read(ds, trailing, sizeof(trailing));
+    if (n < 0) {
+      yyjson_doc_free(state->doc);
+      state->doc = NULL;
+      return stream_fail(ds, err, YYJSON_READ_ERROR_FILE_READ, pos, dstream_error(ds));
+    }
+    if (n == 0) break;
+    tail     = trailing;
+    tail_len = (size_t)n;
+  }
+  
+  dstream_close(ds);
+  return state->doc;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parse a JSON file into 'state->doc'
+//
+// Compressed files (detected by their magic bytes) and pipes are streamed.
+// See above.
+//
+// Plain files use 'yyjson_read_file()', which reads the file into a heap
+// buffer and parses it in-situ.  (Parsing in-situ from a private memory 
+// map is no better: the parser writes to most pages, so they are copied
+// anyway, and peak RSS and run time were the same on a 120MB file)
+//
+// @return the doc, or NULL if there was an error (details in 'err')
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+yyjson_doc *state_read_file(state_t *state, const char *filename, yyjson_read_flag flag, yyjson_read_err *err) {
+  
+  struct stat st;
+  if (stat(filename, &st) != 0) {
+    state->doc = yyjson_read_file(filename, flag, NULL, err); // reports the error
+    return state->doc;
+  }
+  
+  // A pipe can only be read once, so it can't be checked for compression
+  // before it is read
+  if (!S_ISREG(st.st_mode) || detect_compression(filename) != COMPRESSION_NONE) {
+    return state_read_stream(state, filename, flag, err);
+  }
+  
+  state->doc = yyjson_read_file(filename, flag, NULL, err);
+  return state->doc;
+}
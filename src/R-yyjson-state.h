@@ -1,14 +1,5 @@
 
 
-//===========================================================================
-// max columns currently allocated for parsing data.frames
-// TODO: Instead of static value, switch to dynamic allocation and grow
-//       as-needed.  Did not want to think about this at the moment, so 
-//       just set a high-ish value.  Code throws an error if this is 
-//       exceeded during a parse.
-//===========================================================================
-#define MAX_DF_COLS 2048
-
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // State
 // 
@@ -22,8 +13,25 @@
 typedef struct {
   yyjson_doc *doc; // Pass around a referece to the doc so it can be freed on error
   
-  char *colnames[MAX_DF_COLS];
-  int ncols;
+  yyjson_doc **docs; // Docs which are held across multiple lines of NDJSON input
+  R_xlen_t ndocs;
+  
+  char *lines;       // Copies of NDJSON lines to parse again later
+  size_t lines_len;
+  size_t lines_capacity;
+  
+  schema_t schema; // Column names + types found when creating a data.frame
+  
+  // Re-usable memory for parsing one NDJSON line at a time. 
+  // See 'state_line_alc()'
+  void *arena;
+  size_t arena_size;
+  yyjson_alc alc;
+  
+  bool uses_small_doc_arena; // See 'state_small_doc_alc()'
+  
+  struct file_map *map; // Input for an in-situ 'doc'. See 'state_read_stream()'
+  struct file_map **maps; // Input for each of 'docs' (if any).  May be NULL
   
 } state_t;
 
@@ -39,3 +47,7 @@ typedef struct {
 state_t *create_state(void);
 void destroy_state(state_t *state);
 void error_and_destroy_state(state_t *state, const char *fmt, ...);
+yyjson_alc *state_line_alc(state_t *state, size_t len, yyjson_read_flag flag);
+yyjson_alc *state_small_doc_alc(state_t *state, size_t len, yyjson_read_flag flag);
+void release_small_doc_arena(void);
+yyjson_doc *state_read_file(state_t *state, const char *filename, yyjson_read_flag flag, yyjson_read_err *err);
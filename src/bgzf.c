@@ -0,0 +1,483 @@
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include "bgzf.h"
+#include "file-map.h"
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parallel decompression of blocked gzip
+//
+// A gzip file may be made of many independent members, one after the
+// other.  If the start of each member is known, the members can be
+// inflated at the same time on different threads.  Member starts are
+// known for:
+//   - BGZF (blocked gzip, as written by htslib's 'bgzip').  Every member
+//     is at most 64kB and its length is in the 'BC' extra field of the
+//     gzip header.
+//   - any multi-member gzip file with a '.gzi' index alongside it
+//     (i.e. "file.ndjson.gz.gzi").  This is the index written by
+//     'bgzip --index': a little-endian uint64 count, then a
+//     (compressed offset, uncompressed offset) uint64 pair for each
+//     member after the first.
+//
+// Worker threads take the next member from the file (in order, under the
+// lock), inflate it into a slot in a ring buffer and mark it as done.
+// The reader hands out the inflated slots strictly in order, so the
+// output is exactly the same as a serial 'gzread()'.  Lines which cross
+// a member boundary are stitched together by the line reader as usual.
+//
+// The ring has a fixed number of slots, so workers wait (rather than
+// inflating the whole file into memory) if the reader falls behind.
+//
+// No R API calls.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define BGZF_SLOTS_PER_THREAD 4
+#define BGZF_MAX_THREADS      64
+#define BGZF_HEADER_SIZE      12   // Header bytes before the extra field
+
+#define SLOT_FREE  0
+#define SLOT_BUSY  1
+#define SLOT_DONE  2
+#define SLOT_ERROR 3
+
+typedef struct {
+  unsigned char *in;   // compressed member(s)
+  size_t in_len;
+  size_t in_capacity;
+  char *out;           // inflated data
+  size_t out_len;
+  size_t out_capacity;
+  int state;
+  const char *error;
+} bgzf_slot_t;
+
+struct bgzf_reader {
+  FILE *fp;
+  size_t file_size;
+  size_t offset;        // compressed offset of the next member
+
+  uint64_t *gzi;        // member offsets from a '.gzi' index (or NULL)
+  size_t ngzi;
+  size_t gzi_next;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t tid[BGZF_MAX_THREADS];
+  int nthreads;
+
+  bgzf_slot_t *slots;
+  size_t nslots;
+  size_t seq_load;      // sequence number of the next member to load
+  size_t seq_read;      // sequence number of the slot being read
+  size_t read_pos;      // read position in the current slot
+  bool reading;         // is the current slot held by the reader?
+  bool input_done;      // all members loaded (or a load failed)
+  bool shutdown;
+  const char *error;
+};
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Length of the BGZF block starting with 'hdr' (the gzip header up to and
+// including the extra field).
+//
+// @return 0 if this is not a BGZF block
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static size_t bgzf_block_size(const unsigned char *hdr, size_t len) {
+  if (len < BGZF_HEADER_SIZE || hdr[0] != 0x1f || hdr[1] != 0x8b ||
+      hdr[2] != 8 || (hdr[3] & 4) == 0) {
+    return 0;
+  }
+
+  size_t xlen = (size_t)hdr[10] | ((size_t)hdr[11] << 8);
+  if (len < BGZF_HEADER_SIZE + xlen) return 0;
+
+  const unsigned char *sub = hdr + BGZF_HEADER_SIZE;
+  const unsigned char *end = sub + xlen;
+  while (sub + 4 <= end) {
+    size_t slen = (size_t)sub[2] | ((size_t)sub[3] << 8);
+    if (sub[0] == 'B' && sub[1] == 'C' && slen == 2 && sub + 6 <= end) {
+      return ((size_t)sub[4] | ((size_t)sub[5] << 8)) + 1;
+    }
+    sub += 4 + slen;
+  }
+  return 0;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read a '.gzi' index.  The offsets must increase and be within the file
+//
+// @return NULL if there's no usable index
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static uint64_t read_le64(const unsigned char *p) {
+  uint64_t x = 0;
+  for (int i = 7; i >= 0; i--) {
+    x = (x << 8) | p[i];
+  }
+  return x;
+}
+
+static uint64_t *read_gzi(const char *filename, size_t file_size, size_t *ngzi) {
+  size_t len = strlen(filename);
+  char *gzi_filename = malloc(len + 5);
+  if (gzi_filename == NULL) return NULL;
+  memcpy(gzi_filename, filename, len);
+  memcpy(gzi_filename + len, ".gzi", 5);
+  FILE *fp = fopen(gzi_filename, "rb");
+  free(gzi_filename);
+  if (fp == NULL) return NULL;
+
+  unsigned char buf[16];
+  uint64_t *offsets = NULL;
+  if (fread(buf, 1, 8, fp) != 8) goto fail;
+  uint64_t n = read_le64(buf);
+  if (n == 0 || n > file_size) goto fail;
+
+  offsets = malloc((size_t)n * sizeof(uint64_t));
+  if (offsets == NULL) goto fail;
+  for (size_t i = 0; i < n; i++) {
+    if (fread(buf, 1, 16, fp) != 16) goto fail;
+    offsets[i] = read_le64(buf);
+    uint64_t prev = i == 0 ? 0 : offsets[i - 1];
+    if (offsets[i] <= prev || offsets[i] >= file_size) goto fail;
+  }
+
+  fclose(fp);
+  *ngzi = (size_t)n;
+  return offsets;
+
+  fail:
+  free(offsets);
+  fclose(fp);
+  return NULL;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Does every '.gzi' offset point at the start of a gzip member? 
+// i.e. the magic bytes and deflate method '1f 8b 08'.  A stale index (e.g.
+// from before the file was re-compressed) is then never trusted.
+// Leaves the file at its start.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool gzi_offsets_valid(FILE *fp, const uint64_t *offsets, size_t n) {
+  unsigned char magic[3];
+  bool ok = true;
+  for (size_t i = 0; ok && i < n; i++) {
+    ok = file_seek(fp, offsets[i]) && fread(magic, 1, 3, fp) == 3 &&
+      magic[0] == 0x1f && magic[1] == 0x8b && magic[2] == 0x08;
+  }
+  rewind(fp);
+  return ok;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read the next member(s) from the file into a slot.  Called with the lock
+// held, as members must be read in order.
+//
+// @return true if a member was read.  false at the end of the file or on
+//         error (reader->error is set)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool slot_reserve_in(bgzf_slot_t *slot, size_t len) {
+  if (len <= slot->in_capacity) return true;
+  unsigned char *in = realloc(slot->in, len);
+  if (in == NULL) return false;
+  slot->in = in;
+  slot->in_capacity = len;
+  return true;
+}
+
+static bool bgzf_load(bgzf_reader_t *reader, bgzf_slot_t *slot) {
+  if (reader->offset >= reader->file_size) return false;
+
+  size_t block_size;
+  size_t nread = 0;
+  unsigned char hdr[BGZF_HEADER_SIZE + 6];
+
+  if (reader->gzi != NULL) {
+    size_t end = reader->gzi_next < reader->ngzi ? (size_t)reader->gzi[reader->gzi_next] : reader->file_size;
+    reader->gzi_next++;
+    block_size = end - reader->offset;
+  } else {
+    // Read the header to get the block size
+    nread = fread(hdr, 1, sizeof(hdr), reader->fp);
+    block_size = bgzf_block_size(hdr, nread);
+    if (block_size < sizeof(hdr)) {
+      reader->error = "invalid BGZF block";
+      return false;
+    }
+  }
+
+  if (!slot_reserve_in(slot, block_size)) {
+    reader->error = "memory allocation failed";
+    return false;
+  }
+  memcpy(slot->in, hdr, nread);
+  if (fread(slot->in + nread, 1, block_size - nread, reader->fp) != block_size - nread) {
+    reader->error = "truncated gzip data";
+    return false;
+  }
+
+  slot->in_len = block_size;
+  reader->offset += block_size;
+  return true;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Inflate the gzip member(s) in a slot.  No lock needed.
+// zlib checks the CRC and length in each member's trailer.
+//
+// @return NULL on success, otherwise an error message
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static const char *bgzf_inflate(bgzf_slot_t *slot, z_stream *strm) {
+
+  if (slot->in_len < 18) return "truncated gzip data";
+
+  // Size hint from the trailer of the last member (uncompressed length mod 2^32)
+  const unsigned char *isize = slot->in + slot->in_len - 4;
+  size_t hint = (size_t)isize[0] | ((size_t)isize[1] << 8) |
+    ((size_t)isize[2] << 16) | ((size_t)isize[3] << 24);
+  if (hint < 65536) hint = 65536;
+
+  slot->out_len = 0;
+  if (slot->in_len > UINT32_MAX) return "gzip member is too large";
+  if (inflateReset(strm) != Z_OK) return "gzip decompression failed";
+  strm->next_in  = slot->in;
+  strm->avail_in = (uInt)slot->in_len;
+
+  for (;;) {
+    if (slot->out_len == slot->out_capacity) {
+      size_t capacity = slot->out_capacity == 0 ? hint : 2 * slot->out_capacity;
+      char *out = realloc(slot->out, capacity);
+      if (out == NULL) return "memory allocation failed";
+      slot->out = out;
+      slot->out_capacity = capacity;
+    }
+
+    size_t avail = slot->out_capacity - slot->out_len;
+    if (avail > UINT32_MAX) avail = UINT32_MAX;
+    strm->next_out  = (Bytef *)slot->out + slot->out_len;
+    strm->avail_out = (uInt)avail;
+
+    int ret = inflate(strm, Z_NO_FLUSH);
+    slot->out_len += avail - strm->avail_out;
+
+    if (ret == Z_STREAM_END) {
+      if (strm->avail_in == 0) return NULL;
+      // Another member follows
+      if (inflateReset(strm) != Z_OK) return "gzip decompression failed";
+    } else if (ret == Z_BUF_ERROR || (ret == Z_OK && strm->avail_out > 0)) {
+      if (strm->avail_out > 0) return "truncated gzip data";
+    } else if (ret != Z_OK) {
+      return strm->msg != NULL ? strm->msg : "gzip decompression failed";
+    }
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Worker thread
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void *bgzf_worker(void *arg) {
+  bgzf_reader_t *reader = (bgzf_reader_t *)arg;
+
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  bool ok = inflateInit2(&strm, 15 + 16) == Z_OK; // gzip wrapper
+
+  pthread_mutex_lock(&reader->lock);
+  for (;;) {
+    while (!reader->shutdown && !reader->input_done &&
+           reader->seq_load - reader->seq_read >= reader->nslots) {
+      pthread_cond_wait(&reader->cond, &reader->lock);
+    }
+    if (reader->shutdown || reader->input_done) break;
+
+    bgzf_slot_t *slot = &reader->slots[reader->seq_load % reader->nslots];
+    if (!bgzf_load(reader, slot)) {
+      reader->input_done = true;
+      pthread_cond_broadcast(&reader->cond);
+      break;
+    }
+    reader->seq_load++;
+    slot->state = SLOT_BUSY;
+    pthread_mutex_unlock(&reader->lock);
+
+    const char *error = ok ? bgzf_inflate(slot, &strm) : "gzip decompression failed";
+
+    pthread_mutex_lock(&reader->lock);
+    slot->error = error;
+    slot->state = error == NULL ? SLOT_DONE : SLOT_ERROR;
+    pthread_cond_broadcast(&reader->cond);
+  }
+  pthread_mutex_unlock(&reader->lock);
+
+  if (ok) inflateEnd(&strm);
+  return NULL;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Open a reader.
+//
+// @return NULL if the file isn't BGZF (and has no valid '.gzi' index), or 
+//         if the reader can't be started.  The file should then be read 
+//         serially.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bgzf_reader_t *bgzf_open(const char *filename, int nthreads) {
+
+  struct stat st;
+  if (nthreads < 2 || stat(filename, &st) != 0 || !S_ISREG(st.st_mode)) return NULL;
+  if (nthreads > BGZF_MAX_THREADS) nthreads = BGZF_MAX_THREADS;
+
+  bgzf_reader_t *reader = calloc(1, sizeof(bgzf_reader_t));
+  if (reader == NULL) return NULL;
+  reader->file_size = (size_t)st.st_size;
+
+  reader->fp = fopen(filename, "rb");
+  if (reader->fp == NULL) {
+    free(reader);
+    return NULL;
+  }
+
+  // BGZF, or else any gzip file with an index
+  unsigned char hdr[BGZF_HEADER_SIZE + 64];
+  size_t n = fread(hdr, 1, sizeof(hdr), reader->fp);
+  rewind(reader->fp);
+  if (bgzf_block_size(hdr, n) == 0) {
+    reader->gzi = read_gzi(filename, reader->file_size, &reader->ngzi);
+    if (reader->gzi == NULL || !gzi_offsets_valid(reader->fp, reader->gzi, reader->ngzi)) {
+      free(reader->gzi);
+      fclose(reader->fp);
+      free(reader);
+      return NULL;
+    }
+  }
+
+  reader->nslots = (size_t)nthreads * BGZF_SLOTS_PER_THREAD;
+  reader->slots  = calloc(reader->nslots, sizeof(bgzf_slot_t));
+  if (reader->slots == NULL) {
+    free(reader->gzi);
+    fclose(reader->fp);
+    free(reader);
+    return NULL;
+  }
+
+  pthread_mutex_init(&reader->lock, NULL);
+  pthread_cond_init(&reader->cond, NULL);
+
+  for (int i = 0; i < nthreads; i++) {
+    if (pthread_create(&reader->tid[reader->nthreads], NULL, bgzf_worker, reader) == 0) {
+      reader->nthreads++;
+    }
+  }
+  if (reader->nthreads == 0) {
+    bgzf_close(reader);
+    return NULL;
+  }
+
+  return reader;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read up to 'len' inflated bytes, in file order.
+// Less than 'len' bytes are only returned at the end of the file.
+//
+// @return number of bytes read. 0 at end of file. -1 on error
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ptrdiff_t bgzf_read(bgzf_reader_t *reader, void *buf, size_t len) {
+  size_t total = 0;
+
+  while (total < len) {
+    bgzf_slot_t *slot = &reader->slots[reader->seq_read % reader->nslots];
+
+    if (reader->reading && reader->read_pos < slot->out_len) {
+      size_t n = slot->out_len - reader->read_pos;
+      if (n > len - total) n = len - total;
+      memcpy((char *)buf + total, slot->out + reader->read_pos, n);
+      reader->read_pos += n;
+      total += n;
+      continue;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+
+    // Hand the finished slot back to the workers
+    if (reader->reading) {
+      slot->state = SLOT_FREE;
+      reader->seq_read++;
+      reader->read_pos = 0;
+      reader->reading = false;
+      pthread_cond_broadcast(&reader->cond);
+      slot = &reader->slots[reader->seq_read % reader->nslots];
+    }
+
+    // Wait for the next slot to be inflated, or for the end of the input
+    while (!(reader->seq_read < reader->seq_load && slot->state >= SLOT_DONE) &&
+           !(reader->input_done && reader->seq_read >= reader->seq_load)) {
+      pthread_cond_wait(&reader->cond, &reader->lock);
+    }
+
+    if (reader->seq_read >= reader->seq_load) {
+      pthread_mutex_unlock(&reader->lock);
+      if (reader->error != NULL && total == 0) return -1;
+      break;
+    }
+
+    if (slot->state == SLOT_ERROR) {
+      reader->error = slot->error;
+      pthread_mutex_unlock(&reader->lock);
+      return -1;
+    }
+
+    reader->reading = true;
+    pthread_mutex_unlock(&reader->lock);
+  }
+
+  return (ptrdiff_t)total;
+}
+
+
+const char *bgzf_error(bgzf_reader_t *reader) {
+  return reader->error != NULL ? reader->error : "unknown error";
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Stop the workers and free all resources
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void bgzf_close(bgzf_reader_t *reader) {
+  if (reader == NULL) return;
+
+  pthread_mutex_lock(&reader->lock);
+  reader->shutdown = true;
+  pthread_cond_broadcast(&reader->cond);
+  pthread_mutex_unlock(&reader->lock);
+
+  for (int i = 0; i < reader->nthreads; i++) {
+    pthread_join(reader->tid[i], NULL);
+  }
+  pthread_mutex_destroy(&reader->lock);
+  pthread_cond_destroy(&reader->cond);
+
+  for (size_t i = 0; i < reader->nslots; i++) {
+    free(reader->slots[i].in);
+    free(reader->slots[i].out);
+  }
+  free(reader->slots);
+  free(reader->gzi);
+  fclose(reader->fp);
+  free(reader);
+}
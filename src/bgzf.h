@@ -0,0 +1,13 @@
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parallel decompression of blocked gzip.  See 'bgzf.c'
+//
+// Read through 'dstream_open()' with more than one thread, rather than
+// directly.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct bgzf_reader bgzf_reader_t;
+
+bgzf_reader_t *bgzf_open(const char *filename, int nthreads);
+ptrdiff_t bgzf_read(bgzf_reader_t *reader, void *buf, size_t len);
+const char *bgzf_error(bgzf_reader_t *reader);
+void bgzf_close(bgzf_reader_t *reader);
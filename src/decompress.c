@@ -0,0 +1,860 @@
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+#include "bgzf.h"
+#include "decompress.h"
+#include "file-map.h"
+
+// Size of the buffer for compressed input
+#define DSTREAM_IN_SIZE (1 << 17)
+
+// Read-ahead ring.  See 'dstream_start_readahead()'
+#define READAHEAD_BLOCKS        4
+#define READAHEAD_BLOCK_SIZE    (1 << 20)
+#define READAHEAD_MIN_FILE_SIZE (1 << 20)
+
+typedef struct {
+  pthread_t tid;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char *block[READAHEAD_BLOCKS];
+  size_t len[READAHEAD_BLOCKS];
+  size_t head;      // number of blocks filled by the producer
+  size_t tail;      // number of blocks finished by the reader
+  size_t pos;       // read position in the 'tail' block
+  bool eof;
+  bool shutdown;
+  const char *error;
+  readahead_stats_t stats;
+} readahead_t;
+
+// Stats from the most recently closed stream with read-ahead
+static readahead_stats_t last_readahead_stats;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// A decompression stream.
+//
+// The file is opened once, and the compression is detected from the first
+// bytes read into 'in'.  The file is never re-opened to peek at it, as 
+// that would lose data from a pipe (e.g. '/dev/stdin').
+//
+// gzip is inflated with 'zs' (which also handles multi-member files), or 
+// on multiple threads if it is blocked gzip.  See 'bgzf.c'.
+// For the other formats, compressed blocks are read from 'fp' into 'in' 
+// and then decompressed straight into the caller's buffer.  Uncompressed
+// data is copied from 'in' until it is used up, and then read from 'fp'.
+//
+// No R API calls, so a stream may be read from any thread.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+struct dstream {
+  compression_t compression;
+
+  FILE *fp;
+  bgzf_reader_t *bgzf;
+  z_stream *zs;
+  bool zs_raw;   // 'zs' is inflating raw deflate data, not a gzip member
+  readahead_t *ra;
+  size_t file_size;
+
+  unsigned char *in;
+  size_t in_pos;
+  size_t in_len;
+  bool in_eof;
+
+  bool pending;  // Decoder is part way through a frame
+  bool done;
+  const char *error;
+
+#ifdef HAVE_ZSTD
+  ZSTD_DCtx *zstd;
+#endif
+#ifdef HAVE_LZ4
+  LZ4F_dctx *lz4;
+#endif
+#ifdef HAVE_LZMA
+  lzma_stream xz;
+  bool xz_init;
+#endif
+};
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Detect compression from the magic bytes at the start of the data
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static compression_t compression_from_magic(const unsigned char *magic, size_t n) {
+  if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+    return COMPRESSION_GZIP;
+  }
+  if (n >= 4 && memcmp(magic, "\x28\xb5\x2f\xfd", 4) == 0) {
+    return COMPRESSION_ZSTD;
+  }
+  if (n >= 4 && memcmp(magic, "\x04\x22\x4d\x18", 4) == 0) {
+    return COMPRESSION_LZ4;
+  }
+  if (n >= 6 && memcmp(magic, "\xfd\x37\x7a\x58\x5a\x00", 6) == 0) {
+    return COMPRESSION_XZ;
+  }
+  return COMPRESSION_NONE;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Detect compression from the magic bytes at the start of the file.
+//
+// Only regular files are opened to look.  Anything else (e.g. a pipe) can
+// only be read once, so is reported as uncompressed.  Open these with 
+// 'dstream_open()', which detects the compression from the stream itself.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+compression_t detect_compression(const char *filename) {
+  if (!is_regular_file(filename)) return COMPRESSION_NONE;
+
+  unsigned char magic[6] = {0, 0, 0, 0, 0, 0};
+  FILE *fp = fopen(filename, "rb");
+  if (fp == NULL) return COMPRESSION_NONE;
+  size_t n = fread(magic, 1, sizeof(magic), fp);
+  fclose(fp);
+
+  return compression_from_magic(magic, n);
+}
+
+
+const char *compression_name(compression_t compression) {
+  switch (compression) {
+  case COMPRESSION_GZIP: return "gzip";
+  case COMPRESSION_ZSTD: return "zstd";
+  case COMPRESSION_LZ4 : return "LZ4";
+  case COMPRESSION_XZ  : return "xz";
+  default              : return "uncompressed";
+  }
+}
+
+
+bool compression_supported(compression_t compression) {
+  switch (compression) {
+  case COMPRESSION_NONE:
+  case COMPRESSION_GZIP:
+    return true;
+#ifdef HAVE_ZSTD
+  case COMPRESSION_ZSTD:
+    return true;
+#endif
+#ifdef HAVE_LZ4
+  case COMPRESSION_LZ4:
+    return true;
+#endif
+#ifdef HAVE_LZMA
+  case COMPRESSION_XZ:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Open a stream
+//
+// @param nthreads number of threads for decompression.  Only blocked gzip
+//        is decompressed in parallel.  Otherwise ignored.
+// @param errmsg set to the reason for failure
+// @return NULL on failure
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static size_t dstream_fill_n(dstream_t *ds, size_t n);
+
+dstream_t *dstream_open(const char *filename, int nthreads, const char **errmsg) {
+
+  dstream_t *ds = calloc(1, sizeof(dstream_t));
+  if (ds == NULL) {
+    *errmsg = "couldn't allocate decompression stream";
+    return NULL;
+  }
+
+  *errmsg = "couldn't allocate decompression stream";
+  ds->in = malloc(DSTREAM_IN_SIZE);
+  if (ds->in == NULL) goto fail;
+
+  *errmsg = "couldn't open file";
+  ds->fp = fopen(filename, "rb");
+  if (ds->fp == NULL) goto fail;
+
+  struct stat st;
+  bool regular = fstat(fileno(ds->fp), &st) == 0 && S_ISREG(st.st_mode);
+  if (regular) {
+    ds->file_size = (size_t)st.st_size;
+  }
+
+  // The bytes used to detect the compression stay in 'in' to be decoded
+  size_t n = dstream_fill_n(ds, 6);
+  if (ds->error != NULL) {
+    *errmsg = ds->error;
+    goto fail;
+  }
+  compression_t compression = compression_from_magic(ds->in, n);
+  ds->compression = compression;
+
+  if (!compression_supported(compression)) {
+    switch (compression) {
+    case COMPRESSION_ZSTD:
+      *errmsg = "zstd compressed file, but yyjsonr was installed without libzstd";
+      break;
+    case COMPRESSION_LZ4:
+      *errmsg = "LZ4 compressed file, but yyjsonr was installed without liblz4";
+      break;
+    default:
+      *errmsg = "xz compressed file, but yyjsonr was installed without liblzma";
+    }
+    goto fail;
+  }
+
+  if (compression == COMPRESSION_NONE) return ds;
+
+  *errmsg = "couldn't allocate decompression stream";
+  switch (compression) {
+  case COMPRESSION_GZIP: {
+      // Blocked gzip is read from the (regular) file with its own handle
+      if (regular) {
+        ds->bgzf = bgzf_open(filename, nthreads);
+        if (ds->bgzf != NULL) return ds;
+      }
+      z_stream *zs = calloc(1, sizeof(z_stream));
+      if (zs == NULL || inflateInit2(zs, 15 + 16) != Z_OK) {
+        free(zs);
+        goto fail;
+      }
+      ds->zs = zs;
+    }
+    break;
+#ifdef HAVE_ZSTD
+  case COMPRESSION_ZSTD:
+    ds->zstd = ZSTD_createDCtx();
+    if (ds->zstd == NULL) goto fail;
+    break;
+#endif
+#ifdef HAVE_LZ4
+  case COMPRESSION_LZ4:
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&ds->lz4, LZ4F_VERSION))) goto fail;
+    break;
+#endif
+#ifdef HAVE_LZMA
+  case COMPRESSION_XZ: {
+      lzma_stream init = LZMA_STREAM_INIT;
+      ds->xz = init;
+      if (lzma_stream_decoder(&ds->xz, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) goto fail;
+      ds->xz_init = true;
+    }
+    break;
+#endif
+  default:
+    goto fail;
+  }
+
+  return ds;
+
+  fail:
+  dstream_close(ds);
+  return NULL;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Make sure there is compressed input in 'ds->in'
+//
+// @return false at the end of the file (or on error)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool dstream_fill(dstream_t *ds) {
+  if (ds->in_pos < ds->in_len) return true;
+  if (ds->in_eof) return false;
+
+  ds->in_pos = 0;
+  ds->in_len = fread(ds->in, 1, DSTREAM_IN_SIZE, ds->fp);
+  if (ds->in_len < DSTREAM_IN_SIZE) {
+    if (ferror(ds->fp)) {
+      ds->error = "error reading file";
+    }
+    ds->in_eof = true;
+  }
+  return ds->in_len > 0;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Make sure there are at least 'n' bytes of input in 'ds->in', unless
+// the file ends first.
+//
+// @return number of bytes available
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static size_t dstream_fill_n(dstream_t *ds, size_t n) {
+  size_t avail = ds->in_len - ds->in_pos;
+  if (avail >= n || ds->in_eof) return avail;
+
+  memmove(ds->in, ds->in + ds->in_pos, avail);
+  ds->in_pos  = 0;
+  ds->in_len  = avail;
+  ds->in_len += fread(ds->in + avail, 1, DSTREAM_IN_SIZE - avail, ds->fp);
+  if (ds->in_len < DSTREAM_IN_SIZE) {
+    if (ferror(ds->fp)) {
+      ds->error = "error reading file";
+    }
+    ds->in_eof = true;
+  }
+  return ds->in_len;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Inflate gzip
+//
+// Multi-member files are inflated member by member.  Like 'gzread()', 
+// data after the last member which isn't another gzip member is ignored,
+// but a truncated member is an error.
+//
+// A stream opened at an entry point (see 'dstream_open_at()') starts as 
+// raw deflate data part way through a gzip member.  At the end of that 
+// member, its trailer is skipped, and any following members are inflated 
+// as regular gzip.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void dstream_next_member(dstream_t *ds) {
+  size_t trailer = ds->zs_raw ? 8 : 0;
+  size_t avail   = dstream_fill_n(ds, trailer + 2);
+  if (ds->error != NULL) return;
+  if (avail < trailer) {
+    ds->error = "truncated gzip data";
+    return;
+  }
+
+  ds->in_pos += trailer;
+  const unsigned char *p = ds->in + ds->in_pos;
+  if (avail >= trailer + 2 && p[0] == 0x1f && p[1] == 0x8b) {
+    inflateReset2(ds->zs, 15 + 16);
+    ds->zs_raw = false;
+  } else {
+    ds->done = true;
+  }
+}
+
+
+static ptrdiff_t dstream_read_inflate(dstream_t *ds, void *buf, size_t len) {
+  z_stream *zs = ds->zs;
+  size_t out_pos = 0;
+
+  while (out_pos < len && !ds->done) {
+    bool have_input = dstream_fill(ds);
+    if (ds->error != NULL) return -1;
+    if (!have_input) {
+      ds->error = "truncated gzip data";
+      return -1;
+    }
+
+    uInt avail_out = len - out_pos > UINT32_MAX ? UINT32_MAX : (uInt)(len - out_pos);
+    zs->next_in   = ds->in + ds->in_pos;
+    zs->avail_in  = (uInt)(ds->in_len - ds->in_pos);
+    zs->next_out  = (Bytef *)buf + out_pos;
+    zs->avail_out = avail_out;
+    int ret = inflate(zs, Z_NO_FLUSH);
+    ds->in_pos = ds->in_len - zs->avail_in;
+    out_pos   += avail_out - zs->avail_out;
+
+    if (ret == Z_STREAM_END) {
+      dstream_next_member(ds);
+      if (ds->error != NULL) return -1;
+    } else if (ret != Z_OK) {
+      ds->error = zs->msg != NULL ? zs->msg : "corrupt gzip data";
+      return -1;
+    }
+  }
+
+  return (ptrdiff_t)out_pos;
+}
+
+
+static dstream_t *dstream_open_gzip_at(const char *filename, const dstream_point_t *point, 
+                                       const char **errmsg) {
+  dstream_t *ds = calloc(1, sizeof(dstream_t));
+  if (ds == NULL) {
+    *errmsg = "couldn't allocate decompression stream";
+    return NULL;
+  }
+  ds->compression = COMPRESSION_GZIP;
+  
+  struct stat st;
+  if (stat(filename, &st) == 0) {
+    ds->file_size = (size_t)st.st_size;
+  }
+  
+  *errmsg = "couldn't open file";
+  ds->fp = fopen(filename, "rb");
+  if (ds->fp == NULL) goto fail;
+  if (!file_seek(ds->fp, point->in - (point->bits ? 1 : 0))) goto fail;
+  
+  *errmsg = "couldn't allocate decompression stream";
+  ds->in = malloc(DSTREAM_IN_SIZE);
+  z_stream *zs = calloc(1, sizeof(z_stream));
+  if (ds->in == NULL || zs == NULL || inflateInit2(zs, -15) != Z_OK) {
+    free(zs);
+    goto fail;
+  }
+  ds->zs     = zs;
+  ds->zs_raw = true;
+  
+  *errmsg = "invalid entry point for gzip data";
+  if (point->bits > 0) {
+    int ch = getc(ds->fp);
+    if (ch == EOF || inflatePrime(zs, point->bits, ch >> (8 - point->bits)) != Z_OK) goto fail;
+  }
+  if (inflateSetDictionary(zs, point->window, DSTREAM_WINDOW_SIZE) != Z_OK) goto fail;
+  
+  return ds;
+  
+  fail:
+  dstream_close(ds);
+  return NULL;
+}
+
+
+#ifdef HAVE_ZSTD
+static ptrdiff_t dstream_read_zstd(dstream_t *ds, void *buf, size_t len) {
+  ZSTD_outBuffer out = { buf, len, 0 };
+
+  while (out.pos < out.size) {
+    bool have_input = dstream_fill(ds);
+    if (ds->error != NULL) return -1;
+    if (!have_input && !ds->pending) break;
+
+    // With no more input, the decoder may still hold buffered output
+    size_t before = out.pos;
+    ZSTD_inBuffer in = { ds->in, ds->in_len, ds->in_pos };
+    size_t ret = ZSTD_decompressStream(ds->zstd, &out, &in);
+    if (ZSTD_isError(ret)) {
+      ds->error = ZSTD_getErrorName(ret);
+      return -1;
+    }
+    ds->in_pos  = in.pos;
+    ds->pending = ret != 0;
+
+    if (!have_input && out.pos == before) {
+      ds->error = "truncated zstd data";
+      return -1;
+    }
+  }
+
+  return (ptrdiff_t)out.pos;
+}
+#endif
+
+
+#ifdef HAVE_LZ4
+static ptrdiff_t dstream_read_lz4(dstream_t *ds, void *buf, size_t len) {
+  size_t out_pos = 0;
+
+  while (out_pos < len) {
+    bool have_input = dstream_fill(ds);
+    if (ds->error != NULL) return -1;
+    if (!have_input && !ds->pending) break;
+
+    size_t dst_size = len - out_pos;
+    size_t src_size = ds->in_len - ds->in_pos;
+    size_t ret = LZ4F_decompress(ds->lz4, (char *)buf + out_pos, &dst_size,
+                                 ds->in + ds->in_pos, &src_size, NULL);
+    if (LZ4F_isError(ret)) {
+      ds->error = LZ4F_getErrorName(ret);
+      return -1;
+    }
+    ds->in_pos += src_size;
+    out_pos    += dst_size;
+    ds->pending = ret != 0;
+
+    if (!have_input && dst_size == 0) {
+      ds->error = "truncated LZ4 data";
+      return -1;
+    }
+  }
+
+  return (ptrdiff_t)out_pos;
+}
+#endif
+
+
+#ifdef HAVE_LZMA
+static ptrdiff_t dstream_read_xz(dstream_t *ds, void *buf, size_t len) {
+  ds->xz.next_out  = buf;
+  ds->xz.avail_out = len;
+
+  while (ds->xz.avail_out > 0 && !ds->done) {
+    bool have_input = dstream_fill(ds);
+    if (ds->error != NULL) return -1;
+
+    ds->xz.next_in  = ds->in + ds->in_pos;
+    ds->xz.avail_in = ds->in_len - ds->in_pos;
+    lzma_ret ret = lzma_code(&ds->xz, have_input ? LZMA_RUN : LZMA_FINISH);
+    ds->in_pos = ds->in_len - ds->xz.avail_in;
+
+    if (ret == LZMA_STREAM_END) {
+      ds->done = true;
+    } else if (ret != LZMA_OK) {
+      switch (ret) {
+      case LZMA_MEM_ERROR : ds->error = "xz: memory allocation failed"; break;
+      case LZMA_BUF_ERROR : ds->error = "truncated xz data"; break;
+      case LZMA_DATA_ERROR: ds->error = "xz: corrupt data"; break;
+      default             : ds->error = "xz: decompression failed";
+      }
+      return -1;
+    }
+  }
+
+  return (ptrdiff_t)(len - ds->xz.avail_out);
+}
+#endif
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read directly from the decompressor
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static ptrdiff_t dstream_read_direct(dstream_t *ds, void *buf, size_t len) {
+  if (ds->error != NULL) return -1;
+
+  switch (ds->compression) {
+  case COMPRESSION_NONE: {
+      // First the bytes which were read to detect the compression
+      size_t n = ds->in_len - ds->in_pos;
+      if (n > len) n = len;
+      memcpy(buf, ds->in + ds->in_pos, n);
+      ds->in_pos += n;
+      if (n < len && !ds->in_eof) {
+        n += fread((char *)buf + n, 1, len - n, ds->fp);
+        if (n < len && ferror(ds->fp)) {
+          ds->error = "error reading file";
+          return -1;
+        }
+      }
+      return (ptrdiff_t)n;
+    }
+  case COMPRESSION_GZIP: {
+      if (ds->bgzf != NULL) {
+        ptrdiff_t n = bgzf_read(ds->bgzf, buf, len);
+        if (n < 0) ds->error = bgzf_error(ds->bgzf);
+        return n;
+      }
+      return dstream_read_inflate(ds, buf, len);
+    }
+#ifdef HAVE_ZSTD
+  case COMPRESSION_ZSTD:
+    return dstream_read_zstd(ds, buf, len);
+#endif
+#ifdef HAVE_LZ4
+  case COMPRESSION_LZ4:
+    return dstream_read_lz4(ds, buf, len);
+#endif
+#ifdef HAVE_LZMA
+  case COMPRESSION_XZ:
+    return dstream_read_xz(ds, buf, len);
+#endif
+  default:
+    ds->error = "unsupported compression";
+    return -1;
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Open a stream positioned at 'offset' bytes into the decompressed data
+//
+// Uncompressed files seek straight to 'offset'.  gzip files start 
+// inflating from 'point' (if given) which must be at or before 'offset'.
+// Otherwise data before 'offset' is decompressed and discarded.
+//
+// An error while discarding is reported by the first read.
+//
+// @param point entry point into a gzip stream, or NULL
+// @param errmsg set to the reason for failure
+// @return NULL on failure
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+dstream_t *dstream_open_at(const char *filename, const dstream_point_t *point, 
+                           uint64_t offset, const char **errmsg) {
+  dstream_t *ds;
+  uint64_t pos = 0;
+  
+  if (point != NULL && point->out > 0 && point->out <= offset &&
+      detect_compression(filename) == COMPRESSION_GZIP) {
+    ds  = dstream_open_gzip_at(filename, point, errmsg);
+    pos = point->out;
+  } else {
+    ds = dstream_open(filename, 1, errmsg);
+  }
+  if (ds == NULL) return NULL;
+  
+  if (ds->compression == COMPRESSION_NONE) {
+    if (!file_seek(ds->fp, offset)) {
+      *errmsg = "couldn't seek in file";
+      dstream_close(ds);
+      return NULL;
+    }
+    // Drop the bytes read (from the start of the file) by 'dstream_open()'
+    ds->in_pos = ds->in_len = 0;
+    ds->in_eof = false;
+    return ds;
+  }
+  
+  char *buf = malloc(DSTREAM_IN_SIZE);
+  if (buf == NULL) {
+    *errmsg = "couldn't allocate decompression stream";
+    dstream_close(ds);
+    return NULL;
+  }
+  while (pos < offset) {
+    size_t len = offset - pos < DSTREAM_IN_SIZE ? (size_t)(offset - pos) : DSTREAM_IN_SIZE;
+    ptrdiff_t n = dstream_read_direct(ds, buf, len);
+    if (n <= 0) break;
+    pos += (uint64_t)n;
+  }
+  free(buf);
+  
+  return ds;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read-ahead
+//
+// A single compressed stream can't be split, but decompression can still
+// overlap with whatever the reader does with the data (i.e. splitting
+// lines and parsing).  A producer thread decompresses into a ring of large
+// blocks, while the reader copies data out of the oldest filled block.
+// Total time is then close to max(decompress, parse) rather than the sum.
+//
+// Each side counts how often it had to wait for the other:
+//   - producer stalls: the ring was full.  Parsing is the bottleneck
+//   - reader stalls: the ring was empty.  Decompression is the bottleneck
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void *readahead_producer(void *arg) {
+  dstream_t *ds = (dstream_t *)arg;
+  readahead_t *ra = ds->ra;
+
+  pthread_mutex_lock(&ra->lock);
+  while (!ra->shutdown && !ra->eof) {
+    if (ra->head - ra->tail == READAHEAD_BLOCKS) {
+      ra->stats.producer_stalls++;
+      while (!ra->shutdown && ra->head - ra->tail == READAHEAD_BLOCKS) {
+        pthread_cond_wait(&ra->cond, &ra->lock);
+      }
+      if (ra->shutdown) break;
+    }
+    size_t idx = ra->head % READAHEAD_BLOCKS;
+    pthread_mutex_unlock(&ra->lock);
+
+    // Only this thread touches the decompressor (and 'ds->error') until 
+    // it has exited
+    ptrdiff_t n = dstream_read_direct(ds, ra->block[idx], READAHEAD_BLOCK_SIZE);
+
+    pthread_mutex_lock(&ra->lock);
+    if (n > 0) {
+      // A short read may still be followed by an error, so keep going
+      // until the stream reports the end
+      ra->len[idx] = (size_t)n;
+      ra->head++;
+      ra->stats.blocks++;
+    } else {
+      ra->error = n < 0 ? ds->error : NULL;
+      ra->eof   = true;
+    }
+    pthread_cond_broadcast(&ra->cond);
+  }
+  pthread_mutex_unlock(&ra->lock);
+
+  return NULL;
+}
+
+
+static ptrdiff_t readahead_read(readahead_t *ra, void *buf, size_t len) {
+  size_t total = 0;
+
+  while (total < len) {
+    pthread_mutex_lock(&ra->lock);
+
+    // Hand a finished block back to the producer
+    if (ra->tail < ra->head && ra->pos == ra->len[ra->tail % READAHEAD_BLOCKS]) {
+      ra->tail++;
+      ra->pos = 0;
+      pthread_cond_broadcast(&ra->cond);
+    }
+
+    if (ra->tail == ra->head && !ra->eof) {
+      ra->stats.reader_stalls++;
+      while (ra->tail == ra->head && !ra->eof) {
+        pthread_cond_wait(&ra->cond, &ra->lock);
+      }
+    }
+
+    if (ra->tail == ra->head) {
+      // End of stream.  Report any error once all good data is consumed
+      const char *error = ra->error;
+      pthread_mutex_unlock(&ra->lock);
+      if (error != NULL && total == 0) return -1;
+      break;
+    }
+
+    size_t idx = ra->tail % READAHEAD_BLOCKS;
+    pthread_mutex_unlock(&ra->lock);
+
+    size_t n = ra->len[idx] - ra->pos;
+    if (n > len - total) n = len - total;
+    memcpy((char *)buf + total, ra->block[idx] + ra->pos, n);
+    ra->pos += n;
+    total   += n;
+  }
+
+  return (ptrdiff_t)total;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Start decompressing ahead of the reader on another thread.  
+// Must be called before the first read.
+//
+// Only worthwhile for compressed files of a reasonable size.  Blocked gzip
+// read with multiple threads is already decompressed ahead.
+//
+// @return true if read-ahead was started
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool dstream_start_readahead(dstream_t *ds) {
+  if (ds->ra != NULL || ds->bgzf != NULL || ds->compression == COMPRESSION_NONE ||
+      ds->file_size < READAHEAD_MIN_FILE_SIZE) {
+    return false;
+  }
+
+  readahead_t *ra = calloc(1, sizeof(readahead_t));
+  if (ra == NULL) return false;
+  for (int i = 0; i < READAHEAD_BLOCKS; i++) {
+    ra->block[i] = malloc(READAHEAD_BLOCK_SIZE);
+    if (ra->block[i] == NULL) goto fail;
+  }
+
+  pthread_mutex_init(&ra->lock, NULL);
+  pthread_cond_init(&ra->cond, NULL);
+  ds->ra = ra;
+  if (pthread_create(&ra->tid, NULL, readahead_producer, ds) != 0) {
+    ds->ra = NULL;
+    pthread_mutex_destroy(&ra->lock);
+    pthread_cond_destroy(&ra->cond);
+    goto fail;
+  }
+  return true;
+
+  fail:
+  for (int i = 0; i < READAHEAD_BLOCKS; i++) {
+    free(ra->block[i]);
+  }
+  free(ra);
+  return false;
+}
+
+
+static void readahead_stop(dstream_t *ds) {
+  readahead_t *ra = ds->ra;
+
+  pthread_mutex_lock(&ra->lock);
+  ra->shutdown = true;
+  pthread_cond_broadcast(&ra->cond);
+  pthread_mutex_unlock(&ra->lock);
+  pthread_join(ra->tid, NULL);
+
+  last_readahead_stats = ra->stats;
+
+  pthread_mutex_destroy(&ra->lock);
+  pthread_cond_destroy(&ra->cond);
+  for (int i = 0; i < READAHEAD_BLOCKS; i++) {
+    free(ra->block[i]);
+  }
+  free(ra);
+  ds->ra = NULL;
+}
+
+
+readahead_stats_t dstream_last_readahead_stats(void) {
+  return last_readahead_stats;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read up to 'len' decompressed bytes into 'buf'.
+// Less than 'len' bytes are only returned at the end of the stream.
+//
+// @return number of bytes read. 0 at end of stream. -1 on error
+//         (see 'dstream_error()')
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ptrdiff_t dstream_read(dstream_t *ds, void *buf, size_t len) {
+  if (ds->ra == NULL) {
+    return dstream_read_direct(ds, buf, len);
+  }
+
+  ptrdiff_t n = readahead_read(ds->ra, buf, len);
+  if (n < 0) {
+    ds->error = ds->ra->error;
+  }
+  return n;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Compression detected when the stream was opened
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+compression_t dstream_compression(dstream_t *ds) {
+  return ds->compression;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Reason for the last failed read.  Valid until the stream is closed
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+const char *dstream_error(dstream_t *ds) {
+  return ds->error != NULL ? ds->error : "unknown error";
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Close the stream and free all resources
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void dstream_close(dstream_t *ds) {
+  if (ds == NULL) return;
+
+  if (ds->ra != NULL) readahead_stop(ds);
+  if (ds->bgzf != NULL) bgzf_close(ds->bgzf);
+  if (ds->zs != NULL) {
+    inflateEnd(ds->zs);
+    free(ds->zs);
+  }
+  if (ds->fp != NULL) fclose(ds->fp);
+#ifdef HAVE_ZSTD
+  if (ds->zstd != NULL) ZSTD_freeDCtx(ds->zstd);
+#endif
+#ifdef HAVE_LZ4
+  if (ds->lz4 != NULL) LZ4F_freeDecompressionContext(ds->lz4);
+#endif
+#ifdef HAVE_LZMA
+  if (ds->xz_init) lzma_end(&ds->xz);
+#endif
+  free(ds->in);
+  free(ds);
+}
@@ -0,0 +1,53 @@
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decompression streams.  See 'decompress.c'
+//
+// A file is read as a stream of bytes, decompressing on the fly.
+// The compression is detected from the magic bytes at the start of the
+// file (never the file extension).  A stream only opens its file once, 
+// so a pipe such as '/dev/stdin' can be read.
+//
+// gzip (zlib) is always available.  zstd, LZ4 and xz are available if the
+// library was found by 'configure' (HAVE_ZSTD, HAVE_LZ4, HAVE_LZMA).
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef enum {
+  COMPRESSION_NONE = 0,
+  COMPRESSION_GZIP,
+  COMPRESSION_ZSTD,
+  COMPRESSION_LZ4,
+  COMPRESSION_XZ
+} compression_t;
+
+typedef struct dstream dstream_t;
+
+// An entry point part way through a gzip stream, so reading can start 
+// there rather than at the start of the file.  See 'ndjson-index.c'
+#define DSTREAM_WINDOW_SIZE 32768
+
+typedef struct {
+  uint64_t out;          // offset in the decompressed data
+  uint64_t in;           // offset in the file of the first complete byte
+  int bits;              // number of bits of the byte before 'in' to use
+  const unsigned char *window;  // the DSTREAM_WINDOW_SIZE bytes before 'out'
+} dstream_point_t;
+
+typedef struct {
+  double blocks;           // blocks decompressed ahead
+  double producer_stalls;  // times the decompressor waited for the reader
+  double reader_stalls;    // times the reader waited for the decompressor
+} readahead_stats_t;
+
+compression_t detect_compression(const char *filename);
+const char *compression_name(compression_t compression);
+bool compression_supported(compression_t compression);
+
+dstream_t *dstream_open(const char *filename, int nthreads, const char **errmsg);
+dstream_t *dstream_open_at(const char *filename, const dstream_point_t *point, 
+                           uint64_t offset, const char **errmsg);
+compression_t dstream_compression(dstream_t *ds);
+ptrdiff_t dstream_read(dstream_t *ds, void *buf, size_t len);
+const char *dstream_error(dstream_t *ds);
+void dstream_close(dstream_t *ds);
+
+bool dstream_start_readahead(dstream_t *ds);
+readahead_stats_t dstream_last_readahead_stats(void);
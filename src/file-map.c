@@ -0,0 +1,201 @@
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if !defined(MAP_ANON) && defined(MAP_ANONYMOUS)
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+#endif
+
+#include "file-map.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Is this a regular file? i.e. not a pipe/fifo/device which can only be
+// read once
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool is_regular_file(const char *filename) {
+  struct stat st;
+  return stat(filename, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Seek to an absolute position, which may be beyond 2GB
+//
+// @return true on success
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool file_seek(FILE *fp, uint64_t offset) {
+#ifdef _WIN32
+  return _fseeki64(fp, (__int64)offset, SEEK_SET) == 0;
+#else
+  return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Map an entire file into memory.
+// On Windows (no mmap), the file is read into a heap buffer instead.
+// No R API calls, so the result can be shared with worker threads.
+//
+// @return true on success
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool file_map_open(const char *filename, file_map_t *map) {
+  map->data    = NULL;
+  map->len     = 0;
+  map->map_len = 0;
+  map->mapped  = false;
+
+  struct stat st;
+  if (stat(filename, &st) != 0) return false;
+
+  if (st.st_size == 0) {
+    // Can't mmap() an empty file.
+    map->data = calloc(1, 1);
+    return map->data != NULL;
+  }
+
+#ifndef _WIN32
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return false;
+  void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+    madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+    map->data    = (const char *)addr;
+    map->len     = (size_t)st.st_size;
+    map->map_len = map->len;
+    map->mapped  = true;
+    return true;
+  }
+#endif
+
+  // Fallback: read the whole file
+  char *data = malloc((size_t)st.st_size);
+  if (data == NULL) return false;
+  FILE *fp = fopen(filename, "rb");
+  if (fp == NULL) {
+    free(data);
+    return false;
+  }
+  map->len     = fread(data, 1, (size_t)st.st_size, fp);
+  map->map_len = (size_t)st.st_size;
+  map->data    = data;
+  fclose(fp);
+  return true;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Growable buffers for data of unknown length (e.g. decompressed input)
+//
+// 'file_map_reserve()' reserves 'capacity' bytes of address space without
+// using any memory.  'file_map_grow()' then makes the start of it usable
+// as data arrives.  The address never changes, so a parser can hold
+// pointers into the buffer while it is still growing.
+//
+// The last page of the reservation is also made usable straight away, so
+// a reader may write padding at the very end.
+//
+// 'map->len' is the usable length, and 'map->map_len' the reserved length.
+//
+// If address space can't be reserved (e.g. on Windows), the buffer is 
+// grown with realloc() instead, and the address may change on each grow.
+// No R API calls.
+//
+// @return true on success
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define FILE_MAP_GROW_SIZE (16 << 20)
+
+bool file_map_reserve(file_map_t *map, size_t capacity) {
+  map->data    = NULL;
+  map->len     = 0;
+  map->map_len = 0;
+  map->mapped  = false;
+  
+#if !defined(_WIN32) && defined(MAP_ANON)
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  capacity = (capacity + 2 * page_size - 1) / page_size * page_size;
+  
+  void *addr = mmap(NULL, capacity, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+  if (addr == MAP_FAILED) return false;
+  
+  if (mprotect((char *)addr + capacity - page_size, page_size, PROT_READ | PROT_WRITE) != 0) {
+    munmap(addr, capacity);
+    return false;
+  }
+  
+  map->data    = (const char *)addr;
+  map->map_len = capacity;
+  map->mapped  = true;
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+bool file_map_grow(file_map_t *map, size_t len) {
+  if (len <= map->len) return true;
+  
+  size_t new_len = map->len + FILE_MAP_GROW_SIZE;
+  if (new_len < len) new_len = len;
+  
+  if (!map->mapped) {
+    if (new_len < 2 * map->len) new_len = 2 * map->len;
+    char *data = realloc((void *)map->data, new_len);
+    if (data == NULL) return false;
+    memset(data + map->len, 0, new_len - map->len);
+    map->data    = data;
+    map->len     = new_len;
+    map->map_len = new_len;
+    return true;
+  }
+  
+#ifndef _WIN32
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  new_len = (new_len + page_size - 1) / page_size * page_size;
+  if (new_len > map->map_len - page_size) {
+    if (len > map->map_len - page_size) return false;
+    new_len = map->map_len - page_size;
+  }
+  if (mprotect((char *)map->data + map->len, new_len - map->len, PROT_READ | PROT_WRITE) != 0) {
+    return false;
+  }
+  map->len = new_len;
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Release a file map
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void file_map_close(file_map_t *map) {
+  if (map->data == NULL) return;
+#ifndef _WIN32
+  if (map->mapped) {
+    munmap((void *)map->data, map->map_len);
+  } else {
+    free((void *)map->data);
+  }
+#else
+  free((void *)map->data);
+#endif
+  map->data    = NULL;
+  map->len     = 0;
+  map->map_len = 0;
+}
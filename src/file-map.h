@@ -0,0 +1,19 @@
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// A view of an entire file.  See 'file-map.c'
+// Memory-mapped where possible, otherwise the file is read into memory.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct file_map {
+  const char *data;
+  size_t len;
+  size_t map_len;  // bytes mapped/allocated.  May be more than 'len'
+  bool mapped;     // true if 'data' is from mmap(), otherwise from malloc()
+} file_map_t;
+
+bool file_map_open(const char *filename, file_map_t *map);
+bool file_map_reserve(file_map_t *map, size_t capacity);
+bool file_map_grow(file_map_t *map, size_t len);
+void file_map_close(file_map_t *map);
+
+bool is_regular_file(const char *filename);
+bool file_seek(FILE *fp, uint64_t offset);
@@ -14,8 +14,12 @@
 #include <zlib.h>
 
 #include "yyjson.h"
+#include "R-yyjson-schema.h"
 #include "R-yyjson-state.h"
 #include "R-yyjson-parse.h"
+#include "utils.h"
+
+#define GEO_PARSE_OPTIONS_TAG "yyjson_geo_parse_options"
 
 #define SF_POINT               1 << 1
 #define SF_MULTIPOINT          1 << 2
@@ -79,6 +83,13 @@ typedef struct {
 // Initialise geo_parse_opts from an R named list from the user
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 geo_parse_options create_geo_parse_options(SEXP geo_opts_) {
+  
+  // Options compiled with 'opts_read_geojson(compile = TRUE)'
+  geo_parse_options *compiled = get_options_handle(geo_opts_, GEO_PARSE_OPTIONS_TAG);
+  if (compiled != NULL) {
+    return *compiled;
+  }
+  
   geo_parse_options opt = {
     .property_promotion = PROP_TYPE_STRING, // emulate 'geojsonsf' behaviour
   .property_promotion_lgl = PROP_LGL_AS_INT, // emulate 'geojsonsf' behaviour
@@ -129,6 +140,35 @@ geo_parse_options create_geo_parse_options(SEXP geo_opts_) {
   return opt;
 }
 
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Compile an R list of options into a handle to a 'geo_parse_options' struct.
+// The bounding box accumulators are reset each time the struct is used as 
+// it is copied out of the handle.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void compiled_geo_parse_options_finalizer(SEXP handle_) {
+  free(R_ExternalPtrAddr(handle_));
+  R_ClearExternalPtr(handle_);
+}
+
+SEXP compile_geo_parse_options_(SEXP geo_opts_) {
+  
+  if (get_options_handle(geo_opts_, GEO_PARSE_OPTIONS_TAG) != NULL) {
+    return geo_opts_;
+  }
+  
+  geo_parse_options opt = create_geo_parse_options(geo_opts_);
+  
+  geo_parse_options *compiled = malloc(sizeof(geo_parse_options));
+  if (compiled == NULL) {
+    Rf_error("compile_geo_parse_options_(): Memory allocation failed");
+  }
+  *compiled = opt;
+  
+  return make_options_handle(compiled, GEO_PARSE_OPTIONS_TAG, geo_opts_,
+                             compiled_geo_parse_options_finalizer, "opts_read_geojson_compiled");
+}
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // reset the bounding box in 'opt'
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -1089,12 +1129,6 @@ SEXP parse_feature(yyjson_val *obj, geo_parse_options *opt, state_t *state) {
 
 
 
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Accumulating types and names for properies should really be dynamic, 
-// but for first draft, just set a static upper limit on number of properiies.
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-#define MAX_PROPS 256
-
 //===========================================================================
 //  #####                 #                            ###           ##     ##   
 //  #                     #                           #   #           #      #   
@@ -1283,9 +1317,8 @@ SEXP parse_feature_collection(yyjson_val *obj, geo_parse_options *opt, state_t *
   // Iterate over all features to determine full set of properties
   // and their types
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  char *prop_names[MAX_PROPS];
-  unsigned int type_bitset[MAX_PROPS] = {0};
-  size_t nprops = 0;
+  schema_t props_schema;
+  schema_init(&props_schema, true);
   
   unsigned int id_type_bitset = 0;
   
@@ -1306,28 +1339,15 @@ SEXP parse_feature_collection(yyjson_val *obj, geo_parse_options *opt, state_t *
     while ((prop_name = yyjson_obj_iter_next(&prop_iter))) {
       prop_val = yyjson_obj_iter_get_val(prop_name);
       
-      int name_idx = -1;
-      for (int i = 0; i < nprops; i++) {
-        if (yyjson_equals_str(prop_name, prop_names[i])) {
-          name_idx = i;
-          break;
-        }
-      }
-      if (name_idx < 0) {
-        // Name has not been seen yet. so add it.
-        name_idx = (int)nprops;
-        prop_names[nprops] = (char *)yyjson_get_str(prop_name);
-        // Rprintf("Key: %s\n", yyjson_get_str(prop_name));
-        nprops++;
-        if (nprops == MAX_PROPS) {
-          error_and_destroy_state(state, "Maximum properies exceeded parsing feature collection: %i", MAX_PROPS);
-        }
-      }
-      
-      type_bitset[name_idx] = update_type_bitset(type_bitset[name_idx], prop_val, opt->parse_opt);
+      int name_idx = schema_add_key(&props_schema, prop_name);
+      props_schema.type_bitset[name_idx] = update_type_bitset(props_schema.type_bitset[name_idx], prop_val, opt->parse_opt);
     }
   }
   
+  size_t nprops = (size_t)props_schema.ncols;
+  char **prop_names = props_schema.names;
+  unsigned int *type_bitset = props_schema.type_bitset;
+  
   // for (unsigned int i=0; i<nprops; i++) {
   //   unsigned int sexp_type = get_best_sexp_to_represent_type_bitset(type_bitset[i], opt->parse_opt);
   //   dump_type_bitset(type_bitset[i]);
@@ -1808,7 +1828,7 @@ SEXP parse_geojson_file_(SEXP filename_, SEXP geo_opts_, SEXP parse_opts_) {
   filename = R_ExpandFileName(filename);
   yyjson_read_err err;
   state_t *state = create_state();
-  state->doc = yyjson_read_file((char *)filename, opt.yyjson_read_flag, NULL, &err);
+  state_read_file(state, filename, opt.yyjson_read_flag, &err);
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // If doc is NULL, then an error occurred during parsing.
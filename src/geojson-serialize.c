@@ -13,6 +13,9 @@
 
 #include "yyjson.h"
 #include "R-yyjson-serialize.h"
+#include "utils.h"
+
+#define GEO_SERIALIZE_OPTIONS_TAG "yyjson_geo_serialize_options"
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // GeoJSON Serialize options
@@ -31,6 +34,12 @@ geo_serialize_options create_geo_serialize_options(SEXP to_geo_opts_) {
     .serialize_opt = NULL
   };
   
+  // Options compiled with 'opts_write_geojson(compile = TRUE)'
+  geo_serialize_options *compiled = get_options_handle(to_geo_opts_, GEO_SERIALIZE_OPTIONS_TAG);
+  if (compiled != NULL) {
+    return *compiled;
+  }
+  
   if (Rf_isNull(to_geo_opts_) || Rf_length(to_geo_opts_) == 0) {
     return opt;
   }
@@ -53,6 +62,33 @@ geo_serialize_options create_geo_serialize_options(SEXP to_geo_opts_) {
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Compile an R list of options into a handle to a 'geo_serialize_options'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void compiled_geo_serialize_options_finalizer(SEXP handle_) {
+  free(R_ExternalPtrAddr(handle_));
+  R_ClearExternalPtr(handle_);
+}
+
+SEXP compile_geo_serialize_options_(SEXP to_geo_opts_) {
+  
+  if (get_options_handle(to_geo_opts_, GEO_SERIALIZE_OPTIONS_TAG) != NULL) {
+    return to_geo_opts_;
+  }
+  
+  geo_serialize_options opt = create_geo_serialize_options(to_geo_opts_);
+  
+  geo_serialize_options *compiled = malloc(sizeof(geo_serialize_options));
+  if (compiled == NULL) {
+    Rf_error("compile_geo_serialize_options_(): Memory allocation failed");
+  }
+  *compiled = opt;
+  
+  return make_options_handle(compiled, GEO_SERIALIZE_OPTIONS_TAG, to_geo_opts_,
+                             compiled_geo_serialize_options_finalizer, "opts_write_geojson_compiled");
+}
+
+
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Serialize geometry
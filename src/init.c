@@ -5,6 +5,10 @@
 
 
 SEXP yyjson_version_(void);
+SEXP peak_rss_(void);
+SEXP readahead_stats_(void);
+void ndjson_scan_init(void);
+void lazy_str_init(DllInfo *dll);
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -13,20 +17,40 @@ SEXP yyjson_version_(void);
 extern SEXP parse_from_str_ (SEXP str_     , SEXP parse_opts_);
 extern SEXP parse_from_file_(SEXP filename_, SEXP parse_opts_);
 extern SEXP parse_from_raw_ (SEXP filename_, SEXP parse_opts_);
+extern SEXP parse_from_str_vec_(SEXP str_, SEXP parse_opts_, SEXP simplify_df_, SEXP nthreads_);
+
+extern SEXP json_open_file_  (SEXP filename_, SEXP parse_opts_);
+extern SEXP json_open_str_   (SEXP str_     , SEXP parse_opts_);
+extern SEXP json_doc_get_    (SEXP doc_, SEXP ptrs_, SEXP parse_opts_);
+extern SEXP json_doc_type_   (SEXP doc_, SEXP ptr_);
+extern SEXP json_doc_length_ (SEXP doc_, SEXP ptr_);
+extern SEXP json_doc_keys_   (SEXP doc_, SEXP ptr_);
+
+extern SEXP json_extract_(SEXP x_, SEXP paths_, SEXP is_file_, SEXP parse_opts_);
 
 extern SEXP serialize_to_str_ (SEXP x_,                 SEXP serialize_opts_, SEXP as_raw_);
 extern SEXP serialize_to_file_(SEXP x_, SEXP filename_, SEXP serialize_opts_);
 
+extern SEXP compile_parse_options_    (SEXP parse_opts_);
+extern SEXP compile_serialize_options_(SEXP serialize_opts_);
+
 extern SEXP validate_json_file_(SEXP filename_, SEXP verbose_, SEXP parse_opts_);
 extern SEXP validate_json_str_ (SEXP str_     , SEXP verbose_, SEXP parse_opts_);
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // NDJSON
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-extern SEXP parse_ndjson_file_as_df_  (SEXP filename_, SEXP nread_, SEXP nskip_, SEXP nprobe_, SEXP parse_opts_);
-extern SEXP parse_ndjson_file_as_list_(SEXP filename_, SEXP nread_, SEXP nskip_,               SEXP parse_opts_);
+extern SEXP parse_ndjson_file_as_df_  (SEXP filename_, SEXP nread_, SEXP nskip_, SEXP nprobe_, SEXP nthreads_, SEXP index_file_, SEXP line_numbers_, SEXP parse_opts_);
+extern SEXP parse_ndjson_file_as_list_(SEXP filename_, SEXP nread_, SEXP nskip_,                               SEXP index_file_, SEXP line_numbers_, SEXP parse_opts_);
+
+extern SEXP ndjson_index_(SEXP filename_, SEXP index_file_, SEXP stride_, SEXP rebuild_);
+
+extern SEXP ndjson_reader_open_      (SEXP filename_, SEXP chunk_size_, SEXP nskip_, SEXP nprobe_, SEXP parse_opts_);
+extern SEXP ndjson_reader_next_chunk_(SEXP reader_);
+extern SEXP ndjson_reader_close_     (SEXP reader_);
 
 extern SEXP parse_ndjson_str_as_df_  (SEXP str_, SEXP nread_, SEXP nskip_, SEXP nprobe_, SEXP parse_opts_);
+extern SEXP parse_ndjson_strvec_as_df_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP nprobe_, SEXP parse_opts_);
 extern SEXP parse_ndjson_str_as_list_(SEXP str_, SEXP nread_, SEXP nskip_,               SEXP parse_opts_);
 
 extern SEXP serialize_df_to_ndjson_str_ (SEXP robj_,                 SEXP serialize_opts_, SEXP as_raw_);
@@ -44,10 +68,15 @@ extern SEXP parse_geojson_file_(SEXP filename_, SEXP geo_opts_, SEXP parse_opts_
 extern SEXP serialize_sf_to_str_ (SEXP sf_                , SEXP geo_opts_, SEXP serialize_opts_);
 extern SEXP serialize_sf_to_file_(SEXP sf_, SEXP filename_, SEXP geo_opts_, SEXP serialize_opts_);
 
+extern SEXP compile_geo_parse_options_    (SEXP geo_opts_);
+extern SEXP compile_geo_serialize_options_(SEXP geo_opts_);
+
 
 static const R_CallMethodDef CEntries[] = {
   
   {"yyjson_version_", (DL_FUNC) &yyjson_version_, 0},
+  {"peak_rss_"      , (DL_FUNC) &peak_rss_      , 0},
+  {"readahead_stats_", (DL_FUNC) &readahead_stats_, 0},
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Regular JSON
@@ -58,6 +87,19 @@ static const R_CallMethodDef CEntries[] = {
   {"parse_from_str_"  , (DL_FUNC) &parse_from_str_ , 2},
   {"parse_from_file_" , (DL_FUNC) &parse_from_file_, 2},
   {"parse_from_raw_"  , (DL_FUNC) &parse_from_raw_ , 2},
+  {"parse_from_str_vec_", (DL_FUNC) &parse_from_str_vec_, 4},
+
+  {"json_open_file_" , (DL_FUNC) &json_open_file_ , 2},
+  {"json_open_str_"  , (DL_FUNC) &json_open_str_  , 2},
+  {"json_doc_get_"   , (DL_FUNC) &json_doc_get_   , 3},
+  {"json_doc_type_"  , (DL_FUNC) &json_doc_type_  , 2},
+  {"json_doc_length_", (DL_FUNC) &json_doc_length_, 2},
+  {"json_doc_keys_"  , (DL_FUNC) &json_doc_keys_  , 2},
+
+  {"json_extract_", (DL_FUNC) &json_extract_, 4},
+  
+  {"compile_parse_options_"    , (DL_FUNC) &compile_parse_options_    , 1},
+  {"compile_serialize_options_", (DL_FUNC) &compile_serialize_options_, 1},
   
   {"validate_json_file_", (DL_FUNC) &validate_json_file_, 3},
   {"validate_json_str_" , (DL_FUNC) &validate_json_str_ , 3},
@@ -65,10 +107,17 @@ static const R_CallMethodDef CEntries[] = {
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // NDJSON
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  {"parse_ndjson_file_as_df_"  , (DL_FUNC) &parse_ndjson_file_as_df_  , 5},
-  {"parse_ndjson_file_as_list_", (DL_FUNC) &parse_ndjson_file_as_list_, 4},
+  {"parse_ndjson_file_as_df_"  , (DL_FUNC) &parse_ndjson_file_as_df_  , 8},
+  {"parse_ndjson_file_as_list_", (DL_FUNC) &parse_ndjson_file_as_list_, 6},
+  
+  {"ndjson_index_"            , (DL_FUNC) &ndjson_index_            , 4},
+  
+  {"ndjson_reader_open_"      , (DL_FUNC) &ndjson_reader_open_      , 5},
+  {"ndjson_reader_next_chunk_", (DL_FUNC) &ndjson_reader_next_chunk_, 1},
+  {"ndjson_reader_close_"     , (DL_FUNC) &ndjson_reader_close_     , 1},
   
   {"parse_ndjson_str_as_df_"  , (DL_FUNC) &parse_ndjson_str_as_df_  , 5},
+  {"parse_ndjson_strvec_as_df_", (DL_FUNC) &parse_ndjson_strvec_as_df_, 5},
   {"parse_ndjson_str_as_list_", (DL_FUNC) &parse_ndjson_str_as_list_, 4},
   
   {"serialize_df_to_ndjson_str_" , (DL_FUNC) &serialize_df_to_ndjson_str_ , 3},
@@ -86,6 +135,9 @@ static const R_CallMethodDef CEntries[] = {
   {"serialize_sf_to_str_" , (DL_FUNC) &serialize_sf_to_str_ , 3},
   {"serialize_sf_to_file_", (DL_FUNC) &serialize_sf_to_file_, 4},
   
+  {"compile_geo_parse_options_"    , (DL_FUNC) &compile_geo_parse_options_    , 1},
+  {"compile_geo_serialize_options_", (DL_FUNC) &compile_geo_serialize_options_, 1},
+  
   
   {NULL , NULL, 0}
 };
@@ -100,6 +152,12 @@ void R_init_yyjsonr(DllInfo *info) {
     NULL       // External
   );
   R_useDynamicSymbols(info, FALSE);
+  
+  // Select the fastest newline scanner for this CPU
+  ndjson_scan_init();
+  
+  // ALTREP class for 'lazy_strings = TRUE'
+  lazy_str_init(info);
 }
 
 
@@ -0,0 +1,378 @@
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <stddef.h>
+
+#include "yyjson.h"
+#include "R-yyjson-schema.h"
+#include "R-yyjson-state.h"
+#include "R-yyjson-parse.h"
+#include "R-yyjson-filter.h"
+#include "R-yyjson-row-decoder.h"
+#include "R-yyjson-lazy-str.h"
+#include "ndjson-parse.h"
+#include "file-map.h"
+#include "decompress.h"
+#include "ndjson-reader.h"
+
+#define INIT_DOCS_LENGTH 64
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Chunked NDJSON -> data.frame
+//
+// A reader keeps the input stream (see 'ndjson-reader.c') and the schema
+// (column names + types) open between calls, and each call returns the
+// next 'chunk_size' rows as a data.frame.  Only the docs for a single chunk
+// are held in memory at any time.
+//
+// The schema is found by probing the first 'nprobe' lines.  Columns are
+// never added after this, but a column type may be widened if a later value
+// doesn't fit (e.g. a double in an integer column).  A warning is given
+// when this happens, as earlier chunks will have used the narrower type.
+//
+// The parse options are kept as an R list and converted for each chunk, as
+// 'create_parse_options()' uses memory which only lasts for a single .Call()
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct {
+  int chunk_size;
+  double nlines;      // lines consumed so far (incl. skipped and blank lines)
+  double nprobe_end;  // lines up to this are used to find the schema
+  int nchunks;        // chunks returned so far
+  bool probed;        // has the schema been fixed?
+  bool eof;
+
+  schema_t schema;          // column names + type bitsets seen so far
+  unsigned int *sexp_type;  // column types. Set once the schema is fixed
+} chunk_reader_t;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Finalizer for the external pointer
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void chunk_reader_finalizer(SEXP reader_) {
+  chunk_reader_t *reader = (chunk_reader_t *)R_ExternalPtrAddr(reader_);
+  if (reader == NULL) return;
+
+  schema_free(&reader->schema);
+  free(reader->sexp_type);
+  free(reader);
+  R_ClearExternalPtr(reader_);
+}
+
+
+static chunk_reader_t *chunk_reader_get(SEXP reader_) {
+  if (TYPEOF(reader_) != EXTPTRSXP || R_ExternalPtrAddr(reader_) == NULL) {
+    Rf_error("ndjson_reader has been closed");
+  }
+  return (chunk_reader_t *)R_ExternalPtrAddr(reader_);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Type name for use in messages
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static const char *sexp_type_name(unsigned int sexp_type) {
+  if (sexp_type == INT64SXP) return "integer64";
+  return Rf_type2char((SEXPTYPE)sexp_type);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Accumulate the types of the values in a {}-object for the existing
+// columns only. i.e. the same as 'probe_ndjson_object()' except that no
+// new columns are added
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void widen_ndjson_types(yyjson_val *obj, parse_options *opt, state_t *state) {
+  schema_t *schema = &state->schema;
+  
+  // One pass over the object's keys (rather than a lookup per column)
+  yyjson_obj_iter iter = yyjson_obj_iter_with(obj);
+  yyjson_val *key;
+  while ((key = yyjson_obj_iter_next(&iter))) {
+    int col = schema_find(schema, yyjson_get_str(key), yyjson_get_len(key));
+    if (col >= 0) {
+      yyjson_val *val = yyjson_obj_iter_get_val(key);
+      schema->type_bitset[col] = update_type_bitset(schema->type_bitset[col], val, opt);
+    }
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Fix the columns (those in the state's schema) and their types
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void fix_schema(chunk_reader_t *reader, unsigned int *sexp_type, state_t *state) {
+  int ncols = state->schema.ncols;
+  reader->sexp_type = malloc(((size_t)ncols + 1) * sizeof(unsigned int));
+  if (reader->sexp_type == NULL) {
+    error_and_destroy_state(state, "Failed to allocate column types");
+  }
+  memcpy(reader->sexp_type, sexp_type, (size_t)ncols * sizeof(unsigned int));
+
+  reader->probed = true;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Open an NDJSON file for reading in chunks
+//
+// @param filename_ filename. May be compressed (gzip, zstd, LZ4 or xz)
+// @param chunk_size_ maximum number of rows in each chunk
+// @param nskip_ number of lines to skip at the start of the file
+// @param nprobe_ number of lines used to determine the schema. This is
+//        limited to 'chunk_size' so that the schema is fixed within the
+//        first chunk
+// @param parse_opts_ named list of parse options
+//
+// @return external pointer. The line reader and the parse options are
+//         kept alive in its 'protected' slot
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP ndjson_reader_open_(SEXP filename_, SEXP chunk_size_, SEXP nskip_, SEXP nprobe_, SEXP parse_opts_) {
+
+  int nprotect = 0;
+
+  // Check the options are valid before doing anything else
+  create_parse_options(parse_opts_);
+
+  const char *filename = (const char *)CHAR(STRING_ELT(filename_, 0));
+  filename = R_ExpandFileName(filename);
+
+  if (access(filename, R_OK) != 0) {
+    Rf_error("Cannot read from file '%s'", filename);
+  }
+
+  int chunk_size = Rf_asInteger(chunk_size_);
+  int nskip      = Rf_asInteger(nskip_);
+  int nprobe     = Rf_asInteger(nprobe_);
+
+  if (chunk_size == NA_INTEGER || chunk_size <= 0) {
+    Rf_error("'chunk_size' must be a positive integer");
+  }
+
+  if (nprobe < 0 || nprobe > chunk_size) {
+    nprobe = chunk_size;
+  }
+
+  SEXP line_reader_ = PROTECT(line_reader_open(filename, 1)); nprotect++;
+  if (nskip > 0) {
+    line_reader_skip(line_reader_get(line_reader_), (size_t)nskip);
+  }
+
+  SEXP prot_ = PROTECT(Rf_allocVector(VECSXP, 2)); nprotect++;
+  SET_VECTOR_ELT(prot_, 0, line_reader_);
+  SET_VECTOR_ELT(prot_, 1, parse_opts_);
+
+  chunk_reader_t *reader = calloc(1, sizeof(chunk_reader_t));
+  if (reader == NULL) {
+    Rf_error("ndjson_reader_open_(): Couldn't allocate reader");
+  }
+  reader->chunk_size = chunk_size;
+  reader->nlines     = nskip > 0 ? nskip : 0;
+  reader->nprobe_end = reader->nlines + nprobe;
+
+  SEXP reader_ = PROTECT(R_MakeExternalPtr(reader, R_NilValue, prot_)); nprotect++;
+  R_RegisterCFinalizer(reader_, chunk_reader_finalizer);
+
+  UNPROTECT(nprotect);
+  return reader_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read the next chunk as a data.frame.
+//
+// @return data.frame, or NULL when there are no more rows
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP ndjson_reader_next_chunk_(SEXP reader_) {
+
+  int nprotect = 0;
+  chunk_reader_t *reader = chunk_reader_get(reader_);
+
+  if (reader->eof) {
+    return R_NilValue;
+  }
+
+  SEXP prot_ = R_ExternalPtrProtected(reader_);
+  line_reader_t *input = line_reader_get(VECTOR_ELT(prot_, 0));
+
+  // Lines are parsed directly from the line reader's buffer, which does not
+  // have the padding required for in-situ parsing
+  parse_options opt = create_parse_options(VECTOR_ELT(prot_, 1));
+  opt.yyjson_read_flag &= ~YYJSON_READ_INSITU;
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // The state holds a copy of the column names so that the shared
+  // probe/fill code can be used, and so that everything allocated for
+  // this chunk is freed if there is an error.  The reader itself stays valid.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  state_t *state = create_state();
+  if (!schema_merge(&state->schema, &reader->schema)) {
+    error_and_destroy_state(state, "Failed to allocate 'colname'");
+  }
+  
+  // Widening is only reported for chunks after the one where probing ended
+  bool probed_before = reader->probed;
+  
+  // A user-supplied schema is fixed from the start and never widened
+  if (!reader->probed && opt.ncol_types > 0) {
+    fix_schema(reader, declare_ndjson_columns(&opt, state), state);
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Parse lines until there are 'chunk_size' rows.
+  // Lines within the first 'nprobe' lines may add columns. After that,
+  // values can only widen the types of existing columns.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  int docs_capacity = 0;
+  const char *buf;
+  size_t buf_len;
+
+  while (state->ndocs < reader->chunk_size) {
+    buf = line_reader_next(input, &buf_len);
+    if (buf == NULL) {
+      reader->eof = true;
+      break;
+    }
+    reader->nlines++;
+
+    // ignore lines which are just a "\n".
+    if (buf_len == 0) continue;
+
+    yyjson_read_err err;
+    state->doc = yyjson_read_opts((char *)buf, buf_len, opt.yyjson_read_flag, NULL, &err);
+    if (state->doc == NULL) {
+      output_verbose_error(buf, buf_len, err);
+      error_and_destroy_state(state, "Couldn't parse JSON on line %.0f\n", reader->nlines);
+    }
+
+    yyjson_val *obj = yyjson_doc_get_root(state->doc);
+    if (yyjson_get_type(obj) != YYJSON_TYPE_OBJ) {
+      error_and_destroy_state(state, "parse_ndjson_as_df() only works if all lines represent JSON objects");
+    }
+
+    if (!row_matches_filter(obj, opt.filter)) {
+      yyjson_doc_free(state->doc);
+      state->doc = NULL;
+      continue;
+    }
+
+    if (state->ndocs == docs_capacity) {
+      docs_capacity = docs_capacity == 0 ? INIT_DOCS_LENGTH : 2 * docs_capacity;
+      yyjson_doc **docs = realloc(state->docs, (size_t)docs_capacity * sizeof(yyjson_doc *));
+      if (docs == NULL) {
+        error_and_destroy_state(state, "Failed to allocate chunk docs");
+      }
+      state->docs = docs;
+    }
+    state->docs[state->ndocs++] = state->doc;
+    state->doc = NULL;
+
+    if (opt.ncol_types > 0) {
+      continue;
+    } else if (!reader->probed && reader->nlines <= reader->nprobe_end) {
+      probe_ndjson_object(obj, &opt, state);
+    } else {
+      if (!reader->probed) {
+        fix_schema(reader, get_schema_sexp_types(&state->schema, &opt), state);
+      }
+      widen_ndjson_types(obj, &opt, state);
+    }
+  }
+
+  if (!reader->probed) {
+    fix_schema(reader, get_schema_sexp_types(&state->schema, &opt), state);
+  }
+
+  // Keep the schema (including any widened types) for the next chunk
+  if (!schema_merge(&reader->schema, &state->schema)) {
+    error_and_destroy_state(state, "Failed to allocate 'colname'");
+  }
+
+  if (state->ndocs == 0) {
+    destroy_state(state);
+    return R_NilValue;
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Find any columns which have been widened.  
+  // The warnings are only raised once the chunk's docs have been freed, as
+  // a warning may be turned into an error (i.e. 'options(warn = 2)')
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  reader->nchunks++;
+  int nwidened = 0;
+  int *widened_col = (int *)R_alloc((size_t)state->schema.ncols + 1, sizeof(int));
+  unsigned int *widened_from = (unsigned int *)R_alloc((size_t)state->schema.ncols + 1, sizeof(unsigned int));
+  for (int col = 0; opt.ncol_types == 0 && col < state->schema.ncols; col++) {
+    unsigned int sexp_type = get_best_sexp_to_represent_type_bitset(state->schema.type_bitset[col], &opt);
+    if (sexp_type != reader->sexp_type[col]) {
+      if (probed_before) {
+        widened_col[nwidened]  = col;
+        widened_from[nwidened] = reader->sexp_type[col];
+        nwidened++;
+      }
+      reader->sexp_type[col] = sexp_type;
+    }
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Allocate the columns and fill them from the docs
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  int nrows = (int)state->ndocs;
+  SEXP df_ = PROTECT(Rf_allocVector(VECSXP, state->schema.ncols)); nprotect++;
+
+  for (int col = 0; col < state->schema.ncols; col++) {
+    // INT64SXP is actually contained in a REALSXP
+    unsigned int alloc_type = reader->sexp_type[col] == INT64SXP ? REALSXP : reader->sexp_type[col];
+    SEXP vec_ = PROTECT(alloc_df_column(alloc_type, nrows, &opt));
+    if (reader->sexp_type[col] == INT64SXP) {
+      SEXP att_val_ = PROTECT(Rf_mkString("integer64"));
+      Rf_setAttrib(vec_, R_ClassSymbol, att_val_);
+      UNPROTECT(1);
+    }
+    SET_VECTOR_ELT(df_, col, vec_);
+    UNPROTECT(1);
+  }
+
+  row_decoder_t *dec = row_decoder_create(&state->schema, reader->sexp_type, &opt, state);
+  for (int row = 0; row < nrows; row++) {
+    fill_ndjson_row(df_, row, yyjson_doc_get_root(state->docs[row]), dec);
+    yyjson_doc_free(state->docs[row]);
+    state->docs[row] = NULL;
+  }
+
+  SEXP df_final_ = PROTECT(promote_list_to_data_frame(df_, state->schema.names, state->schema.ncols)); nprotect++;
+
+  destroy_state(state);
+  
+  // The reader's schema has the same columns, and outlives the state
+  for (int i = 0; i < nwidened; i++) {
+    int col = widened_col[i];
+    Rf_warning("ndjson_reader: column '%s' widened from %s to %s in chunk %i",
+               reader->schema.names[col], sexp_type_name(widened_from[i]),
+               sexp_type_name(reader->sexp_type[col]), reader->nchunks);
+  }
+  
+  UNPROTECT(nprotect);
+  return df_final_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Close the reader and release the input stream
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP ndjson_reader_close_(SEXP reader_) {
+  if (TYPEOF(reader_) == EXTPTRSXP && R_ExternalPtrAddr(reader_) != NULL) {
+    line_reader_close(VECTOR_ELT(R_ExternalPtrProtected(reader_), 0));
+    chunk_reader_finalizer(reader_);
+  }
+  return R_NilValue;
+}
@@ -0,0 +1,571 @@
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include "file-map.h"
+#include "decompress.h"
+#include "ndjson-scan.h"
+#include "ndjson-index.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Sidecar row index for NDJSON files
+//
+// Skipping to row N of an NDJSON file normally means finding the first N
+// newlines, and for a compressed file, decompressing everything before it.
+// The index is built with a single pass over the file, and records:
+//
+//   - the offset (in the decompressed data) of every 'stride'-th row.
+//     Reading row N then starts at row 'N - N % stride', so at most
+//     'stride - 1' lines are skipped.
+//   - for gzip: entry points into the compressed stream about every
+//     INDEX_SPAN bytes of decompressed data.  An entry point is a deflate
+//     block boundary, plus the 32kB of data before it (the most a deflate
+//     block can refer back to).  Inflating can start from an entry point,
+//     so at most INDEX_SPAN bytes are decompressed to reach any row.
+//     This is the approach of 'zran.c' in the zlib examples.
+//
+// Other compressed formats only get row offsets.  Reading still has to
+// decompress everything before the row, but skips the line scanning.
+//
+// The index file also records the size and modification time (to the 
+// nanosecond, where the OS has it) of the data file, and is only used if 
+// these still match.
+//
+// File layout (native byte order):
+//   - header (index_header_t)
+//   - 'npoints' windows of DSTREAM_WINDOW_SIZE bytes
+//   - 'nrow_offsets' uint64 row offsets (at 'row_offsets_pos')
+//   - 'npoints' entry points (index_point_t, at 'points_pos')
+//
+// The index file is written under a temporary name, and then renamed, so
+// a reader never sees a partially written index.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define INDEX_MAGIC    "YYNDIDX2"
+#define INDEX_SPAN     (4 << 20)
+#define INDEX_IN_SIZE  (1 << 17)
+#define INDEX_OUT_SIZE (1 << 20)
+
+typedef struct {
+  char     magic[8];
+  uint64_t file_size;
+  int64_t  file_mtime_ns;
+  uint32_t compression;
+  uint32_t stride;
+  uint64_t nrows;
+  uint64_t nrow_offsets;
+  uint64_t row_offsets_pos;
+  uint64_t npoints;
+  uint64_t points_pos;
+} index_header_t;
+
+typedef struct {
+  uint64_t out;
+  uint64_t in;
+  uint64_t bits;
+} index_point_t;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Modification time in nanoseconds.  Whole seconds would miss a file 
+// which is rewritten (at the same size) within a second of indexing.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static int64_t file_mtime_ns(const struct stat *st) {
+#if defined(__APPLE__)
+  return (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  return (int64_t)st->st_mtime * 1000000000;
+#else
+  return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Row offsets found while building the index
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct {
+  uint32_t stride;
+  uint64_t nlines;    // newlines seen so far
+  uint64_t total;     // bytes of data seen so far
+  char last;          // last byte seen
+  uint64_t *offset;
+  size_t noffsets;
+  size_t capacity;
+  index_point_t *point;
+  size_t npoints;
+  size_t point_capacity;
+} index_builder_t;
+
+
+static bool builder_add_offset(index_builder_t *b, uint64_t offset) {
+  if (b->noffsets == b->capacity) {
+    size_t capacity = b->capacity == 0 ? 1024 : 2 * b->capacity;
+    uint64_t *new_offset = realloc(b->offset, capacity * sizeof(uint64_t));
+    if (new_offset == NULL) return false;
+    b->offset   = new_offset;
+    b->capacity = capacity;
+  }
+  b->offset[b->noffsets++] = offset;
+  return true;
+}
+
+
+static bool builder_add_point(index_builder_t *b, index_point_t point) {
+  if (b->npoints == b->point_capacity) {
+    size_t capacity = b->point_capacity == 0 ? 64 : 2 * b->point_capacity;
+    index_point_t *new_point = realloc(b->point, capacity * sizeof(index_point_t));
+    if (new_point == NULL) return false;
+    b->point          = new_point;
+    b->point_capacity = capacity;
+  }
+  b->point[b->npoints++] = point;
+  return true;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Count the rows in the next 'len' bytes of data.
+// Rows are counted the same way as 'line_reader_skip()' i.e. including
+// blank lines, and a final line without a newline.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool builder_scan(index_builder_t *b, const char *data, size_t len) {
+  if (len == 0) return true;
+
+  const char *p   = data;
+  const char *end = data + len;
+  const char *nl;
+  while ((nl = scan_newline(p, end)) != NULL) {
+    b->nlines++;
+    if (b->nlines % b->stride == 0) {
+      if (!builder_add_offset(b, b->total + (uint64_t)(nl - data) + 1)) return false;
+    }
+    p = nl + 1;
+  }
+
+  b->total += len;
+  b->last   = data[len - 1];
+  return true;
+}
+
+
+static void builder_free(index_builder_t *b) {
+  free(b->offset);
+  free(b->point);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Index a gzip file.
+//
+// The data is inflated with Z_BLOCK, so that inflate() returns at each
+// deflate block boundary, where an entry point can be recorded.
+// The output goes into a circular 32kB window, which always holds the
+// data before the current position.
+//
+// @return NULL on success, otherwise an error message
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static const char *index_gzip(const char *filename, index_builder_t *b, FILE *out) {
+
+  FILE *fp = fopen(filename, "rb");
+  if (fp == NULL) return "couldn't open file";
+
+  unsigned char *in     = malloc(INDEX_IN_SIZE);
+  unsigned char *window = malloc(DSTREAM_WINDOW_SIZE);
+  z_stream zs;
+  memset(&zs, 0, sizeof(z_stream));
+  if (in == NULL || window == NULL || inflateInit2(&zs, 15 + 16) != Z_OK) {
+    free(in);
+    free(window);
+    fclose(fp);
+    return "memory allocation failed";
+  }
+
+  const char *errmsg = NULL;
+  uint64_t totin  = 0;
+  uint64_t totout = 0;
+  uint64_t last   = 0;
+  bool eof        = false;
+  bool member_end = false;
+  zs.next_in = in;
+
+  for (;;) {
+    // Top up the input.  A 2 byte minimum to check for another gzip member
+    if (zs.avail_in < 2 && !eof) {
+      memmove(in, zs.next_in, zs.avail_in);
+      size_t want = INDEX_IN_SIZE - zs.avail_in;
+      size_t n    = fread(in + zs.avail_in, 1, want, fp);
+      if (n < want) {
+        if (ferror(fp)) {
+          errmsg = "error reading file";
+          break;
+        }
+        eof = true;
+      }
+      zs.next_in   = in;
+      zs.avail_in += (uInt)n;
+    }
+
+    if (member_end) {
+      // Like 'gzread()', ignore anything after the last member
+      if (zs.avail_in < 2 || zs.next_in[0] != 0x1f || zs.next_in[1] != 0x8b) break;
+      inflateReset(&zs);
+      member_end = false;
+    }
+
+    if (zs.avail_in == 0) {
+      errmsg = "truncated gzip data";
+      break;
+    }
+
+    if (zs.avail_out == 0) {
+      zs.next_out  = window;
+      zs.avail_out = DSTREAM_WINDOW_SIZE;
+    }
+
+    unsigned char *out_start = zs.next_out;
+    uInt avail_in  = zs.avail_in;
+    uInt avail_out = zs.avail_out;
+    int ret = inflate(&zs, Z_BLOCK);
+    totin  += avail_in  - zs.avail_in;
+    totout += avail_out - zs.avail_out;
+
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+      errmsg = zs.msg != NULL ? zs.msg : "corrupt gzip data";
+      break;
+    }
+    if (!builder_scan(b, (const char *)out_start, avail_out - zs.avail_out)) {
+      errmsg = "memory allocation failed";
+      break;
+    }
+
+    if (ret == Z_STREAM_END) {
+      member_end = true;
+      continue;
+    }
+
+    // At a block boundary (other than after the last block)?
+    if ((zs.data_type & 128) && !(zs.data_type & 64) && totout - last > INDEX_SPAN) {
+      index_point_t point = { totout, totin, (uint64_t)(zs.data_type & 7) };
+      size_t left = zs.avail_out;  // oldest data is at the end of the window
+      if (!builder_add_point(b, point) ||
+          fwrite(window + DSTREAM_WINDOW_SIZE - left, 1, left, out) != left ||
+          fwrite(window, 1, DSTREAM_WINDOW_SIZE - left, out) != DSTREAM_WINDOW_SIZE - left) {
+        errmsg = "couldn't write index";
+        break;
+      }
+      last = totout;
+    }
+  }
+
+  inflateEnd(&zs);
+  free(in);
+  free(window);
+  fclose(fp);
+  return errmsg;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Index any other file.  Rows only.
+//
+// @return NULL on success, otherwise an error message
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static const char *index_rows(const char *filename, compression_t compression, index_builder_t *b) {
+
+  if (compression == COMPRESSION_NONE) {
+    file_map_t map;
+    if (!file_map_open(filename, &map)) return "couldn't read file";
+    bool ok = builder_scan(b, map.data, map.len);
+    file_map_close(&map);
+    return ok ? NULL : "memory allocation failed";
+  }
+
+  const char *errmsg;
+  dstream_t *ds = dstream_open(filename, 1, &errmsg);
+  if (ds == NULL) return errmsg;
+
+  char *buf = malloc(INDEX_OUT_SIZE);
+  if (buf == NULL) {
+    dstream_close(ds);
+    return "memory allocation failed";
+  }
+  dstream_start_readahead(ds);
+
+  errmsg = NULL;
+  ptrdiff_t n;
+  while ((n = dstream_read(ds, buf, INDEX_OUT_SIZE)) > 0) {
+    if (!builder_scan(b, buf, (size_t)n)) {
+      errmsg = "memory allocation failed";
+      break;
+    }
+  }
+  if (n < 0) {
+    // Copy as the message may not outlive the stream
+    static char read_errmsg[256];
+    snprintf(read_errmsg, sizeof(read_errmsg), "%s", dstream_error(ds));
+    errmsg = read_errmsg;
+  }
+
+  free(buf);
+  dstream_close(ds);
+  return errmsg;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Build an index and write it to 'index_file'
+//
+// @return NULL on success, otherwise an error message
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static const char *index_build(const char *filename, const char *index_file,
+                               uint32_t stride, index_header_t *hdr) {
+
+  struct stat st;
+  if (stat(filename, &st) != 0) return "couldn't read file";
+
+  memset(hdr, 0, sizeof(index_header_t));
+  memcpy(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic));
+  hdr->file_size     = (uint64_t)st.st_size;
+  hdr->file_mtime_ns = file_mtime_ns(&st);
+  hdr->compression   = (uint32_t)detect_compression(filename);
+  hdr->stride        = stride;
+
+  size_t len = strlen(index_file);
+  char *tmp_file = malloc(len + 5);
+  if (tmp_file == NULL) return "memory allocation failed";
+  memcpy(tmp_file, index_file, len);
+  memcpy(tmp_file + len, ".tmp", 5);
+
+  FILE *out = fopen(tmp_file, "wb");
+  if (out == NULL) {
+    free(tmp_file);
+    return "couldn't create index file";
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // The header is written again at the end, once the counts are known.
+  // Windows are written as they are found.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  index_builder_t b;
+  memset(&b, 0, sizeof(index_builder_t));
+  b.stride = stride;
+
+  const char *errmsg = NULL;
+  if (fwrite(hdr, sizeof(index_header_t), 1, out) != 1 || !builder_add_offset(&b, 0)) {
+    errmsg = "couldn't write index";
+  } else if (hdr->compression == COMPRESSION_GZIP) {
+    errmsg = index_gzip(filename, &b, out);
+  } else {
+    errmsg = index_rows(filename, (compression_t)hdr->compression, &b);
+  }
+
+  if (errmsg == NULL) {
+    // A newline at the very end doesn't start another row
+    hdr->nrows = b.nlines + (b.total > 0 && b.last != '\n');
+    while (b.noffsets > 0 && b.offset[b.noffsets - 1] >= b.total) {
+      b.noffsets--;
+    }
+    hdr->nrow_offsets    = b.noffsets;
+    hdr->row_offsets_pos = sizeof(index_header_t) + b.npoints * DSTREAM_WINDOW_SIZE;
+    hdr->npoints         = b.npoints;
+    hdr->points_pos      = hdr->row_offsets_pos + b.noffsets * sizeof(uint64_t);
+
+    if (fwrite(b.offset, sizeof(uint64_t), b.noffsets, out) != b.noffsets ||
+        (b.npoints > 0 && fwrite(b.point, sizeof(index_point_t), b.npoints, out) != b.npoints) ||
+        !file_seek(out, 0) ||
+        fwrite(hdr, sizeof(index_header_t), 1, out) != 1) {
+      errmsg = "couldn't write index";
+    }
+  }
+  builder_free(&b);
+
+  if (fclose(out) != 0 && errmsg == NULL) {
+    errmsg = "couldn't write index";
+  }
+  if (errmsg == NULL && rename(tmp_file, index_file) != 0) {
+    // Windows can't rename over an existing file
+    remove(index_file);
+    if (rename(tmp_file, index_file) != 0) {
+      errmsg = "couldn't create index file";
+    }
+  }
+  if (errmsg != NULL) {
+    remove(tmp_file);
+  }
+  free(tmp_file);
+
+  return errmsg;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Open an index, and check that it is for the current version of the file
+//
+// @return NULL if there is no index, or it is out of date
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static FILE *index_open(const char *index_file, const char *filename, index_header_t *hdr) {
+  struct stat st;
+  if (stat(filename, &st) != 0) return NULL;
+
+  FILE *fp = fopen(index_file, "rb");
+  if (fp == NULL) return NULL;
+
+  if (fread(hdr, sizeof(index_header_t), 1, fp) != 1 ||
+      memcmp(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->file_size     != (uint64_t)st.st_size ||
+      hdr->file_mtime_ns != file_mtime_ns(&st) ||
+      hdr->compression   != (uint32_t)detect_compression(filename) ||
+      hdr->stride == 0) {
+    fclose(fp);
+    return NULL;
+  }
+
+  return fp;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Find where to start reading for rows 'row_lo' up to 'row_hi' (0-based,
+// exclusive).  Only the parts of the index which are needed are read.
+//
+// 'seek->point' (if set) points into 'seek', so 'seek' must not be copied.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void ndjson_index_seek(const char *index_file, const char *filename,
+                       uint64_t row_lo, uint64_t row_hi, ndjson_seek_t *seek) {
+
+  seek->row       = 0;
+  seek->offset    = 0;
+  seek->end       = UINT64_MAX;
+  seek->has_point = false;
+
+  index_header_t hdr;
+  FILE *fp = index_open(index_file, filename, &hdr);
+  if (fp == NULL) {
+    Rf_error("NDJSON index '%s' is missing or out of date. Recreate it with 'ndjson_index()'", index_file);
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Row offsets
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  bool ok = true;
+  if (hdr.nrow_offsets > 0) {
+    uint64_t k = row_lo / hdr.stride;
+    if (k >= hdr.nrow_offsets) k = hdr.nrow_offsets - 1;
+    ok = file_seek(fp, hdr.row_offsets_pos + k * sizeof(uint64_t)) &&
+      fread(&seek->offset, sizeof(uint64_t), 1, fp) == 1;
+    seek->row = k * hdr.stride;
+
+    uint64_t k_end = row_hi / hdr.stride + (row_hi % hdr.stride != 0);
+    if (ok && k_end < hdr.nrow_offsets) {
+      ok = file_seek(fp, hdr.row_offsets_pos + k_end * sizeof(uint64_t)) &&
+        fread(&seek->end, sizeof(uint64_t), 1, fp) == 1;
+    }
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Latest gzip entry point at or before the row
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  if (ok && hdr.npoints > 0 && seek->offset > 0) {
+    index_point_t *point = malloc(hdr.npoints * sizeof(index_point_t));
+    ok = point != NULL && file_seek(fp, hdr.points_pos) &&
+      fread(point, sizeof(index_point_t), hdr.npoints, fp) == hdr.npoints;
+
+    if (ok) {
+      // Binary search for the last point with 'out <= offset'
+      size_t lo = 0, hi = hdr.npoints;
+      while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (point[mid].out <= seek->offset) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+      if (lo > 0) {
+        index_point_t p = point[lo - 1];
+        ok = file_seek(fp, sizeof(index_header_t) + (lo - 1) * (uint64_t)DSTREAM_WINDOW_SIZE) &&
+          fread(seek->window, 1, DSTREAM_WINDOW_SIZE, fp) == DSTREAM_WINDOW_SIZE;
+        seek->point.out    = p.out;
+        seek->point.in     = p.in;
+        seek->point.bits   = (int)p.bits;
+        seek->point.window = seek->window;
+        seek->has_point    = ok;
+      }
+    }
+    free(point);
+  }
+
+  fclose(fp);
+  if (!ok) {
+    Rf_error("Couldn't read NDJSON index '%s'", index_file);
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create an index for an NDJSON file, unless there's already an up to date
+// one with the same 'stride'
+//
+// @param filename NDJSON file.  Must be a regular file
+// @param index_file where to save the index
+// @param stride_ record the offset of every 'stride'-th row
+// @param rebuild_ always build a new index
+// @return list with 'nrows', 'stride' and 'compression'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP ndjson_index_(SEXP filename_, SEXP index_file_, SEXP stride_, SEXP rebuild_) {
+
+  // Both paths are normalized in R
+  const char *filename   = CHAR(STRING_ELT(filename_, 0));
+  const char *index_file = CHAR(STRING_ELT(index_file_, 0));
+  int stride = Rf_asInteger(stride_);
+
+  if (stride == NA_INTEGER || stride < 1) {
+    Rf_error("ndjson_index(): 'stride' must be a positive integer");
+  }
+  if (!is_regular_file(filename)) {
+    Rf_error("ndjson_index(): Cannot index '%s'. Must be a regular file", filename);
+  }
+  compression_t compression = detect_compression(filename);
+  if (!compression_supported(compression)) {
+    Rf_error("ndjson_index(): '%s' is %s compressed, but yyjsonr was installed without support for it",
+             filename, compression_name(compression));
+  }
+
+  index_header_t hdr;
+  FILE *fp = Rf_asLogical(rebuild_) == TRUE ? NULL : index_open(index_file, filename, &hdr);
+  if (fp != NULL) {
+    fclose(fp);
+  }
+  if (fp == NULL || hdr.stride != (uint32_t)stride) {
+    const char *errmsg = index_build(filename, index_file, (uint32_t)stride, &hdr);
+    if (errmsg != NULL) {
+      Rf_error("ndjson_index(): Couldn't index '%s': %s", filename, errmsg);
+    }
+  }
+
+  SEXP res_ = PROTECT(Rf_allocVector(VECSXP, 3));
+  SEXP nms_ = PROTECT(Rf_allocVector(STRSXP, 3));
+  SET_VECTOR_ELT(res_, 0, Rf_ScalarReal((double)hdr.nrows));
+  SET_VECTOR_ELT(res_, 1, Rf_ScalarInteger((int)hdr.stride));
+  SET_VECTOR_ELT(res_, 2, Rf_mkString(compression_name((compression_t)hdr.compression)));
+  SET_STRING_ELT(nms_, 0, Rf_mkChar("nrows"));
+  SET_STRING_ELT(nms_, 1, Rf_mkChar("stride"));
+  SET_STRING_ELT(nms_, 2, Rf_mkChar("compression"));
+  Rf_setAttrib(res_, R_NamesSymbol, nms_);
+
+  UNPROTECT(2);
+  return res_;
+}
@@ -0,0 +1,18 @@
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Sidecar row index for NDJSON files.  See 'ndjson-index.c'
+//
+// 'ndjson_index_seek()' finds where to start reading to get to a row,
+// without reading any of the file before it.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct {
+  uint64_t row;        // first row at 'offset'.  At or before the requested row
+  uint64_t offset;     // offset of 'row' in the decompressed data
+  uint64_t end;        // offset at or after the end of the requested rows
+  bool has_point;      // is 'point' set?
+  dstream_point_t point;
+  unsigned char window[DSTREAM_WINDOW_SIZE];
+} ndjson_seek_t;
+
+void ndjson_index_seek(const char *index_file, const char *filename,
+                       uint64_t row_lo, uint64_t row_hi, ndjson_seek_t *seek);
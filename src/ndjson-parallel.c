@@ -0,0 +1,1026 @@
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <stddef.h>
+
+#include "yyjson.h"
+#include "R-yyjson-schema.h"
+#include "R-yyjson-state.h"
+#include "R-yyjson-parse.h"
+#include "R-yyjson-filter.h"
+#include "R-yyjson-row-decoder.h"
+#include "R-yyjson-lazy-str.h"
+#include "ndjson-parse.h"
+#include "file-map.h"
+#include "decompress.h"
+#include "ndjson-reader.h"
+#include "ndjson-scan.h"
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Multi-threaded NDJSON -> data.frame
+//
+// The input is split into one byte-range per thread.  Each range is
+// aligned so that it starts just after a '\n' i.e. each thread only ever
+// sees complete lines.
+//
+// Parsing happens in phases.  Each phase runs on all threads and the main
+// thread waits for all workers to finish before starting the next phase.
+//
+//   (1) LINES: count the lines in each range so that each thread knows the
+//       global line number of its first line. This is needed so that
+//       'nskip', 'nread' and 'nprobe' mean exactly the same as in the
+//       single-threaded parser.
+//   (2) PROBE: each thread accumulates the column names (in first-seen order)
+//       and the 'type_bitset' for each column over the probe lines in its range.
+//       On the main thread, these per-range results are merged in range order,
+//       so column order and column types are identical to a serial probe.
+//   (3) FILL: each thread decodes the values for every column into plain
+//       C buffers (one per column). No R API calls are made in worker threads.
+//       Rows which don't match the 'filter' option are skipped in both the
+//       PROBE and FILL phases.
+//   (4) On the main thread, the R vectors are allocated and the per-thread
+//       buffers are copied in (in range order, so row order is preserved).
+//       This is also where CHARSXPs are created and where nested values are
+//       converted with 'json_as_robj()'
+//
+// Values which do not match the type of their column (i.e. a type mismatch
+// beyond the 'nprobe' lines) are set to NA and counted, and a single
+// warning is issued at the end (rather than one warning per value)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Don't bother splitting small inputs across lots of threads
+#define MIN_BYTES_PER_THREAD 65536
+
+#define PHASE_LINES 0
+#define PHASE_PROBE 1
+#define PHASE_FILL  2
+
+#define WORKER_OK          0
+#define WORKER_PARSE_ERROR 1
+#define WORKER_NOT_OBJECT  2
+#define WORKER_ALLOC_ERROR 3
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// A reference to a string value held in a worker's string arena.
+// len < 0 indicates NA
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct {
+  size_t offset;
+  int len;
+} str_ref_t;
+
+
+struct par_ctx;
+struct worker;
+
+// Decode a single value into row 'row' of a column buffer.
+// 'val' is NULL if the key is missing
+typedef void (*par_writer_t)(void *coldata, size_t row, yyjson_val *val, struct worker *w);
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Per-thread state
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct worker {
+  struct par_ctx *ctx;
+
+  // Complete lines in the range [start, end)
+  const char *start;
+  const char *end;
+
+  // PHASE_LINES
+  size_t nlines;
+  size_t first_line;   // global line number of the first line in this range
+
+  // PHASE_PROBE
+  schema_t schema;     // columns discovered in this range
+  unsigned int type_status;
+
+  // PHASE_FILL
+  size_t nrows;        // actual rows decoded (blank lines are skipped)
+  void **coldata;      // one buffer per column
+  char *arena;         // storage for string values
+  size_t arena_len;
+  size_t arena_capacity;
+  yyjson_doc **docs;   // docs kept alive for list-columns
+  size_t ndocs;
+  size_t nconvert_fail;
+  int *key_col;        // predicted column for each key position
+  size_t nkey_col;
+  size_t *last_row;    // last row written for each column
+
+  // First error encountered
+  int err;
+  size_t err_line;
+  yyjson_read_err read_err;
+} worker_t;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Shared state
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct par_ctx {
+  file_map_t map;      // file contents
+
+  parse_options *opt;
+  int phase;
+
+  int nworkers;
+  worker_t *workers;
+
+  // line windows: [lo, hi)
+  size_t probe_lo;
+  size_t probe_hi;
+  size_t row_lo;
+  size_t row_hi;
+
+  // merged schema. This is the schema in the 'state'
+  int ncols;
+  schema_t *schema;
+  unsigned int *sexp_type;
+  par_writer_t *writer;  // writer for each column
+  bool keep_docs;
+  int extra_col; // Column for the undeclared keys. -1 if there is none
+} par_ctx_t;
+
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Free everything in the context.
+// This is called from the finalizer of the external pointer which owns
+// the context, so memory is recovered even if an R error occurs
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void free_worker_fill(par_ctx_t *ctx, worker_t *w) {
+  if (w->coldata != NULL) {
+    for (int col = 0; col < ctx->ncols; col++) {
+      free(w->coldata[col]);
+    }
+    free(w->coldata);
+    w->coldata = NULL;
+  }
+  free(w->arena);
+  w->arena = NULL;
+  free(w->key_col);
+  w->key_col = NULL;
+  free(w->last_row);
+  w->last_row = NULL;
+  if (w->docs != NULL) {
+    for (size_t i = 0; i < w->ndocs; i++) {
+      yyjson_doc_free(w->docs[i]);
+    }
+    free(w->docs);
+    w->docs = NULL;
+  }
+}
+
+static void destroy_par_ctx(par_ctx_t *ctx) {
+  if (ctx == NULL) return;
+
+  if (ctx->workers != NULL) {
+    for (int i = 0; i < ctx->nworkers; i++) {
+      worker_t *w = &ctx->workers[i];
+      schema_free(&w->schema);
+      free_worker_fill(ctx, w);
+    }
+    free(ctx->workers);
+  }
+
+  free(ctx->sexp_type);
+  free(ctx->writer);
+  file_map_close(&ctx->map);
+  free(ctx);
+}
+
+static void par_ctx_finalizer(SEXP ctx_) {
+  par_ctx_t *ctx = (par_ctx_t *)R_ExternalPtrAddr(ctx_);
+  destroy_par_ctx(ctx);
+  R_ClearExternalPtr(ctx_);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Record an error in a worker. Only the first error is kept
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void worker_error(worker_t *w, int err, size_t line) {
+  if (w->err == WORKER_OK) {
+    w->err = err;
+    w->err_line = line;
+  }
+}
+
+
+//===========================================================================
+// Thread-safe value decoders.
+//
+// These mirror 'json_val_to_logical()' etc in 'R-yyjson-parse.c', but
+// instead of calling Rf_warning() they count the failures.
+//===========================================================================
+static int32_t par_val_to_logical(yyjson_val *val, worker_t *w) {
+  if (val == NULL) return NA_LOGICAL;
+  switch (yyjson_get_type(val)) {
+  case YYJSON_TYPE_BOOL:
+    return yyjson_get_bool(val);
+  case YYJSON_TYPE_NULL:
+    return NA_LOGICAL;
+  case YYJSON_TYPE_STR:
+    if (yyjson_equals_str(val, "NA")) return NA_LOGICAL;
+    break;
+  default:
+    break;
+  }
+  w->nconvert_fail++;
+  return NA_LOGICAL;
+}
+
+static int32_t par_val_to_integer(yyjson_val *val, worker_t *w) {
+  if (val == NULL) return NA_INTEGER;
+  switch (yyjson_get_type(val)) {
+  case YYJSON_TYPE_NUM:
+    switch (yyjson_get_subtype(val)) {
+    case YYJSON_SUBTYPE_UINT:
+      return (int32_t)yyjson_get_uint(val);
+    case YYJSON_SUBTYPE_SINT:
+      return (int32_t)yyjson_get_sint(val);
+    default:
+      break;
+    }
+    break;
+  case YYJSON_TYPE_NULL:
+    return NA_INTEGER;
+  case YYJSON_TYPE_STR:
+    if (yyjson_equals_str(val, "NA")) return NA_INTEGER;
+    break;
+  default:
+    break;
+  }
+  w->nconvert_fail++;
+  return NA_INTEGER;
+}
+
+static double par_val_to_double(yyjson_val *val, worker_t *w) {
+  if (val == NULL) return NA_REAL;
+  switch (yyjson_get_type(val)) {
+  case YYJSON_TYPE_NUM:
+    switch (yyjson_get_subtype(val)) {
+    case YYJSON_SUBTYPE_UINT:
+      return (double)yyjson_get_uint(val);
+    case YYJSON_SUBTYPE_SINT:
+      return (double)yyjson_get_sint(val);
+    case YYJSON_SUBTYPE_REAL:
+      return yyjson_get_real(val);
+    default:
+      break;
+    }
+    break;
+  case YYJSON_TYPE_STR:
+    if (yyjson_equals_str(val, "-Inf")) {
+      return -INFINITY;
+    } else if (yyjson_equals_str(val, "Inf")) {
+      return INFINITY;
+    } else if (yyjson_equals_str(val, "NaN")) {
+      return R_NaN;
+    }
+    return NA_REAL;
+  case YYJSON_TYPE_NULL:
+    return NA_REAL;
+  default:
+    break;
+  }
+  w->nconvert_fail++;
+  return NA_REAL;
+}
+
+static int64_t par_val_to_integer64(yyjson_val *val, worker_t *w) {
+  if (val == NULL) return INT64_MIN;
+  switch (yyjson_get_type(val)) {
+  case YYJSON_TYPE_NUM:
+    switch (yyjson_get_subtype(val)) {
+    case YYJSON_SUBTYPE_UINT:
+      return (int64_t)yyjson_get_uint(val);
+    case YYJSON_SUBTYPE_SINT:
+      return yyjson_get_sint(val);
+    default:
+      break;
+    }
+    break;
+  case YYJSON_TYPE_STR:
+    if (yyjson_equals_str(val, "NA")) return INT64_MIN;
+    break;
+  case YYJSON_TYPE_NULL:
+    return INT64_MIN;
+  default:
+    break;
+  }
+  w->nconvert_fail++;
+  return INT64_MIN; // Equivalent to NA in integer64
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Append bytes to the worker's string arena
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static str_ref_t arena_append(worker_t *w, const char *str, size_t len) {
+  str_ref_t ref = { .offset = 0, .len = -1 };
+
+  if (w->arena_len + len > w->arena_capacity) {
+    size_t new_capacity = w->arena_capacity == 0 ? 65536 : 2 * w->arena_capacity;
+    while (w->arena_len + len > new_capacity) {
+      new_capacity *= 2;
+    }
+    char *new_arena = realloc(w->arena, new_capacity);
+    if (new_arena == NULL) {
+      worker_error(w, WORKER_ALLOC_ERROR, 0);
+      return ref;
+    }
+    w->arena = new_arena;
+    w->arena_capacity = new_capacity;
+  }
+
+  memcpy(w->arena + w->arena_len, str, len);
+  ref.offset = w->arena_len;
+  ref.len    = (int)len;
+  w->arena_len += len;
+  return ref;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Thread-safe version of 'json_val_to_charsxp()'.  The string is stored in
+// the worker's arena, and the CHARSXP is created later on the main thread.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static str_ref_t par_val_to_str(yyjson_val *val, worker_t *w) {
+  str_ref_t na = { .offset = 0, .len = -1 };
+  parse_options *opt = w->ctx->opt;
+  char buf[128] = "";
+
+  if (val == NULL) return na;
+
+  switch (yyjson_get_type(val)) {
+  case YYJSON_TYPE_NULL:
+    return na;
+  case YYJSON_TYPE_BOOL:
+    return yyjson_get_bool(val) ? arena_append(w, "TRUE", 4) : arena_append(w, "FALSE", 5);
+  case YYJSON_TYPE_NUM:
+    switch(yyjson_get_subtype(val)) {
+    case YYJSON_SUBTYPE_UINT:
+      snprintf(buf, 128, "%llu", (unsigned long long)yyjson_get_uint(val));
+      break;
+    case YYJSON_SUBTYPE_SINT:
+      snprintf(buf, 128, "%lld", (long long)yyjson_get_sint(val));
+      break;
+    case YYJSON_SUBTYPE_REAL:
+      snprintf(buf, 128, "%.*f", opt->digits_promote, yyjson_get_real(val));
+      break;
+    default:
+      w->nconvert_fail++;
+      return na;
+    }
+    return arena_append(w, buf, strlen(buf));
+  case YYJSON_TYPE_STR:
+    if (opt->str_specials == STR_SPECIALS_AS_SPECIAL && yyjson_equals_str(val, "NA")) {
+      return na;
+    }
+    // Note: use strlen() to match 'Rf_mkChar()' in the serial parser
+    return arena_append(w, yyjson_get_str(val), strlen(yyjson_get_str(val)));
+  case YYJSON_TYPE_RAW:
+    return arena_append(w, yyjson_get_raw(val), strlen(yyjson_get_raw(val)));
+  default:
+    break;
+  }
+
+  w->nconvert_fail++;
+  return na;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parse a single line.  Record an error if parsing fails
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static yyjson_doc *worker_parse_line(worker_t *w, const char *line, size_t len, size_t line_num) {
+  yyjson_read_err err;
+  yyjson_doc *doc = yyjson_read_opts((char *)line, len, w->ctx->opt->yyjson_read_flag, NULL, &err);
+  if (doc == NULL) {
+    worker_error(w, WORKER_PARSE_ERROR, line_num);
+    w->read_err = err;
+  }
+  return doc;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// PHASE_LINES: Count lines in this range
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void worker_count_lines(worker_t *w) {
+  size_t nlines = count_newlines(w->start, w->end);
+
+  // final line without a trailing newline
+  if (w->end > w->start && w->end[-1] != '\n') {
+    nlines++;
+  }
+
+  w->nlines = nlines;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// PHASE_PROBE: accumulate names and type_bitsets for the probe lines
+// which fall in this range
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void worker_probe(worker_t *w) {
+  par_ctx_t *ctx = w->ctx;
+  const char *p = w->start;
+  size_t line_num = w->first_line;
+
+  while (p < w->end && line_num < ctx->probe_hi) {
+    const char *nl = scan_newline(p, w->end);
+    const char *eol = nl == NULL ? w->end : nl;
+    size_t len = (size_t)(eol - p);
+
+    if (line_num >= ctx->probe_lo && len > 0) {
+      yyjson_doc *doc = worker_parse_line(w, p, len, line_num);
+      if (doc == NULL) return;
+
+      yyjson_val *obj = yyjson_doc_get_root(doc);
+      yyjson_val *key;
+      yyjson_obj_iter obj_iter = yyjson_obj_iter_with(obj); // MUST be an object
+
+      // Only probe the rows which will be kept
+      bool keep = row_matches_filter(obj, ctx->opt->filter);
+
+      while (keep && (key = yyjson_obj_iter_next(&obj_iter))) {
+        if (!is_selected_column(key, ctx->opt)) continue;
+        yyjson_val *val = yyjson_obj_iter_get_val(key);
+
+        int name_idx = schema_add_key(&w->schema, key);
+        if (name_idx < 0) {
+          worker_error(w, WORKER_ALLOC_ERROR, line_num);
+          yyjson_doc_free(doc);
+          return;
+        }
+
+        w->schema.type_bitset[name_idx] = update_type_bitset_core(
+          w->schema.type_bitset[name_idx], val, ctx->opt, &w->type_status
+        );
+      }
+
+      yyjson_doc_free(doc);
+    }
+
+    line_num++;
+    p = eol + 1;
+  }
+}
+
+
+//===========================================================================
+// Column writers.
+// One of these is chosen for each column before PHASE_FILL, so the column
+// type is not re-checked for every value.
+//===========================================================================
+static void par_write_logical(void *coldata, size_t row, yyjson_val *val, worker_t *w) {
+  ((int32_t *)coldata)[row] = par_val_to_logical(val, w);
+}
+
+static void par_write_integer(void *coldata, size_t row, yyjson_val *val, worker_t *w) {
+  ((int32_t *)coldata)[row] = par_val_to_integer(val, w);
+}
+
+static void par_write_integer64(void *coldata, size_t row, yyjson_val *val, worker_t *w) {
+  ((int64_t *)coldata)[row] = par_val_to_integer64(val, w);
+}
+
+static void par_write_double(void *coldata, size_t row, yyjson_val *val, worker_t *w) {
+  ((double *)coldata)[row] = par_val_to_double(val, w);
+}
+
+static void par_write_str(void *coldata, size_t row, yyjson_val *val, worker_t *w) {
+  ((str_ref_t *)coldata)[row] = par_val_to_str(val, w);
+}
+
+// List column. Keep a reference to the value (and keep its doc alive)
+// so it can be converted to an R object on the main thread
+static void par_write_val(void *coldata, size_t row, yyjson_val *val, worker_t *w) {
+  ((yyjson_val **)coldata)[row] = val;
+}
+
+static par_writer_t par_writer_for_type(unsigned int sexp_type) {
+  switch(sexp_type) {
+  case LGLSXP:   return par_write_logical;
+  case INTSXP:   return par_write_integer;
+  case INT64SXP: return par_write_integer64;
+  case REALSXP:  return par_write_double;
+  case STRSXP:   return par_write_str;
+  default:       return par_write_val;
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decode the values of a {}-object into the given row.
+//
+// The keys are walked once, in order, with the column for each key 
+// predicted from the key order of the previous object (see 
+// 'schema_predict_col()').  This is the same as 'row_decoder_fill()' 
+// but without calling the R API.
+//
+// @return false if memory allocation failed
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool worker_fill_row(worker_t *w, size_t row, yyjson_val *obj) {
+  par_ctx_t *ctx = w->ctx;
+
+  size_t nkeys = yyjson_obj_size(obj);
+  if (nkeys > w->nkey_col) {
+    size_t nkey_col = 2 * nkeys;
+    int *key_col = realloc(w->key_col, nkey_col * sizeof(int));
+    if (key_col == NULL) return false;
+    for (size_t i = w->nkey_col; i < nkey_col; i++) {
+      key_col[i] = -1;
+    }
+    w->key_col  = key_col;
+    w->nkey_col = nkey_col;
+  }
+
+  yyjson_val *key;
+  yyjson_obj_iter iter = yyjson_obj_iter_with(obj);
+
+  for (size_t i = 0; (key = yyjson_obj_iter_next(&iter)); i++) {
+    int col = schema_predict_col(ctx->schema, w->key_col, i, key);
+    if (col < 0 || col == ctx->extra_col || w->last_row[col] == row) continue;
+
+    w->last_row[col] = row;
+    ctx->writer[col](w->coldata[col], row, yyjson_obj_iter_get_val(key), w);
+  }
+
+  for (int col = 0; col < ctx->ncols; col++) {
+    if (w->last_row[col] == row) continue;
+    w->last_row[col] = row;
+
+    if (col == ctx->extra_col) {
+      // The undeclared keys are gathered from the whole object on the
+      // main thread
+      ((yyjson_val **)w->coldata[col])[row] = obj;
+    } else {
+      ctx->writer[col](w->coldata[col], row, NULL, w);
+    }
+  }
+
+  return true;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// PHASE_FILL: decode each line into per-column C buffers
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void worker_fill(worker_t *w) {
+  par_ctx_t *ctx = w->ctx;
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Maximum number of rows in this range is the number of lines which
+  // overlap the row window. Allocate for this and then only use what's needed
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  size_t lo = w->first_line > ctx->row_lo ? w->first_line : ctx->row_lo;
+  size_t hi = w->first_line + w->nlines < ctx->row_hi ? w->first_line + w->nlines : ctx->row_hi;
+  if (hi <= lo) return;
+  size_t max_rows = hi - lo;
+
+  w->coldata = calloc((size_t)ctx->ncols + 1, sizeof(void *));
+  if (w->coldata == NULL) {
+    worker_error(w, WORKER_ALLOC_ERROR, lo);
+    return;
+  }
+  for (int col = 0; col < ctx->ncols; col++) {
+    size_t elem_size = 0;
+    switch(ctx->sexp_type[col]) {
+    case LGLSXP:
+    case INTSXP:   elem_size = sizeof(int32_t);      break;
+    case REALSXP:  elem_size = sizeof(double);       break;
+    case INT64SXP: elem_size = sizeof(int64_t);      break;
+    case STRSXP:   elem_size = sizeof(str_ref_t);    break;
+    default:       elem_size = sizeof(yyjson_val *); break;
+    }
+    w->coldata[col] = malloc(max_rows * elem_size);
+    if (w->coldata[col] == NULL) {
+      worker_error(w, WORKER_ALLOC_ERROR, lo);
+      return;
+    }
+  }
+  if (ctx->keep_docs) {
+    w->docs = calloc(max_rows, sizeof(yyjson_doc *));
+    if (w->docs == NULL) {
+      worker_error(w, WORKER_ALLOC_ERROR, lo);
+      return;
+    }
+  }
+
+  w->nkey_col = (size_t)ctx->ncols + 1;
+  w->key_col  = malloc(w->nkey_col * sizeof(int));
+  w->last_row = malloc(w->nkey_col * sizeof(size_t));
+  if (w->key_col == NULL || w->last_row == NULL) {
+    worker_error(w, WORKER_ALLOC_ERROR, lo);
+    return;
+  }
+  for (size_t i = 0; i < w->nkey_col; i++) {
+    w->key_col[i]  = -1;
+    w->last_row[i] = SIZE_MAX;
+  }
+
+
+  const char *p = w->start;
+  size_t line_num = w->first_line;
+  size_t row = 0;
+
+  while (p < w->end && line_num < ctx->row_hi) {
+    const char *nl = scan_newline(p, w->end);
+    const char *eol = nl == NULL ? w->end : nl;
+    size_t len = (size_t)(eol - p);
+
+    // ignore blank lines
+    if (line_num >= ctx->row_lo && len > 0) {
+      yyjson_doc *doc = worker_parse_line(w, p, len, line_num);
+      if (doc == NULL) return;
+
+      yyjson_val *obj = yyjson_doc_get_root(doc);
+      if (yyjson_get_type(obj) != YYJSON_TYPE_OBJ) {
+        worker_error(w, WORKER_NOT_OBJECT, line_num);
+        yyjson_doc_free(doc);
+        return;
+      }
+
+      if (!row_matches_filter(obj, ctx->opt->filter)) {
+        yyjson_doc_free(doc);
+        line_num++;
+        p = eol + 1;
+        continue;
+      }
+
+      if (!worker_fill_row(w, row, obj)) {
+        worker_error(w, WORKER_ALLOC_ERROR, line_num);
+        yyjson_doc_free(doc);
+        return;
+      }
+
+      if (ctx->keep_docs) {
+        w->docs[w->ndocs++] = doc;
+      } else {
+        yyjson_doc_free(doc);
+      }
+
+      if (w->err != WORKER_OK) return;
+      row++;
+    }
+
+    line_num++;
+    p = eol + 1;
+  }
+
+  w->nrows = row;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Thread entry point
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void *worker_run(void *arg) {
+  worker_t *w = (worker_t *)arg;
+
+  switch(w->ctx->phase) {
+  case PHASE_LINES:
+    worker_count_lines(w);
+    break;
+  case PHASE_PROBE:
+    worker_probe(w);
+    break;
+  case PHASE_FILL:
+    worker_fill(w);
+    break;
+  }
+
+  return NULL;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Run a phase across all the workers and wait for them to finish.
+// Worker 0 runs on the calling thread.  If a thread can't be created,
+// that worker is just run on the calling thread too.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void run_phase(par_ctx_t *ctx, int phase) {
+  ctx->phase = phase;
+
+  pthread_t tid[ctx->nworkers];
+  bool started[ctx->nworkers];
+
+  for (int i = 1; i < ctx->nworkers; i++) {
+    started[i] = pthread_create(&tid[i], NULL, worker_run, &ctx->workers[i]) == 0;
+  }
+
+  worker_run(&ctx->workers[0]);
+
+  for (int i = 1; i < ctx->nworkers; i++) {
+    if (started[i]) {
+      pthread_join(tid[i], NULL);
+    } else {
+      worker_run(&ctx->workers[i]);
+    }
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Raise the first error (by line number) from any worker
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void check_worker_errors(par_ctx_t *ctx, state_t *state, const char *phase_desc) {
+
+  worker_t *first = NULL;
+  for (int i = 0; i < ctx->nworkers; i++) {
+    worker_t *w = &ctx->workers[i];
+    if (w->err != WORKER_OK && (first == NULL || w->err_line < first->err_line)) {
+      first = w;
+    }
+  }
+  if (first == NULL) return;
+
+  // Line numbers in messages are relative to the first line after 'nskip'
+  int line = (int)(first->err_line - ctx->row_lo + 1);
+
+  switch(first->err) {
+  case WORKER_PARSE_ERROR:
+    error_and_destroy_state(state, "Couldn't parse JSON %s %i: %s\n", phase_desc, line, first->read_err.msg);
+    break;
+  case WORKER_NOT_OBJECT:
+    error_and_destroy_state(state, "parse_ndjson_as_df() only works if all lines represent JSON objects");
+    break;
+  default:
+    error_and_destroy_state(state, "parse_ndjson_file_as_df_(): Memory allocation failed");
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parse ndjson file as a data.frame using multiple threads
+//
+// @param filename uncompressed NDJSON file
+// @param nread,nskip,nprobe same meaning as for 'parse_ndjson_file_as_df_()'
+//        Negative values for 'nread' and 'nprobe' mean "all lines"
+// @param nthreads number of threads
+// @param start,end only this byte range of the file is read.  'start' must
+//        be the start of a line, and 'nskip' is counted from there.  
+//        'end' may be beyond the end of the file.  (See 'ndjson-index.c')
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP parse_ndjson_file_as_df_parallel(const char *filename, int nread, int nskip,
+                                      int nprobe, int nthreads, 
+                                      uint64_t start, uint64_t end, parse_options *opt) {
+
+  int nprotect = 0;
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // The context is owned by an external pointer, so that it is cleaned up
+  // by the garbage collector if there's an error in the R API calls below.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  par_ctx_t *ctx = calloc(1, sizeof(par_ctx_t));
+  if (ctx == NULL) {
+    Rf_error("parse_ndjson_file_as_df_(): Couldn't allocate context");
+  }
+  SEXP ctx_ = PROTECT(R_MakeExternalPtr(ctx, R_NilValue, R_NilValue)); nprotect++;
+  R_RegisterCFinalizer(ctx_, par_ctx_finalizer);
+
+  // Parsing happens from a read-only map of the file, so in-situ
+  // parsing is not possible.
+  ctx->opt = opt;
+  ctx->extra_col = -1;
+  ctx->opt->yyjson_read_flag &= ~(unsigned int)YYJSON_READ_INSITU;
+
+  if (!file_map_open(filename, &ctx->map)) {
+    Rf_error("parse_ndjson_file_as_df_(): Couldn't read file '%s'", filename);
+  }
+  size_t len = ctx->map.len;
+  if (end < len) len = (size_t)end;
+  if (start > len) start = len;
+  const char *data = ctx->map.data + start;
+  len -= (size_t)start;
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Split the data into one range per thread. Each range starts
+  // at the beginning of a line
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  size_t max_threads = len / MIN_BYTES_PER_THREAD + 1;
+  if (nthreads < 1) nthreads = 1;
+  if ((size_t)nthreads > max_threads) nthreads = (int)max_threads;
+
+  ctx->nworkers = nthreads;
+  ctx->workers  = calloc((size_t)nthreads, sizeof(worker_t));
+  if (ctx->workers == NULL) {
+    Rf_error("parse_ndjson_file_as_df_(): Couldn't allocate workers");
+  }
+
+  const char *prev_end = data;
+  for (int i = 0; i < nthreads; i++) {
+    worker_t *w = &ctx->workers[i];
+    w->ctx   = ctx;
+    w->start = prev_end;
+    if (i == nthreads - 1) {
+      w->end = data + len;
+    } else {
+      const char *target = data + (len / (size_t)nthreads) * (size_t)(i + 1);
+      if (target < w->start) target = w->start;
+      const char *nl = scan_newline(target, data + len);
+      w->end = nl == NULL ? data + len : nl + 1;
+    }
+    prev_end = w->end;
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // (1) Count lines so each range knows its global line numbers
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  run_phase(ctx, PHASE_LINES);
+
+  size_t total_lines = 0;
+  for (int i = 0; i < nthreads; i++) {
+    ctx->workers[i].first_line = total_lines;
+    total_lines += ctx->workers[i].nlines;
+  }
+
+  size_t skip = nskip > 0 ? (size_t)nskip : 0;
+  ctx->row_lo   = skip;
+  ctx->row_hi   = nread  < 0 ? total_lines : skip + (size_t)nread;
+  ctx->probe_lo = skip;
+  ctx->probe_hi = nprobe < 0 ? total_lines : skip + (size_t)nprobe;
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // (2) Probe for column names and types.
+  //     Not needed if the user has supplied the schema in 'col_types'
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  if (opt->ncol_types == 0) {
+    run_phase(ctx, PHASE_PROBE);
+  }
+
+  state_t *state = create_state();
+  check_worker_errors(ctx, state, "during probe line");
+
+  unsigned int *declared_type = NULL;
+  if (opt->ncol_types > 0) {
+    declared_type = declare_ndjson_columns(opt, state);
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Merge the per-range column names/types.
+  // Ranges are merged in order, so that the column order is the order
+  // in which names are first seen in the file.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  unsigned int type_status = 0;
+
+  for (int i = 0; i < nthreads; i++) {
+    worker_t *w = &ctx->workers[i];
+    type_status |= w->type_status;
+    if (!schema_merge(&state->schema, &w->schema)) {
+      error_and_destroy_state(state, "parse_ndjson_file_as_df_(): Memory allocation failed");
+    }
+  }
+
+  if (type_status & TYPE_STATUS_UNKNOWN) {
+    error_and_destroy_state(state, "get_array_element_type_bitset(): Unhandled JSON type/subtype\n");
+  }
+  report_type_bitset_status(type_status);
+
+  ctx->ncols       = state->schema.ncols;
+  ctx->schema      = &state->schema;
+  ctx->sexp_type   = calloc((size_t)ctx->ncols + 1, sizeof(unsigned int));
+  ctx->writer      = calloc((size_t)ctx->ncols + 1, sizeof(par_writer_t));
+  if (ctx->sexp_type == NULL || ctx->writer == NULL) {
+    error_and_destroy_state(state, "parse_ndjson_file_as_df_(): Memory allocation failed");
+  }
+
+  for (int col = 0; col < ctx->ncols; col++) {
+    ctx->sexp_type[col] = opt->ncol_types > 0 ? declared_type[col] : 
+      get_best_sexp_to_represent_type_bitset(state->schema.type_bitset[col], opt);
+    ctx->writer[col] = par_writer_for_type(ctx->sexp_type[col]);
+    if (ctx->sexp_type[col] == VECSXP) {
+      ctx->keep_docs = true;
+    }
+  }
+  if (opt->extra_cols_as_list) {
+    ctx->extra_col = opt->ncol_types;
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // (3) Decode all values into C buffers
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  run_phase(ctx, PHASE_FILL);
+  check_worker_errors(ctx, state, "on line");
+
+  size_t nrows = 0;
+  size_t nconvert_fail = 0;
+  for (int i = 0; i < nthreads; i++) {
+    nrows         += ctx->workers[i].nrows;
+    nconvert_fail += ctx->workers[i].nconvert_fail;
+  }
+  if (nrows > INT32_MAX) {
+    error_and_destroy_state(state, "parse_ndjson_file_as_df_(): Too many rows for a data.frame");
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // (4) Create the R columns and copy in the data from each range in order.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  SEXP df_ = PROTECT(Rf_allocVector(VECSXP, ctx->ncols)); nprotect++;
+
+  for (int col = 0; col < ctx->ncols; col++) {
+    unsigned int sexp_type = ctx->sexp_type[col];
+
+    // INT64SXP is actually contained in a REALSXP
+    unsigned int alloc_type = sexp_type == INT64SXP ? REALSXP : sexp_type;
+    SEXP vec_ = PROTECT(alloc_df_column(alloc_type, (R_xlen_t)nrows, opt));
+    if (sexp_type == INT64SXP) {
+      SEXP att_val_ = PROTECT(Rf_mkString("integer64"));
+      Rf_setAttrib(vec_, R_ClassSymbol, att_val_);
+      UNPROTECT(1);
+    }
+    SET_VECTOR_ELT(df_, col, vec_);
+    UNPROTECT(1); // no longer needs protection once part of data.frame
+
+    R_xlen_t row = 0;
+    for (int i = 0; i < nthreads; i++) {
+      worker_t *w = &ctx->workers[i];
+      if (w->nrows == 0) continue;
+      void *data = w->coldata[col];
+
+      switch(sexp_type) {
+      case LGLSXP:
+        memcpy(LOGICAL(vec_) + row, data, w->nrows * sizeof(int32_t));
+        break;
+      case INTSXP:
+        memcpy(INTEGER(vec_) + row, data, w->nrows * sizeof(int32_t));
+        break;
+      case INT64SXP:
+      case REALSXP:
+        memcpy(REAL(vec_) + row, data, w->nrows * sizeof(double));
+        break;
+      case STRSXP: {
+        str_ref_t *ref = (str_ref_t *)data;
+        if (opt->lazy_strings) {
+          for (size_t j = 0; j < w->nrows; j++) {
+            const char *str = ref[j].len < 0 ? NULL : w->arena + ref[j].offset;
+            lazy_str_set(vec_, row + (R_xlen_t)j, str, (size_t)ref[j].len);
+          }
+          break;
+        }
+        for (size_t j = 0; j < w->nrows; j++) {
+          if (ref[j].len < 0) {
+            SET_STRING_ELT(vec_, row + (R_xlen_t)j, NA_STRING);
+          } else {
+            SET_STRING_ELT(vec_, row + (R_xlen_t)j, Rf_mkCharLen(w->arena + ref[j].offset, ref[j].len));
+          }
+        }
+      }
+        break;
+      case VECSXP: {
+        yyjson_val **vals = (yyjson_val **)data;
+        parse_options nested;
+        parse_options *nested_opt = nested_parse_options(opt, &nested);
+        for (size_t j = 0; j < w->nrows; j++) {
+          if (col == ctx->extra_col) {
+            SET_VECTOR_ELT(vec_, row + (R_xlen_t)j, json_object_extra_keys(vals[j], ctx->schema, opt, state));
+          } else if (vals[j] == NULL) {
+            SET_VECTOR_ELT(vec_, row + (R_xlen_t)j, opt->df_missing_list_elem);
+          } else {
+            SET_VECTOR_ELT(vec_, row + (R_xlen_t)j, json_as_robj(vals[j], nested_opt, state));
+          }
+        }
+      }
+        break;
+      default:
+        error_and_destroy_state(state, "parse_ndjson_file_as_df_(): Unknown type");
+      }
+
+      row += (R_xlen_t)w->nrows;
+
+      // This column's buffer is no longer needed
+      free(w->coldata[col]);
+      w->coldata[col] = NULL;
+    }
+  }
+
+  if (nconvert_fail > 0) {
+    Rf_warning("parse_ndjson_file_as_df_(): %.0f value(s) did not match the type of their column (as determined by '%s') and were set to NA", 
+               (double)nconvert_fail, opt->ncol_types > 0 ? "col_types" : "nprobe");
+  }
+
+  SEXP df_final_ = PROTECT(promote_list_to_data_frame(df_, state->schema.names, state->schema.ncols)); nprotect++;
+
+  destroy_state(state);
+  destroy_par_ctx(ctx);
+  R_ClearExternalPtr(ctx_);
+
+  UNPROTECT(nprotect);
+  return df_final_;
+}
@@ -7,19 +7,35 @@
 #include <R_ext/Connections.h>
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-#include <zlib.h>
+#include <stddef.h>
 
 #include "yyjson.h"
+#include "R-yyjson-schema.h"
 #include "R-yyjson-state.h"
 #include "R-yyjson-parse.h"
 #include "R-yyjson-serialize.h"
+#include "R-yyjson-filter.h"
+#include "R-yyjson-row-decoder.h"
+#include "R-yyjson-lazy-str.h"
+#include "ndjson-parse.h"
+#include "file-map.h"
+#include "decompress.h"
+#include "ndjson-reader.h"
+#include "ndjson-scan.h"
+#include "ndjson-index.h"
 
-#define MAX_LINE_LENGTH 131072
 #define INIT_LIST_LENGTH 64
 
+// Limits on the parsed probe docs kept for the data.frame fill
+#define PROBE_MAX_DOCS  10000
+#define PROBE_MAX_BYTES (16 << 20)
+
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Double the length of a list by
@@ -38,9 +54,6 @@ SEXP grow_list(SEXP oldlist) {
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Count the number of newlines in a file
-// 'gz' lib handles compressed and uncompressed files.
-//
 // Two options for parsing streaming input from a file:
 //   (1) calculate num of lines. Allocate this exactly. Parse file.
 //       - PRO: Minimise re-allocation as data grows
@@ -54,39 +67,89 @@ SEXP grow_list(SEXP oldlist) {
 //  and then just truncate it to the actual data size at the end.
 //
 // For data.frames, growing its size involves growing the size of every 
-// column individually. For int/double, this is an easy re-allocation.
-// For string STRSXP you'd have to grow them in the same manner as 'grow_list_()'
-// grows VECSXP objects.  This seems like a lot of work in order to figure
-// out if its any faster than just traversing the file twice in order to 
-// count number of newlines.
+// column individually. See 'grow_list_of_vectors()'.
 //
-// For now (2023-08-09), ndjson->list will use method 2 and 
-// ndjson->data.frame will use method 1
+// Method 1 can't work for non-seekable input (e.g. pipes), and means a 
+// small 'nread' still has to scan the entire file, so both ndjson->list 
+// and ndjson->data.frame use method 2.
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-int count_lines(const char *filename) {
-  char buf[MAX_LINE_LENGTH] = {0};
-  int counter = 0;
-  
-  gzFile file = gzopen(filename, "r");
-  
-  for(;;) {
-    size_t res = (size_t)gzread(file, buf, MAX_LINE_LENGTH);
-    
-    size_t i;
-    for(i = 0; i < res; i++) {
-      if (buf[i] == '\n')
-        counter++;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Grow every vector in a list to the new length.
+// Note: 'Rf_lengthgets()' does not keep attributes (other than names), so 
+// any class attribute must be set after the final truncation.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void grow_list_of_vectors(SEXP df_, int new_length) {
+  for (int i=0; i < Rf_length(df_); i++) {
+    if (is_lazy_str(VECTOR_ELT(df_, i))) {
+      lazy_str_set_length(VECTOR_ELT(df_, i), new_length);
+      continue;
     }
-    
-    if (gzeof(file))
-      break;
+    SEXP new_ = PROTECT(Rf_lengthgets(VECTOR_ELT(df_, i), new_length));
+    SET_VECTOR_ELT(df_, i, new_);
+    UNPROTECT(1);
   }
+}
+
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Use the NDJSON index (if any) to find where to start reading, to skip 
+// 'nskip' lines.  'nskip' is reduced by the number of lines the index skips.
+//
+// @return NULL if there is no index
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static ndjson_seek_t *seek_ndjson_file(const char *filename, SEXP index_file_, int *nskip, int nread) {
+  if (Rf_isNull(index_file_)) return NULL;
   
-  gzclose(file);
-  return counter;
+  uint64_t row_lo = *nskip > 0 ? (uint64_t)*nskip : 0;
+  uint64_t row_hi = row_lo + (nread < 0 ? (uint64_t)INT32_MAX : (uint64_t)nread);
+  ndjson_seek_t *seek = (ndjson_seek_t *)R_alloc(1, sizeof(ndjson_seek_t));
+  ndjson_index_seek(CHAR(STRING_ELT(index_file_, 0)), filename, row_lo, row_hi, seek);
+  *nskip = (int)(row_lo - seek->row);
+  
+  return seek;
+}
+
+
+static SEXP open_ndjson_file(const char *filename, int nthreads, SEXP index_file_, int *nskip, int nread) {
+  ndjson_seek_t *seek = seek_ndjson_file(filename, index_file_, nskip, nread);
+  if (seek == NULL) {
+    return line_reader_open(filename, nthreads);
+  }
+  return line_reader_open_at(filename, nthreads, seek->has_point ? &seek->point : NULL, seek->offset);
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Line numbers of the rows read from a file.  Used by 'rows' in 
+// 'read_ndjson_file()' to find the requested lines, as blank lines and 
+// rows dropped by the filter don't give a row.
+//
+// 'lines_' is an integer vector (grown as needed), or R_NilValue if line
+// numbers were not requested.  Lines are counted from 1 after 'nskip'.
+// The result has attributes:
+//    "line"   line number of each row
+//    "nlines" number of lines read (including blank lines)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void add_row_line(SEXP *lines_, PROTECT_INDEX ipx, R_xlen_t *nrow_lines, int line) {
+  if (Rf_isNull(*lines_)) return;
+  if (*nrow_lines == XLENGTH(*lines_)) {
+    REPROTECT(*lines_ = Rf_xlengthgets(*lines_, 2 * XLENGTH(*lines_)), ipx);
+  }
+  INTEGER(*lines_)[(*nrow_lines)++] = line;
+}
+
+static void set_row_lines(SEXP res_, SEXP lines_, R_xlen_t nrow_lines, int nlines) {
+  if (Rf_isNull(lines_)) return;
+  SEXP line_   = PROTECT(Rf_xlengthgets(lines_, nrow_lines));
+  SEXP nlines_ = PROTECT(Rf_ScalarInteger(nlines));
+  Rf_setAttrib(res_, Rf_install("line"), line_);
+  Rf_setAttrib(res_, Rf_install("nlines"), nlines_);
+  UNPROTECT(2);
+}
+
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Parse ndjson as a list of R objects: one-r-object-per-line-of-input
@@ -102,17 +165,20 @@ int count_lines(const char *filename) {
 // @param filename filename containing ndjson data
 // @param nread_limit number of lines to read
 // @param nskip number of lines to skip before reading
+// @param index_file_ NDJSON index for the file (see 'ndjson-index.c'), or NULL
+// @param line_numbers_ logical. Record the line number of each element.
+//        See 'add_row_line()'
 // @param parse_opts list of options for parsing.
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP parse_ndjson_file_as_list_(SEXP filename_, SEXP nread_limit_, SEXP nskip_, SEXP parse_opts_) {
-  
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Buffer to read each line of the input file.
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  char buf[MAX_LINE_LENGTH] = {0};
+SEXP parse_ndjson_file_as_list_(SEXP filename_, SEXP nread_limit_, SEXP nskip_, SEXP index_file_, SEXP line_numbers_, SEXP parse_opts_) {
   
+  int nprotect = 0;
   parse_options opt = create_parse_options(parse_opts_);
   
+  // Lines are parsed directly from the line reader's buffer, which does not
+  // have the padding required for in-situ parsing
+  opt.yyjson_read_flag &= ~YYJSON_READ_INSITU;
+  
   int nread_limit = Rf_asInteger(nread_limit_);
   int nskip = Rf_asInteger(nskip_);
   
@@ -129,16 +195,16 @@ SEXP parse_ndjson_file_as_list_(SEXP filename_, SEXP nread_limit_, SEXP nskip_,
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Open file
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  gzFile input = gzopen(filename, "r");
+  SEXP reader_ = PROTECT(open_ndjson_file(filename, 1, index_file_, &nskip, nread_limit)); nprotect++;
+  line_reader_t *input = line_reader_get(reader_);
+  const char *buf;
+  size_t buf_len;
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Skip lines if requested
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   if (nskip > 0) {
-    while (gzgets(input, buf, MAX_LINE_LENGTH) != 0) {
-      nskip--;
-      if (nskip == 0) break;
-    }
+    line_reader_skip(input, (size_t)nskip);
   }
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -146,9 +212,15 @@ SEXP parse_ndjson_file_as_list_(SEXP filename_, SEXP nread_limit_, SEXP nskip_,
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   PROTECT_INDEX ipx;
   SEXP list_;
-  PROTECT_WITH_INDEX(list_ = Rf_allocVector(VECSXP, 64), &ipx);
+  PROTECT_WITH_INDEX(list_ = Rf_allocVector(VECSXP, 64), &ipx); nprotect++;
   R_xlen_t list_size = XLENGTH(list_);
   
+  PROTECT_INDEX lpx;
+  SEXP lines_;
+  PROTECT_WITH_INDEX(lines_ = Rf_asLogical(line_numbers_) == 1 ? Rf_allocVector(INTSXP, 64) : R_NilValue, &lpx); nprotect++;
+  R_xlen_t nrow_lines = 0;
+  int nlines = 0;
+  
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Iterate over the file.  For each line
@@ -160,13 +232,18 @@ SEXP parse_ndjson_file_as_list_(SEXP filename_, SEXP nread_limit_, SEXP nskip_,
   //   - otherwise 
   //        insert resulting robject into list
   //   - free the doc
+  //
+  // Each line is parsed once, into memory from an arena which is re-used
+  // for every line (see 'state_line_alc()')
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  state_t *state = create_state();
   unsigned int nread_actual = 0;
-  while (gzgets(input, buf, MAX_LINE_LENGTH) != 0) {
+  while ((buf = line_reader_next(input, &buf_len)) != NULL) {
     
     if (nread_actual >= nread_limit) {
       break;
     }
+    nlines++;
     
     //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
     // Grow list if we need more room
@@ -178,40 +255,72 @@ SEXP parse_ndjson_file_as_list_(SEXP filename_, SEXP nread_limit_, SEXP nskip_,
     
     // ignore lines which are just a "\n".
     // might have to do something fancier for lines with just whitespace
-    if (strlen(buf) <= 1) continue;
+    if (buf_len == 0) continue;
     
     yyjson_read_err err;
-    state_t *state = create_state();
-    state->doc = yyjson_read_opts(buf, strlen(buf), opt.yyjson_read_flag, NULL, &err);
+    yyjson_alc *alc = state_line_alc(state, buf_len, opt.yyjson_read_flag);
+    state->doc = yyjson_read_opts((char *)buf, buf_len, opt.yyjson_read_flag, alc, &err);
     
     if (state->doc == NULL) {
-      output_verbose_error(buf, strlen(buf), err);
+      output_verbose_error(buf, buf_len, err);
       Rf_warning("Couldn't parse NDJSON row %i. Inserting 'NULL'\n", nread_actual + 1);
       SET_VECTOR_ELT(list_, nread_actual, R_NilValue);
     } else {
-      SET_VECTOR_ELT(list_, nread_actual, parse_json_from_str(buf, strlen(buf), &opt));
+      SET_VECTOR_ELT(list_, nread_actual, json_as_robj(yyjson_doc_get_root(state->doc), &opt, state));
+      yyjson_doc_free(state->doc);
+      state->doc = NULL;
     }
     
-    destroy_state(state);
+    add_row_line(&lines_, lpx, &nrow_lines, nlines);
     nread_actual++;
   }
+  destroy_state(state);
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // 'list_' is oversized 
   // Need to copy list into a new list which contains just the valid elements
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   REPROTECT(list_ = Rf_lengthgets(list_, (R_len_t)nread_actual), ipx);
+  set_row_lines(list_, lines_, nrow_lines, nlines);
 
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Close input, tidy memory and return
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  gzclose(input);
-  UNPROTECT(1);
+  line_reader_close(reader_);
+  UNPROTECT(nprotect);
   return list_;
 }
 
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Skip records in an NDJSON string by scanning for newlines, rather than 
+// parsing each skipped record.  Blank lines do not count as records.
+//
+// @return number of bytes skipped
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static size_t skip_ndjson_str_records(const char *str, size_t str_size, int nskip) {
+  const char *p   = str;
+  const char *end = str + str_size;
+  
+  while (nskip > 0 && p < end) {
+    const char *nl  = scan_newline(p, end);
+    const char *eol = nl == NULL ? end : nl;
+    
+    for (const char *c = p; c < eol; c++) {
+      if (*c != ' ' && *c != '\t' && *c != '\r') {
+        nskip--;
+        break;
+      }
+    }
+    
+    p = nl == NULL ? end : nl + 1;
+  }
+  
+  return (size_t)(p - str);
+}
+
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Parse ndjson as a list of R objects: one-r-object-per-line-of-input
 // 
@@ -273,24 +382,15 @@ SEXP parse_ndjson_str_as_list_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP parse_o
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Skip lines if requested
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  while (nskip > 0 && total_read < orig_str_size) {
-    yyjson_read_err err;
-    state_t *state = create_state();
-    state->doc = yyjson_read_opts(str, str_size, opt.yyjson_read_flag, NULL, &err);
-    size_t pos = yyjson_doc_get_read_size(state->doc);
-    destroy_state(state);
-    
-    //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    // Advance string 
-    //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    total_read += pos + 1;
-    str += pos + 1;
-    str_size -= (pos + 1);
-    
-    nskip--;
+  if (nskip > 0) {
+    size_t pos = skip_ndjson_str_records(str, str_size, nskip);
+    total_read += pos;
+    str += pos;
+    str_size -= pos;
   }
   
   
+  state_t *state = create_state();
   unsigned int i = 0;
   while (total_read < orig_str_size) {
     
@@ -306,9 +406,20 @@ SEXP parse_ndjson_str_as_list_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP parse_o
       list_size = XLENGTH(list_);
     }
     
+    //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    // Parse once, with the arena sized for the current line.
+    // A record may span more than one line, so if the arena turns out 
+    // to be too small, parse again with the default allocator
+    //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    const char *nl = scan_newline(str, str + str_size);
+    size_t line_len = nl == NULL ? str_size : (size_t)(nl - str);
+    
     yyjson_read_err err;
-    state_t *state = create_state();
-    state->doc = yyjson_read_opts(str, str_size, opt.yyjson_read_flag, NULL, &err);
+    yyjson_alc *alc = state_line_alc(state, line_len, opt.yyjson_read_flag);
+    state->doc = yyjson_read_opts(str, str_size, opt.yyjson_read_flag, alc, &err);
+    if (state->doc == NULL && alc != NULL && err.code == YYJSON_READ_ERROR_MEMORY_ALLOCATION) {
+      state->doc = yyjson_read_opts(str, str_size, opt.yyjson_read_flag, NULL, &err);
+    }
     size_t pos = yyjson_doc_get_read_size(state->doc);
     
     
@@ -316,12 +427,12 @@ SEXP parse_ndjson_str_as_list_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP parse_o
       Rf_warning("Couldn't parse NDJSON row %i. Inserting 'NULL'\n", i + 1);
       SET_VECTOR_ELT(list_, i, R_NilValue);
     } else {
-      SET_VECTOR_ELT(list_, i, parse_json_from_str(str, str_size, &opt));
+      SET_VECTOR_ELT(list_, i, json_as_robj(yyjson_doc_get_root(state->doc), &opt, state));
+      yyjson_doc_free(state->doc);
+      state->doc = NULL;
     }
     i++;
     
-    destroy_state(state);
-    
     
     //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
     // Advance string 
@@ -330,6 +441,7 @@ SEXP parse_ndjson_str_as_list_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP parse_o
     str += pos + 1;
     str_size -= (pos + 1);
   }
+  destroy_state(state);
   
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -360,6 +472,10 @@ SEXP parse_ndjson_str_as_list_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP parse_o
 void truncate_list_of_vectors(SEXP df_, int data_length, int allocated_length) {
   if (data_length != allocated_length) {
     for (int i=0; i < Rf_length(df_); i++) {
+      if (is_lazy_str(VECTOR_ELT(df_, i))) {
+        lazy_str_set_length(VECTOR_ELT(df_, i), data_length);
+        continue;
+      }
       SEXP trunc_ = PROTECT(Rf_lengthgets(VECTOR_ELT(df_, i), data_length));
       SET_VECTOR_ELT(df_, i, trunc_);
       UNPROTECT(1);
@@ -412,27 +528,176 @@ SEXP promote_list_to_data_frame(SEXP df_, char **colname, int ncols) {
 
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Accumulate names and types of the members of a {}-object into the 
+// schema in the state.
+// Names are copied, as the 'doc' they are from may be freed before 
+// the column names are used
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void probe_ndjson_object(yyjson_val *obj, parse_options *opt, state_t *state) {
+  yyjson_val *key;
+  yyjson_obj_iter obj_iter = yyjson_obj_iter_with(obj); // MUST be an object
+  schema_t *schema = &state->schema;
+  
+  while ((key = yyjson_obj_iter_next(&obj_iter))) {
+    if (!is_selected_column(key, opt)) continue;
+    yyjson_val *val = yyjson_obj_iter_get_val(key);
+    
+    int name_idx = schema_add_key(schema, key);
+    if (name_idx < 0) {
+      error_and_destroy_state(state, "Failed to allocate 'colname'");
+    }
+    
+    schema->type_bitset[name_idx] = update_type_bitset(schema->type_bitset[name_idx], val, opt);
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Set the column names + types from the 'col_types' option, instead of 
+// probing the data.
+//
+// @return SEXP type for each column. Memory from R_alloc()
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+unsigned int *declare_ndjson_columns(parse_options *opt, state_t *state) {
+  int ncols = get_declared_column_count(opt);
+  unsigned int *sexp_type = (unsigned int *)R_alloc((size_t)ncols + 1, sizeof(unsigned int));
+  
+  for (int col = 0; col < ncols; col++) {
+    const char *name = get_declared_column_name(opt, col);
+    if (schema_add(&state->schema, name, strlen(name)) < 0) {
+      error_and_destroy_state(state, "Failed to allocate 'colname'");
+    }
+    sexp_type[col] = get_declared_column_type(opt, col);
+  }
+  
+  return sexp_type;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Best SEXP type for each column in the schema.
+//
+// @return SEXP type for each column. Memory from R_alloc()
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+unsigned int *get_schema_sexp_types(schema_t *schema, parse_options *opt) {
+  unsigned int *sexp_type = (unsigned int *)R_alloc((size_t)schema->ncols + 1, sizeof(unsigned int));
+  for (int col = 0; col < schema->ncols; col++) {
+    sexp_type[col] = get_best_sexp_to_represent_type_bitset(schema->type_bitset[col], opt);
+  }
+  return sexp_type;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Slot the values from a {}-object into the given row of the data.frame.
+// The same decoder should be used for all rows, as it learns the key order.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void fill_ndjson_row(SEXP df_, int row, yyjson_val *obj, row_decoder_t *dec) {
+  
+  if (yyjson_get_type(obj) != YYJSON_TYPE_OBJ) {
+    error_and_destroy_state(dec->state, "parse_ndjson_as_df() only works if all lines represent JSON objects");
+  }
+  
+  row_decoder_fill(dec, df_, row, obj);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parse a line of NDJSON into the next row of the data.frame.
+// The data.frame is grown if needed.  Lines which don't match the filter 
+// are dropped before any R objects are created for them.
+//
+// @return true if a row was added
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool parse_ndjson_row(const char *buf, size_t buf_len, int nlines, SEXP df_, int row, 
+                             int *nrows, row_decoder_t *dec, parse_options *opt, state_t *state) {
+  yyjson_read_err err;
+  state->doc = yyjson_read_opts((char *)buf, buf_len, opt->yyjson_read_flag, NULL, &err);
+  if (state->doc == NULL) {
+    output_verbose_error(buf, buf_len, err);
+    error_and_destroy_state(state, "Couldn't parse JSON on line %i\n", nlines);
+  }
+  
+  if (!row_matches_filter(yyjson_doc_get_root(state->doc), opt->filter)) {
+    yyjson_doc_free(state->doc);
+    state->doc = NULL;
+    return false;
+  }
+  
+  if (row == *nrows) {
+    *nrows = *nrows > INT32_MAX / 2 ? INT32_MAX : 2 * *nrows;
+    grow_list_of_vectors(df_, *nrows);
+  }
+  
+  fill_ndjson_row(df_, row, yyjson_doc_get_root(state->doc), dec);
+  
+  yyjson_doc_free(state->doc);
+  state->doc = NULL;
+  return true;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Keep a copy of a line in 'state->lines' (newline separated)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void keep_ndjson_line(state_t *state, const char *buf, size_t buf_len) {
+  size_t needed = state->lines_len + buf_len + 1;
+  if (needed > state->lines_capacity) {
+    size_t capacity = state->lines_capacity == 0 ? 65536 : state->lines_capacity;
+    while (capacity < needed) capacity *= 2;
+    char *lines = realloc(state->lines, capacity);
+    if (lines == NULL) {
+      error_and_destroy_state(state, "Failed to allocate copy of probe lines");
+    }
+    state->lines          = lines;
+    state->lines_capacity = capacity;
+  }
+  memcpy(state->lines + state->lines_len, buf, buf_len);
+  state->lines[state->lines_len + buf_len] = '\n';
+  state->lines_len = needed;
+}
+
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Parse ndjson as a data.frame one-rorw-per-line-of-input
 // 
 // Compared to parsing to list
 //   CON: Complex multi-column handling 
-//   CON: in order to avoid re-allocation of memory as file is read, we have to
-//        do an initial pass over the file to count the lines so we know the
-//        number of rows.
 //   CON: Have to probe the data.set to find out data types for each column.
 //        This is done once at the start of the parse, and it is then
 //        assumed all future types match the types seen so far.
 //        This might not be true, but a comprimise I'm making for speed.
-//   PRO: Faster. Data.frame allocation happens once, and data is slotted into 
-//        it.  No re-allocation as we pre-determine the number of rows and 
-//        type for each columnx
+//   PRO: Faster. Data is slotted directly into the data.frame columns, which
+//        are grown geometrically as needed and truncated once at the end.
+//
+// The input is only read once, and only as far as is needed:
+//   - the parsed docs for the 'nprobe' lines are kept, and are used to fill 
+//     the first rows after the column types have been determined.
+//   - reading stops as soon as 'nread' lines have been consumed.
+// This means the input does not need to be seekable e.g. '/dev/stdin'
+//
+// Parsed docs take several times the memory of the JSON text, so only the
+// first PROBE_MAX_DOCS docs (up to PROBE_MAX_BYTES of text) are kept.  
+// The probed lines after these are parsed again for the fill: a regular 
+// file is re-opened and read from the first of these lines, otherwise
+// (e.g. a pipe) a copy of each line's text is kept instead.
+//
+// If 'nthreads' > 1 and the file is not compressed, parsing is handed off to
+// the multi-threaded parser in 'ndjson-parallel.c'.  Blocked gzip files are 
+// decompressed on 'nthreads' threads (see 'bgzf.c'), but parsed serially.
+//
+// If 'line_numbers_' is TRUE, the line number of each row is recorded (see
+// 'add_row_line()').  This is only done by the serial parser.
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP parse_ndjson_file_as_df_(SEXP filename_, SEXP nread_, SEXP nskip_, SEXP nprobe_, SEXP parse_opts_) {
+SEXP parse_ndjson_file_as_df_(SEXP filename_, SEXP nread_, SEXP nskip_, SEXP nprobe_, SEXP nthreads_, SEXP index_file_, SEXP line_numbers_, SEXP parse_opts_) {
   
   int nprotect = 0;
-  char buf[MAX_LINE_LENGTH] = {0};
   parse_options opt = create_parse_options(parse_opts_);
+  
+  // Lines are parsed directly from the line reader's buffer, which does not
+  // have the padding required for in-situ parsing
+  opt.yyjson_read_flag &= ~YYJSON_READ_INSITU;
   const char *filename = (const char *)CHAR(STRING_ELT(filename_, 0));
   filename = R_ExpandFileName(filename);
   
@@ -456,141 +721,158 @@ SEXP parse_ndjson_file_as_df_(SEXP filename_, SEXP nread_, SEXP nskip_, SEXP npr
     nprobe = INT32_MAX;
   }
   
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Get the maximum possible number of json rows in this ndjson file.
-  // Note: the actual number of rows to parse may be less than this due
-  // to blank lines and/or errors.
-  // 'nrows' controls the amount of memory pre-allocated for rows in the df.
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  int nrows = count_lines(filename);
-  
-  // Account for rows to be skipped
-  nrows = nrows - nskip;
-  if (nrows < 0) {
-    nrows = 0;
+  // No point probing lines which will not be read
+  if (nprobe > nread) {
+    nprobe = nread;
   }
   
-  // Ensure we don't read more than the user requested
-  if (nrows > nread) {
-    nrows = nread;
+  bool line_numbers = Rf_asLogical(line_numbers_) == 1;
+  int nthreads = Rf_asInteger(nthreads_);
+  if (nthreads > 1 && !line_numbers && is_regular_file(filename) && detect_compression(filename) == COMPRESSION_NONE) {
+    // With an index, only the rows from 'nskip' to 'nskip + nread' are scanned
+    ndjson_seek_t *seek = seek_ndjson_file(filename, index_file_, &nskip, nread);
+    uint64_t start = seek == NULL ? 0 : seek->offset;
+    uint64_t end   = seek == NULL ? UINT64_MAX : seek->end;
+    return parse_ndjson_file_as_df_parallel(filename, nread, nskip, nprobe, nthreads, start, end, &opt);
   }
 
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Accumulation of unique key-names in the objects
   // These will become the column names of the data.frame.
   // Each column also has a 'type_bitset' to keep track of the type of each
-  // value across the different {}-objects
+  // value across the different {}-objects.  These are kept in 'state->schema'
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  unsigned int type_bitset[MAX_DF_COLS] = {0};
-  unsigned int sexp_type[MAX_DF_COLS] = {0};
+  unsigned int *sexp_type = NULL;
   
   
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Probe file for types
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  gzFile input = gzopen(filename, "r");
+  int nskip_requested = nskip > 0 ? nskip : 0;
+  PROTECT_INDEX ipx;
+  SEXP reader_;
+  PROTECT_WITH_INDEX(reader_ = open_ndjson_file(filename, nthreads, index_file_, &nskip, nread), &ipx); nprotect++;
+  line_reader_t *input = line_reader_get(reader_);
+  const char *buf;
+  size_t buf_len;
+  
+  PROTECT_INDEX lpx;
+  SEXP lines_;
+  PROTECT_WITH_INDEX(lines_ = line_numbers ? Rf_allocVector(INTSXP, 64) : R_NilValue, &lpx); nprotect++;
+  R_xlen_t nrow_lines = 0;
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Skip lines if requested
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   if (nskip > 0) {
-    int nskip2 = nskip;
-    while (gzgets(input, buf, MAX_LINE_LENGTH) != 0) {
-      nskip2--;
-      if (nskip2 == 0) break;
-    }
+    line_reader_skip(input, (size_t)nskip);
   }
   
   
   state_t *state = create_state();
   
-  for (unsigned int i = 0; i < nprobe; i++) {
-    char *ret = gzgets(input, buf, MAX_LINE_LENGTH);
-    if (ret == NULL) {
+  // A user-supplied schema means no probing is needed
+  if (opt.ncol_types > 0) {
+    sexp_type = declare_ndjson_columns(&opt, state);
+    nprobe = 0;
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Probe lines for types.
+  // The parsed docs are kept in the state so that they can be used to 
+  // fill the data.frame without re-reading the input.  Once the limit on
+  // kept docs is reached, lines are only probed.  'nlines_kept' is then
+  // the number of lines consumed before the first line which wasn't kept.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  int nlines = 0; // Number of lines consumed (including blank lines)
+  int docs_capacity = 0;
+  size_t docs_bytes = 0;
+  int nlines_kept = -1;
+  bool can_reread = is_regular_file(filename);
+  
+  while (nlines < nprobe) {
+    buf = line_reader_next(input, &buf_len);
+    if (buf == NULL) {
       break;
     }
-    
+    nlines++;
     
     // ignore lines which are just a "\n".
     // might have to do something fancier for lines with just whitespace
-    if (strlen(buf) <= 1) continue;
+    if (buf_len == 0) continue;
     
     yyjson_read_err err;
-    state->doc = yyjson_read_opts(buf, strlen(buf), opt.yyjson_read_flag, NULL, &err);
+    state->doc = yyjson_read_opts((char *)buf, buf_len, opt.yyjson_read_flag, NULL, &err);
     if (state->doc == NULL) {
-      output_verbose_error(buf, strlen(buf), err);
-      error_and_destroy_state(state, "Couldn't parse JSON during probe line %i\n", i + 1);
+      output_verbose_error(buf, buf_len, err);
+      error_and_destroy_state(state, "Couldn't parse JSON during probe line %i\n", nlines);
     }
     
-    yyjson_val *obj = yyjson_doc_get_root(state->doc);
-    yyjson_val *key;
-    yyjson_obj_iter obj_iter = yyjson_obj_iter_with(obj); // MUST be an object
-    
-    while ((key = yyjson_obj_iter_next(&obj_iter))) {
-      yyjson_val *val = yyjson_obj_iter_get_val(key);
-      
-      int name_idx = -1;
-      for (int i = 0; i < state->ncols; i++) {
-        if (yyjson_equals_str(key, state->colnames[i])) {
-          name_idx = i;
-          break;
-        }
-      }
-      if (name_idx < 0) {
-        // Name has not been seen yet.
-        // Need to copy the string as the 'doc' it is from is freed at the end of every loop
-        name_idx = state->ncols;
-        char *new_name = (char *)yyjson_get_str(key);
-        size_t n = strlen(new_name) + 1;
-        state->colnames[state->ncols] = calloc(n, 1);
-        if (state->colnames[state->ncols] == 0) {
-          error_and_destroy_state(state, "Failed to allocate 'colname'");
-        }
-        strcpy(state->colnames[state->ncols], new_name);
-        state->ncols++;
-        if (state->ncols == MAX_DF_COLS) {
-          error_and_destroy_state(state, "Maximum columns for data.frame exceeded: %i", MAX_DF_COLS);
-        }
+    // Rows which don't match the filter are dropped before any R objects 
+    // are created for them
+    if (!row_matches_filter(yyjson_doc_get_root(state->doc), opt.filter)) {
+      yyjson_doc_free(state->doc);
+      state->doc = NULL;
+      continue;
+    }
+    
+    probe_ndjson_object(yyjson_doc_get_root(state->doc), &opt, state);
+    
+    if (nlines_kept < 0 &&
+        (state->ndocs == PROBE_MAX_DOCS || docs_bytes + buf_len > PROBE_MAX_BYTES)) {
+      nlines_kept = nlines - 1;
+    }
+    
+    // Lines which are read again (below) get their line number then
+    if (nlines_kept < 0 || !can_reread) {
+      add_row_line(&lines_, lpx, &nrow_lines, nlines);
+    }
+    
+    if (nlines_kept >= 0) {
+      if (!can_reread) {
+        keep_ndjson_line(state, buf, buf_len);
       }
-      
-      type_bitset[name_idx] = update_type_bitset(type_bitset[name_idx], val, &opt);
+      yyjson_doc_free(state->doc);
+      state->doc = NULL;
+      continue;
     }
     
-    yyjson_doc_free(state->doc);
+    if (state->ndocs == docs_capacity) {
+      docs_capacity = docs_capacity == 0 ? INIT_LIST_LENGTH : 2 * docs_capacity;
+      yyjson_doc **docs = realloc(state->docs, (size_t)docs_capacity * sizeof(yyjson_doc *));
+      if (docs == NULL) {
+        error_and_destroy_state(state, "Failed to allocate probe docs");
+      }
+      state->docs = docs;
+    }
+    state->docs[state->ndocs++] = state->doc;
     state->doc = NULL;
+    docs_bytes += buf_len;
   }
   
-  gzclose(input);
-  
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Create a list (which will be promoted to a data.frame before returning)
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  SEXP df_ = PROTECT(Rf_allocVector(VECSXP, state->ncols)); nprotect++;
-  
+  SEXP df_ = PROTECT(Rf_allocVector(VECSXP, state->schema.ncols)); nprotect++;
   
+  // Initial number of rows allocated. This grows as needed
+  int nrows = state->ndocs > INIT_LIST_LENGTH ? (int)state->ndocs : INIT_LIST_LENGTH;
+  if (nrows > nread) {
+    nrows = nread;
+  }
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // For each column name,
   //   - determine the best SEXP to represent the 'type_bitset'
-  //   - Call a parse function which will
-  //        - loop through the entire []-array, plucking the value from each
-  //          {}-object
-  //        - return an atomic vector or a list
-  //   - place this vector as a column in the data.frame
+  //   - place a vector of this type as a column in the data.frame
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  for (unsigned int col = 0; col < state->ncols; col++) {
-    sexp_type[col] = get_best_sexp_to_represent_type_bitset(type_bitset[col], &opt);
-    
+  if (opt.ncol_types == 0) {
+    sexp_type = get_schema_sexp_types(&state->schema, &opt);
+  }
+  
+  for (int col = 0; col < state->schema.ncols; col++) {    
     // INT64SXP is actually contained in a REALSXP
     unsigned int alloc_type = sexp_type[col] == INT64SXP ? REALSXP : sexp_type[col];
     
     // Allocate memory for column
-    SEXP vec_ = PROTECT(Rf_allocVector(alloc_type, nrows));
-    if (sexp_type[col] == INT64SXP) {
-      SEXP att_val_ = PROTECT(Rf_mkString("integer64"));
-      Rf_setAttrib(vec_, R_ClassSymbol, att_val_);
-      UNPROTECT(1);
-    }
+    SEXP vec_ = PROTECT(alloc_df_column(alloc_type, nrows, &opt));
     
     // place vector into data.frame
     SET_VECTOR_ELT(df_, col, vec_);
@@ -599,98 +881,83 @@ SEXP parse_ndjson_file_as_df_(SEXP filename_, SEXP nread_, SEXP nskip_, SEXP npr
   
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Parse file
+  // Fill rows from the probe docs
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  input = gzopen(filename, "r");
+  row_decoder_t *dec = row_decoder_create(&state->schema, sexp_type, &opt, state);
+  int row = 0;
   
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Skip lines if requested
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  if (nskip > 0) {
-    while (gzgets(input, buf, MAX_LINE_LENGTH) != 0) {
-      nskip--;
-      if (nskip == 0) break;
+  for (int i = 0; i < state->ndocs; i++) {
+    fill_ndjson_row(df_, row, yyjson_doc_get_root(state->docs[i]), dec);
+    yyjson_doc_free(state->docs[i]);
+    state->docs[i] = NULL;
+    row++;
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Fill rows from the probed lines which weren't kept as docs
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  if (nlines_kept >= 0 && can_reread) {
+    // Start reading again from the first line which wasn't kept
+    line_reader_close(reader_);
+    nskip = nskip_requested + nlines_kept;
+    REPROTECT(reader_ = open_ndjson_file(filename, nthreads, index_file_, &nskip, nread - nlines_kept), ipx);
+    input = line_reader_get(reader_);
+    if (nskip > 0) {
+      line_reader_skip(input, (size_t)nskip);
     }
+    nlines = nlines_kept;
+  } else if (nlines_kept >= 0) {
+    const char *line = state->lines;
+    const char *end  = state->lines + state->lines_len;
+    while (line < end) {
+      const char *nl = memchr(line, '\n', (size_t)(end - line));
+      if (parse_ndjson_row(line, (size_t)(nl - line), nlines, df_, row, &nrows, dec, &opt, state)) {
+        row++;
+      }
+      line = nl + 1;
+    }
+    free(state->lines);
+    state->lines = NULL;
+    state->lines_len = state->lines_capacity = 0;
   }
   
-  // keep track of actual number of rows parsed.
-  // This might not be the same as 'nrow' as we can skip rows that we 
-  // can't parse.
-  int row = 0;
   
-  for (unsigned int i = 0; i < nrows; i++) {
-    char *ret = gzgets(input, buf, MAX_LINE_LENGTH);
-    if (ret == NULL) {
-      Rf_error("Unexepcted end to data\n");
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Continue parsing the rest of the file.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  while (nlines < nread) {
+    buf = line_reader_next(input, &buf_len);
+    if (buf == NULL) {
+      break;
     }
+    nlines++;
     
     // ignore lines which are just a "\n".
     // might have to do something fancier for lines with just whitespace
-    if (strlen(buf) <= 1) continue;
-    
-    yyjson_read_err err;
-    state->doc = yyjson_read_opts(buf, strlen(buf), opt.yyjson_read_flag, NULL, &err);
-    if (state->doc == NULL) {
-      output_verbose_error(buf, strlen(buf), err);
-      error_and_destroy_state(state, "Couldn't parse JSON on line %i\n", i + 1);
-    }
+    if (buf_len == 0) continue;
     
-    yyjson_val *obj = yyjson_doc_get_root(state->doc);
-    if (yyjson_get_type(obj) != YYJSON_TYPE_OBJ) {
-      error_and_destroy_state(state, "parse_ndjson_as_df() only works if all lines represent JSON objects");
+    if (parse_ndjson_row(buf, buf_len, nlines, df_, row, &nrows, dec, &opt, state)) {
+      add_row_line(&lines_, lpx, &nrow_lines, nlines);
+      row++;
     }
-    
-    for (unsigned int col = 0; col < state->ncols; col++) {
-      SEXP column_ = VECTOR_ELT(df_, col);
-      
-      yyjson_val *val = yyjson_obj_get(obj, state->colnames[col]);
-      
-      switch(sexp_type[col]) {
-      case LGLSXP:
-        LOGICAL(column_)[row] = json_val_to_logical(val, &opt);
-        break;
-      case INTSXP:
-        INTEGER(column_)[row] = json_val_to_integer(val, &opt);
-        break;
-      case INT64SXP: {
-        long long tmp = json_val_to_integer64(val, &opt);
-        ((long long *)(REAL(column_)))[row] = tmp;
-      }
-        break;
-      case REALSXP:
-        REAL(column_)[row] = json_val_to_double(val, &opt);
-        break;
-      case STRSXP:
-        if (val == NULL) {
-          SET_STRING_ELT(column_, row, NA_STRING);
-        } else {
-          SET_STRING_ELT(column_, row, json_val_to_charsxp(val, &opt));
-        }
-        break;
-      case VECSXP:
-        if (val == NULL) {
-          SET_VECTOR_ELT(column_, row, opt.df_missing_list_elem);
-        } else {
-          SET_VECTOR_ELT(column_, row, json_as_robj(val, &opt, state));
-        }
-        break;
-      default:
-        error_and_destroy_state(state, "parse_ndjson_file_as_df_(): Unknown type");
-      } 
-      
-    }
-    
-    yyjson_doc_free(state->doc);
-    state->doc = NULL;
-    
-    row++;
   }
   
-  gzclose(input);
+  line_reader_close(reader_);
   
   
   truncate_list_of_vectors(df_, row, nrows);
-  SEXP df_final_ = PROTECT(promote_list_to_data_frame(df_, state->colnames, state->ncols)); nprotect++;
+  
+  // Class attributes are set once the columns have reached their final length
+  for (int col = 0; col < state->schema.ncols; col++) {
+    if (sexp_type[col] == INT64SXP) {
+      SEXP att_val_ = PROTECT(Rf_mkString("integer64"));
+      Rf_setAttrib(VECTOR_ELT(df_, col), R_ClassSymbol, att_val_);
+      UNPROTECT(1);
+    }
+  }
+  
+  SEXP df_final_ = PROTECT(promote_list_to_data_frame(df_, state->schema.names, state->schema.ncols)); nprotect++;
+  set_row_lines(df_final_, lines_, nrow_lines, nlines);
   
   destroy_state(state);
   UNPROTECT(nprotect);
@@ -753,21 +1020,11 @@ SEXP parse_ndjson_str_as_df_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP nprobe_,
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Skip lines if requested
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  while (nskip > 0 && total_read < orig_str_size) {
-    yyjson_read_err err;
-    state_t *state = create_state();
-    state->doc = yyjson_read_opts(str, str_size, opt.yyjson_read_flag, NULL, &err);
-    size_t pos = yyjson_doc_get_read_size(state->doc);
-    destroy_state(state);
-    
-    //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    // Advance string 
-    //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    total_read += pos + 1;
-    str += pos + 1;
-    str_size -= (pos + 1);
-    
-    nskip--;
+  if (nskip > 0) {
+    size_t pos = skip_ndjson_str_records(str, str_size, nskip);
+    total_read += pos;
+    str += pos;
+    str_size -= pos;
   }
   
   
@@ -775,10 +1032,9 @@ SEXP parse_ndjson_str_as_df_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP nprobe_,
   // Accumulation of unique key-names in the objects
   // These will become the column names of the data.frame.
   // Each column also has a 'type_bitset' to keep track of the type of each
-  // value across the different {}-objects
+  // value across the different {}-objects.  These are kept in 'state->schema'
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  unsigned int type_bitset[MAX_DF_COLS] = {0};
-  unsigned int sexp_type[MAX_DF_COLS] = {0};
+  unsigned int *sexp_type = NULL;
   int nrows = 0;
   
   
@@ -788,6 +1044,12 @@ SEXP parse_ndjson_str_as_df_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP nprobe_,
   
   state_t *state = create_state();
   
+  // A user-supplied schema means no probing is needed
+  if (opt.ncol_types > 0) {
+    sexp_type = declare_ndjson_columns(&opt, state);
+    nprobe = 0;
+  }
+  
   while (nprobe > 0 && total_read < orig_str_size) {
     yyjson_read_err err;
     state->doc = yyjson_read_opts(str, str_size, opt.yyjson_read_flag, NULL, &err);
@@ -796,39 +1058,10 @@ SEXP parse_ndjson_str_as_df_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP nprobe_,
       error_and_destroy_state(state, "Couldn't parse JSON during probe line %i\n", nrows + 1);
     }
     
+    // Only probe the rows which will be kept
     yyjson_val *obj = yyjson_doc_get_root(state->doc);
-    yyjson_val *key;
-    yyjson_obj_iter obj_iter = yyjson_obj_iter_with(obj); // MUST be an object
-    
-    while ((key = yyjson_obj_iter_next(&obj_iter))) {
-      yyjson_val *val = yyjson_obj_iter_get_val(key);
-      
-      int name_idx = -1;
-      for (int i = 0; i < state->ncols; i++) {
-        if (yyjson_equals_str(key, state->colnames[i])) {
-          name_idx = i;
-          break;
-        }
-      }
-      if (name_idx < 0) {
-        // Name has not been seen yet
-        name_idx = state->ncols;
-        char *new_name = (char *)yyjson_get_str(key);
-        size_t n = strlen(new_name) + 1;
-        state->colnames[state->ncols] = calloc(n, 1);
-        if (state->colnames[state->ncols] == 0) {
-          error_and_destroy_state(state, "Failed to allocate 'colname'");
-        }
-        strcpy(state->colnames[state->ncols], new_name);
-        state->ncols++;
-        if (state->ncols == MAX_DF_COLS) {
-          // TODO: Switch to dynamic allocation and 'realloc()' as needed.
-          // Free the 'colnames' we copied out of JSON docs when probing
-          error_and_destroy_state(state, "Maximum columns for data.frame exceeded: %i", MAX_DF_COLS);
-        }
-      }
-      
-      type_bitset[name_idx] = update_type_bitset(type_bitset[name_idx], val, &opt);
+    if (row_matches_filter(obj, opt.filter)) {
+      probe_ndjson_object(obj, &opt, state);
     }
     
     yyjson_doc_free(state->doc);
@@ -875,7 +1108,7 @@ SEXP parse_ndjson_str_as_df_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP nprobe_,
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Create a list to hold vectors
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  SEXP df_ = PROTECT(Rf_allocVector(VECSXP, state->ncols)); nprotect++;
+  SEXP df_ = PROTECT(Rf_allocVector(VECSXP, state->schema.ncols)); nprotect++;
   
   
   
@@ -888,19 +1121,16 @@ SEXP parse_ndjson_str_as_df_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP nprobe_,
   //        - return an atomic vector or a list
   //   - place this vector as a column in the data.frame
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  for (unsigned int col = 0; col < state->ncols; col++) {
-    sexp_type[col] = get_best_sexp_to_represent_type_bitset(type_bitset[col], &opt);
-    
+  if (opt.ncol_types == 0) {
+    sexp_type = get_schema_sexp_types(&state->schema, &opt);
+  }
+  
+  for (int col = 0; col < state->schema.ncols; col++) {    
     // INT64SXP is actually contained in a REALSXP
     unsigned int alloc_type = sexp_type[col] == INT64SXP ? REALSXP : sexp_type[col];
     
     // Allocate memory for column
-    SEXP vec_ = PROTECT(Rf_allocVector(alloc_type, nrows));
-    if (sexp_type[col] == INT64SXP) {
-      SEXP att_val_ = PROTECT(Rf_mkString("integer64"));
-      Rf_setAttrib(vec_, R_ClassSymbol, att_val_);
-      UNPROTECT(1);
-    }
+    SEXP vec_ = PROTECT(alloc_df_column(alloc_type, nrows, &opt));
     
     // place vector into list
     SET_VECTOR_ELT(df_, col, vec_);
@@ -919,6 +1149,7 @@ SEXP parse_ndjson_str_as_df_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP nprobe_,
   // This might not be the same as 'nrow' as we can skip rows that we 
   // can't parse.
   int row = 0;
+  row_decoder_t *dec = row_decoder_create(&state->schema, sexp_type, &opt, state);
   
   for (unsigned int i = 0; i < nrows; i++) {
     yyjson_read_err err;
@@ -933,44 +1164,11 @@ SEXP parse_ndjson_str_as_df_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP nprobe_,
       error_and_destroy_state(state, "parse_ndjson_as_df() only works if all lines represent JSON objects");
     }
     
-    for (unsigned int col = 0; col < state->ncols; col++) {
-      SEXP column_ = VECTOR_ELT(df_, col);
-      
-      yyjson_val *val = yyjson_obj_get(obj, state->colnames[col]);
-      
-      switch(sexp_type[col]) {
-      case LGLSXP:
-        LOGICAL(column_)[row] = json_val_to_logical(val, &opt);
-        break;
-      case INTSXP:
-        INTEGER(column_)[row] = json_val_to_integer(val, &opt);
-        break;
-      case INT64SXP: {
-        long long tmp = json_val_to_integer64(val, &opt);
-        ((long long *)(REAL(column_)))[row] = tmp;
-      }
-        break;
-      case REALSXP:
-        REAL(column_)[row] = json_val_to_double(val, &opt);
-        break;
-      case STRSXP:
-        if (val == NULL) {
-          SET_STRING_ELT(column_, row, NA_STRING);
-        } else {
-          SET_STRING_ELT(column_, row, json_val_to_charsxp(val, &opt));
-        }
-        break;
-      case VECSXP:
-        if (val == NULL) {
-          SET_VECTOR_ELT(column_, row, opt.df_missing_list_elem);
-        } else {
-          SET_VECTOR_ELT(column_, row, json_as_robj(val, &opt, state));
-        }
-        break;
-      default:
-        error_and_destroy_state(state, "parse_ndjson_file_as_df_(): Unknown type");
-      } 
-      
+    // Rows which don't match the filter are not added to the data.frame
+    bool keep = row_matches_filter(obj, opt.filter);
+    
+    if (keep) {
+      fill_ndjson_row(df_, row, obj, dec);
     }
     
     yyjson_doc_free(state->doc);
@@ -984,14 +1182,194 @@ SEXP parse_ndjson_str_as_df_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP nprobe_,
     str_size -= (pos + 1);
     
     
-    row++;
+    if (keep) {
+      row++;
+    }
   }
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Promote the 'list' of accumulated vectors to be a real 'data.frame'
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   truncate_list_of_vectors(df_, row, nrows);
-  df_ = PROTECT(promote_list_to_data_frame(df_, state->colnames, state->ncols));  nprotect++;
+  
+  // Class attributes are set once the columns have reached their final length
+  for (int col = 0; col < state->schema.ncols; col++) {
+    if (sexp_type[col] == INT64SXP) {
+      SEXP att_val_ = PROTECT(Rf_mkString("integer64"));
+      Rf_setAttrib(VECTOR_ELT(df_, col), R_ClassSymbol, att_val_);
+      UNPROTECT(1);
+    }
+  }
+  
+  df_ = PROTECT(promote_list_to_data_frame(df_, state->schema.names, state->schema.ncols));  nprotect++;
+  
+  destroy_state(state);
+  UNPROTECT(nprotect);
+  return df_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parse a character vector into a data.frame. Each element is one record
+// (i.e. the equivalent of one line of NDJSON).
+//
+// This is the same probe + fill as 'parse_ndjson_str_as_df_()', but walks
+// the elements directly, so the vector never needs to be pasted into a
+// single (possibly > 2^31 bytes) string.
+//
+// NA elements become rows of missing values.  A 'filter' sees them as '{}',
+// so e.g. '~ is.null(a)' keeps them.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP parse_ndjson_strvec_as_df_(SEXP str_, SEXP nread_, SEXP nskip_, SEXP nprobe_, SEXP parse_opts_) {
+  
+  int nprotect = 0;
+  
+  if (!Rf_isString(str_)) {
+    Rf_error("parse_ndjson_strvec_as_df_(): 'x' must be a character vector");
+  }
+  
+  parse_options opt = create_parse_options(parse_opts_);
+  // Elements of 'str_' are R's own strings and must not be modified
+  opt.yyjson_read_flag &= ~YYJSON_READ_INSITU;
+  
+  int nread  = Rf_asInteger(nread_);
+  int nskip  = Rf_asInteger(nskip_);
+  int nprobe = Rf_asInteger(nprobe_);
+  
+  if (nread  <= 0) { nread  = INT32_MAX; }
+  if (nprobe <= 0) { nprobe = INT32_MAX; }
+  if (nskip  <  0) { nskip  = 0; }
+  
+  R_xlen_t n = Rf_xlength(str_);
+  if (n > INT32_MAX) {
+    Rf_error("parse_ndjson_strvec_as_df_(): Too many elements");
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Elements [start, end) are read
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  int start = nskip < n ? nskip : (int)n;
+  int nrows = (int)n - start;
+  nrows = nrows > nread ? nread : nrows;
+  int end = start + nrows;
+  
+  state_t *state = create_state();
+  unsigned int *sexp_type = NULL;
+  
+  // A user-supplied schema means no probing is needed
+  if (opt.ncol_types > 0) {
+    sexp_type = declare_ndjson_columns(&opt, state);
+    nprobe = 0;
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Probe the first 'nprobe' elements for column names + types
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  for (int i = start; i < end && i - start < nprobe; i++) {
+    SEXP elem_ = STRING_ELT(str_, i);
+    if (elem_ == NA_STRING) continue;
+    
+    yyjson_read_err err;
+    state->doc = yyjson_read_opts((char *)CHAR(elem_), (size_t)LENGTH(elem_), opt.yyjson_read_flag, NULL, &err);
+    if (state->doc == NULL) {
+      output_verbose_error(CHAR(elem_), (unsigned long)LENGTH(elem_), err);
+      error_and_destroy_state(state, "Couldn't parse JSON during probe element %i\n", i + 1);
+    }
+    
+    // Only probe the rows which will be kept
+    yyjson_val *obj = yyjson_doc_get_root(state->doc);
+    if (yyjson_is_obj(obj) && row_matches_filter(obj, opt.filter)) {
+      probe_ndjson_object(obj, &opt, state);
+    }
+    
+    yyjson_doc_free(state->doc);
+    state->doc = NULL;
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Allocate a vector for each column
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  SEXP df_ = PROTECT(Rf_allocVector(VECSXP, state->schema.ncols)); nprotect++;
+  
+  if (opt.ncol_types == 0) {
+    sexp_type = get_schema_sexp_types(&state->schema, &opt);
+  }
+  
+  for (int col = 0; col < state->schema.ncols; col++) {    
+    // INT64SXP is actually contained in a REALSXP
+    unsigned int alloc_type = sexp_type[col] == INT64SXP ? REALSXP : sexp_type[col];
+    SET_VECTOR_ELT(df_, col, alloc_df_column(alloc_type, nrows, &opt));
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Fill the data.frame one element at a time
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  int row = 0;
+  row_decoder_t *dec = row_decoder_create(&state->schema, sexp_type, &opt, state);
+  
+  // NA elements are filtered as if they were '{}' i.e. every key is missing.
+  // The empty doc lives in a stack buffer, so needs no freeing on error.
+  yyjson_val *na_obj = NULL;
+  yyjson_alc na_alc;
+  char na_buf[512];
+  if (opt.filter != NULL) {
+    if (yyjson_alc_pool_init(&na_alc, na_buf, sizeof(na_buf))) {
+      yyjson_doc *na_doc = yyjson_read_opts("{}", 2, 0, &na_alc, NULL);
+      na_obj = yyjson_doc_get_root(na_doc);
+    }
+    if (na_obj == NULL) {
+      error_and_destroy_state(state, "parse_ndjson_strvec_as_df_(): Couldn't create empty object");
+    }
+  }
+  
+  for (int i = start; i < end; i++) {
+    SEXP elem_ = STRING_ELT(str_, i);
+    
+    if (elem_ == NA_STRING) {
+      if (na_obj == NULL || row_matches_filter(na_obj, opt.filter)) {
+        row_decoder_fill(dec, df_, row, NULL);
+        row++;
+      }
+      continue;
+    }
+    
+    yyjson_read_err err;
+    state->doc = yyjson_read_opts((char *)CHAR(elem_), (size_t)LENGTH(elem_), opt.yyjson_read_flag, NULL, &err);
+    if (state->doc == NULL) {
+      output_verbose_error(CHAR(elem_), (unsigned long)LENGTH(elem_), err);
+      error_and_destroy_state(state, "Couldn't parse JSON in element %i\n", i + 1);
+    }
+    
+    yyjson_val *obj = yyjson_doc_get_root(state->doc);
+    if (yyjson_get_type(obj) != YYJSON_TYPE_OBJ) {
+      error_and_destroy_state(state, "parse_ndjson_as_df() only works if all lines represent JSON objects");
+    }
+    
+    // Rows which don't match the filter are not added to the data.frame
+    if (row_matches_filter(obj, opt.filter)) {
+      fill_ndjson_row(df_, row, obj, dec);
+      row++;
+    }
+    
+    yyjson_doc_free(state->doc);
+    state->doc = NULL;
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Promote the 'list' of accumulated vectors to be a real 'data.frame'
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  truncate_list_of_vectors(df_, row, nrows);
+  
+  // Class attributes are set once the columns have reached their final length
+  for (int col = 0; col < state->schema.ncols; col++) {
+    if (sexp_type[col] == INT64SXP) {
+      SEXP att_val_ = PROTECT(Rf_mkString("integer64"));
+      Rf_setAttrib(VECTOR_ELT(df_, col), R_ClassSymbol, att_val_);
+      UNPROTECT(1);
+    }
+  }
+  
+  df_ = PROTECT(promote_list_to_data_frame(df_, state->schema.names, state->schema.ncols));  nprotect++;
   
   destroy_state(state);
   UNPROTECT(nprotect);
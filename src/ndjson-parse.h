@@ -0,0 +1,20 @@
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Helpers shared between the NDJSON parsers
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP grow_list(SEXP oldlist);
+void grow_list_of_vectors(SEXP df_, int new_length);
+void truncate_list_of_vectors(SEXP df_, int data_length, int allocated_length);
+SEXP promote_list_to_data_frame(SEXP df_, char **colname, int ncols);
+void probe_ndjson_object(yyjson_val *obj, parse_options *opt, state_t *state);
+unsigned int *declare_ndjson_columns(parse_options *opt, state_t *state);
+unsigned int *get_schema_sexp_types(schema_t *schema, parse_options *opt);
+void fill_ndjson_row(SEXP df_, int row, yyjson_val *obj, row_decoder_t *dec);
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Multi-threaded NDJSON -> data.frame parser for uncompressed files.
+// See 'ndjson-parallel.c'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP parse_ndjson_file_as_df_parallel(const char *filename, int nread, int nskip,
+                                      int nprobe, int nthreads, 
+                                      uint64_t start, uint64_t end, parse_options *opt);
@@ -0,0 +1,246 @@
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "file-map.h"
+#include "decompress.h"
+#include "ndjson-reader.h"
+#include "ndjson-scan.h"
+
+// Initial size of the buffer. Grows as needed to hold a complete line.
+#define LINE_READER_INIT_CAPACITY 131072
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Free all resources held by the reader
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void line_reader_finalizer(SEXP reader_) {
+  line_reader_t *reader = (line_reader_t *)R_ExternalPtrAddr(reader_);
+  if (reader == NULL) return;
+  
+  if (reader->input != NULL) {
+    dstream_close(reader->input);
+  }
+  if (reader->map.data != NULL) {
+    file_map_close(&reader->map);  // 'buf' points into the map
+  } else {
+    free(reader->buf);
+  }
+  free(reader);
+  R_ClearExternalPtr(reader_);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Open a reader. 
+// Uncompressed regular files are memory-mapped.  Everything else is read
+// through a decompression stream (gzip, zstd, LZ4, xz or uncompressed).
+// Blocked gzip is decompressed on 'nthreads' threads.  Other compressed
+// files are decompressed on a separate thread, ahead of line splitting and
+// parsing on this one.
+//
+// 'line_reader_open_at()' starts reading at 'offset' bytes into the 
+// (decompressed) data, which should be the start of a line.  gzip files 
+// are inflated from 'point' (if not NULL).  See 'ndjson-index.c'
+//
+// @return external pointer to a 'line_reader_t'.  Caller must PROTECT()
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP line_reader_open(const char *filename, int nthreads) {
+  return line_reader_open_at(filename, nthreads, NULL, 0);
+}
+
+
+SEXP line_reader_open_at(const char *filename, int nthreads, const dstream_point_t *point, uint64_t offset) {
+  
+  line_reader_t *reader = calloc(1, sizeof(line_reader_t));
+  if (reader == NULL) {
+    Rf_error("line_reader_open(): Couldn't allocate reader");
+  }
+  
+  SEXP reader_ = PROTECT(R_MakeExternalPtr(reader, R_NilValue, R_NilValue));
+  R_RegisterCFinalizer(reader_, line_reader_finalizer);
+  
+#ifndef _WIN32
+  if (is_regular_file(filename) && detect_compression(filename) == COMPRESSION_NONE && 
+      file_map_open(filename, &reader->map)) {
+    // The entire file is already in the buffer
+    reader->buf      = (char *)reader->map.data;
+    reader->capacity = reader->map.len;
+    reader->len      = reader->map.len;
+    reader->pos      = offset < reader->len ? (size_t)offset : reader->len;
+    reader->eof      = true;
+    UNPROTECT(1);
+    return reader_;
+  }
+#endif
+  
+  reader->buf = malloc(LINE_READER_INIT_CAPACITY);
+  if (reader->buf == NULL) {
+    Rf_error("line_reader_open(): Couldn't allocate buffer");
+  }
+  reader->capacity = LINE_READER_INIT_CAPACITY;
+  
+  const char *errmsg;
+  if (point == NULL && offset == 0) {
+    reader->input = dstream_open(filename, nthreads, &errmsg);
+  } else {
+    reader->input = dstream_open_at(filename, point, offset, &errmsg);
+  }
+  if (reader->input == NULL) {
+    Rf_error("Couldn't open file '%s': %s", filename, errmsg);
+  }
+  dstream_start_readahead(reader->input);
+  
+  UNPROTECT(1);
+  return reader_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Fetch the reader from the external pointer
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+line_reader_t *line_reader_get(SEXP reader_) {
+  line_reader_t *reader = (line_reader_t *)R_ExternalPtrAddr(reader_);
+  if (reader == NULL) {
+    Rf_error("line_reader_get(): Reader has been closed");
+  }
+  return reader;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Close the reader now, rather than waiting for the garbage collector
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void line_reader_close(SEXP reader_) {
+  line_reader_finalizer(reader_);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read more data into the buffer.
+//   - unconsumed data is moved to the start of the buffer
+//   - if the buffer is still full (i.e. a single line fills the entire 
+//     buffer), then the buffer is doubled in size
+//
+// @return number of bytes read. 0 at end of input
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static size_t line_reader_fill(line_reader_t *reader) {
+  // Note: a memory-mapped reader is always at 'eof'
+  if (reader->eof) return 0;
+  
+  if (reader->pos > 0) {
+    memmove(reader->buf, reader->buf + reader->pos, reader->len - reader->pos);
+    reader->len -= reader->pos;
+    reader->pos  = 0;
+  }
+  
+  if (reader->len == reader->capacity) {
+    size_t new_capacity = 2 * reader->capacity;
+    char *new_buf = realloc(reader->buf, new_capacity);
+    if (new_buf == NULL) {
+      Rf_error("line_reader: Couldn't grow buffer to %.0f bytes", (double)new_capacity);
+    }
+    reader->buf      = new_buf;
+    reader->capacity = new_capacity;
+  }
+  
+  ptrdiff_t nbytes = dstream_read(reader->input, reader->buf + reader->len, reader->capacity - reader->len);
+  if (nbytes < 0) {
+    Rf_error("line_reader: Error reading input: %s", dstream_error(reader->input));
+  }
+  if (nbytes == 0) {
+    reader->eof = true;
+  }
+  
+  reader->len += (size_t)nbytes;
+  return (size_t)nbytes;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Get the next line
+//
+// The returned pointer is into the reader's buffer and is only valid until
+// the next call.  The line is not nul-terminated.  
+//
+// @param line_len length of the line (not including the '\n')
+// @return pointer to start of line, or NULL when there are no more lines
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+const char *line_reader_next(line_reader_t *reader, size_t *line_len) {
+  
+  size_t scanned = reader->pos;
+  
+  for (;;) {
+    const char *nl = scan_newline(reader->buf + scanned, reader->buf + reader->len);
+    if (nl != NULL) {
+      const char *line = reader->buf + reader->pos;
+      *line_len = (size_t)(nl - line);
+      reader->pos = (size_t)(nl - reader->buf) + 1;
+      return line;
+    }
+    
+    // No newline in the buffered data. Read more (which may move the data)
+    size_t offset = reader->len - reader->pos;
+    if (line_reader_fill(reader) == 0) {
+      break;
+    }
+    scanned = reader->pos + offset;
+  }
+  
+  // End of input. Any remaining data is the final line without a newline
+  if (reader->pos < reader->len) {
+    const char *line = reader->buf + reader->pos;
+    *line_len = reader->len - reader->pos;
+    reader->pos = reader->len;
+    return line;
+  }
+  
+  return NULL;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Skip lines
+//
+// @return number of lines actually skipped
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+size_t line_reader_skip(line_reader_t *reader, size_t nlines) {
+  size_t nskipped = 0;
+  
+  while (nskipped < nlines) {
+    // Skip complete lines in the buffered data. 
+    // For memory-mapped files this is the entire file.
+    const char *p   = reader->buf + reader->pos;
+    const char *end = reader->buf + reader->len;
+    while (nskipped < nlines) {
+      const char *nl = scan_newline(p, end);
+      if (nl == NULL) break;
+      p = nl + 1;
+      nskipped++;
+    }
+    reader->pos = (size_t)(p - reader->buf);
+    
+    if (nskipped == nlines) break;
+    
+    // Only a partial line remains in the buffer. Read more.
+    if (line_reader_fill(reader) == 0) {
+      // End of input. Any remaining data is the final line without a newline
+      if (reader->pos < reader->len) {
+        reader->pos = reader->len;
+        nskipped++;
+      }
+      break;
+    }
+  }
+  
+  return nskipped;
+}
@@ -0,0 +1,30 @@
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Line reader for NDJSON files
+//
+// Hands out lines as pointers into a buffer i.e. no copying of each line.
+//   - Uncompressed regular files are memory-mapped, and the buffer is 
+//     the mapped file
+//   - Otherwise blocks of (possibly compressed) input are read into a heap 
+//     buffer.  The buffer grows as needed, so there is no limit on 
+//     line length.
+//
+// The reader is held in an external pointer so it is closed by the 
+// garbage collector if an R error occurs during parsing.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct {
+  dstream_t *input;
+  file_map_t map;
+  char *buf;
+  size_t capacity;
+  size_t pos;     // start of unconsumed data in 'buf'
+  size_t len;     // end of valid data in 'buf'
+  bool eof;
+} line_reader_t;
+
+SEXP line_reader_open(const char *filename, int nthreads);
+SEXP line_reader_open_at(const char *filename, int nthreads, const dstream_point_t *point, uint64_t offset);
+line_reader_t *line_reader_get(SEXP reader_);
+void line_reader_close(SEXP reader_);
+
+const char *line_reader_next(line_reader_t *reader, size_t *line_len);
+size_t line_reader_skip(line_reader_t *reader, size_t nlines);
@@ -0,0 +1,148 @@
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ndjson-scan.h"
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Newline scanning for NDJSON
+//
+// Finding the record boundaries in NDJSON is just finding the '\n' bytes.
+// On x86_64, SSE2 is always available, and AVX2 is used if the CPU
+// supports it (checked at runtime).  Other platforms use a scalar fallback.
+//
+// No R API calls are made in this file, so these functions are safe to 
+// call from worker threads.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define NDJSON_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+
+//===========================================================================
+// Scalar
+//===========================================================================
+static const char *scan_newline_scalar(const char *p, const char *end) {
+  return memchr(p, '\n', (size_t)(end - p));
+}
+
+static size_t count_newlines_scalar(const char *p, const char *end) {
+  size_t count = 0;
+  while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+    count++;
+    p++;
+  }
+  return count;
+}
+
+
+#ifdef NDJSON_SCAN_X86
+//===========================================================================
+// SSE2 - 16 bytes at a time
+//===========================================================================
+static const char *scan_newline_sse2(const char *p, const char *end) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  
+  while (end - p >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+  
+  return scan_newline_scalar(p, end);
+}
+
+static size_t count_newlines_sse2(const char *p, const char *end) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  size_t count = 0;
+  
+  while (end - p >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl));
+    count += (size_t)__builtin_popcount(mask);
+    p += 16;
+  }
+  
+  return count + count_newlines_scalar(p, end);
+}
+
+
+//===========================================================================
+// AVX2 - 32 bytes at a time
+//===========================================================================
+__attribute__((target("avx2")))
+static const char *scan_newline_avx2(const char *p, const char *end) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  
+  while (end - p >= 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, nl));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 32;
+  }
+  
+  return scan_newline_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static size_t count_newlines_avx2(const char *p, const char *end) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  size_t count = 0;
+  
+  while (end - p >= 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, nl));
+    count += (size_t)__builtin_popcount(mask);
+    p += 32;
+  }
+  
+  return count + count_newlines_sse2(p, end);
+}
+#endif
+
+
+//===========================================================================
+// Runtime dispatch
+//===========================================================================
+static const char *(*scan_newline_fn)(const char *p, const char *end) = scan_newline_scalar;
+static size_t (*count_newlines_fn)(const char *p, const char *end) = count_newlines_scalar;
+
+void ndjson_scan_init(void) {
+#ifdef NDJSON_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    scan_newline_fn   = scan_newline_avx2;
+    count_newlines_fn = count_newlines_avx2;
+  } else {
+    scan_newline_fn   = scan_newline_sse2;
+    count_newlines_fn = count_newlines_sse2;
+  }
+#endif
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Find the next '\n' in [p, end)
+// @return pointer to the '\n' or NULL if there isn't one
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+const char *scan_newline(const char *p, const char *end) {
+  if (p >= end) return NULL;
+  return scan_newline_fn(p, end);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Count the '\n' in [p, end)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+size_t count_newlines(const char *p, const char *end) {
+  if (p >= end) return 0;
+  return count_newlines_fn(p, end);
+}
@@ -0,0 +1,11 @@
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Vectorised newline scanning. See 'ndjson-scan.c'
+//
+// Call 'ndjson_scan_init()' once (from R_init_yyjsonr()) to select the 
+// fastest implementation supported by the CPU.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void ndjson_scan_init(void);
+
+const char *scan_newline(const char *p, const char *end);
+size_t count_newlines(const char *p, const char *end);
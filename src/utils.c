@@ -6,12 +6,19 @@
 #include <Rdefines.h>
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <time.h>
 
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
 #include "yyjson.h"
 #include "R-yyjson-serialize.h"
+#include "decompress.h"
 
 
 
@@ -21,3 +28,97 @@
 SEXP yyjson_version_(void) {
   return Rf_mkString(YYJSON_VERSION_STRING);
 }
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Peak resident set size of this process (in bytes).  NA if unknown.
+// Used for checking the memory use of parsing large files.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP peak_rss_(void) {
+#ifndef _WIN32
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+    return Rf_ScalarReal((double)usage.ru_maxrss);          // bytes
+#else
+    return Rf_ScalarReal((double)usage.ru_maxrss * 1024.0); // kilobytes
+#endif
+  }
+#endif
+  return Rf_ScalarReal(NA_REAL);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read-ahead decompression counters for the most recently closed stream.
+// Shows whether decompression or parsing was the bottleneck.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP readahead_stats_(void) {
+  readahead_stats_t stats = dstream_last_readahead_stats();
+  
+  SEXP res_ = PROTECT(Rf_allocVector(REALSXP, 3));
+  SEXP nms_ = PROTECT(Rf_allocVector(STRSXP, 3));
+  REAL(res_)[0] = stats.blocks;
+  REAL(res_)[1] = stats.producer_stalls;
+  REAL(res_)[2] = stats.reader_stalls;
+  SET_STRING_ELT(nms_, 0, Rf_mkChar("blocks"));
+  SET_STRING_ELT(nms_, 1, Rf_mkChar("producer_stalls"));
+  SET_STRING_ELT(nms_, 2, Rf_mkChar("reader_stalls"));
+  Rf_setAttrib(res_, R_NamesSymbol, nms_);
+  
+  UNPROTECT(2);
+  return res_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Compiled options handles.
+//
+// An external pointer to an already-populated C options struct, so that 
+// the R list of options doesn't need to be re-parsed on every call.
+//
+//   - the tag identifies the type of struct e.g. 'yyjson_parse_options'
+//   - the original R list is kept in the 'prot' slot (so that any CHARSXPs 
+//     the struct points to stay alive), and also in the "opts" attribute, 
+//     so options can still be modified in R (see 'modify_list()')
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP make_options_handle(void *opt, const char *tag, SEXP opts_, 
+                         R_CFinalizer_t finalizer, const char *cls) {
+  
+  SEXP handle_ = PROTECT(R_MakeExternalPtr(opt, Rf_install(tag), opts_));
+  R_RegisterCFinalizer(handle_, finalizer);
+  
+  Rf_setAttrib(handle_, Rf_install("opts"), opts_);
+  
+  SEXP cls_ = PROTECT(Rf_allocVector(STRSXP, 2));
+  SET_STRING_ELT(cls_, 0, Rf_mkChar(cls));
+  SET_STRING_ELT(cls_, 1, Rf_mkChar("yyjson_compiled_opts"));
+  Rf_setAttrib(handle_, R_ClassSymbol, cls_);
+  
+  UNPROTECT(2);
+  return handle_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Get the C options struct from a compiled options handle.
+//
+// @return NULL if 'opts_' is not a handle (i.e. it is an R list of options)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void *get_options_handle(SEXP opts_, const char *tag) {
+  
+  if (TYPEOF(opts_) != EXTPTRSXP) {
+    return NULL;
+  }
+  
+  if (R_ExternalPtrTag(opts_) != Rf_install(tag)) {
+    Rf_error("Compiled options are of the wrong type. Expected '%s'", tag);
+  }
+  
+  void *opt = R_ExternalPtrAddr(opts_);
+  if (opt == NULL) {
+    Rf_error("Compiled options are no longer valid (handles can't be saved and re-loaded)");
+  }
+  
+  return opt;
+}
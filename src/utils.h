@@ -6,3 +6,7 @@ void truncate_list_of_vectors(SEXP df_, int data_length, int allocated_length);
 SEXP promote_list_to_data_frame(SEXP df_, char **colname, int ncols);
 int df_col_idx(SEXP df_, const char *nm);
 
+
+SEXP make_options_handle(void *opt, const char *tag, SEXP opts_, 
+                         R_CFinalizer_t finalizer, const char *cls);
+void *get_options_handle(SEXP opts_, const char *tag);